@@ -1,8 +1,26 @@
 #!/bin/sh
 
-./map-linux/build/bench-map-linux-random | sed -e 's/^/old-map, /' > bench.txt
-./map-linux/build/bench-map-linux-sequential | sed -e 's/^/old-map, /' >> bench.txt
-./map-jemalloc/build/bench-map-jemalloc-random | sed -e 's/^/proposed-map, /' >> bench.txt
-./map-jemalloc/build/bench-map-jemalloc-sequential | sed -e 's/^/proposed-map, /' >> bench.txt
+./map-linux/build/bench-map-linux "$@" | sed -e 's/^/old-map, /' > bench.txt
+./map-jemalloc/build/bench-map-jemalloc "$@" | sed -e 's/^/proposed-map, /' >> bench.txt
+./map-compact/build/bench-map-compact "$@" | sed -e 's/^/compact-map, /' >> bench.txt
+./map-btree/build/bench-map-btree "$@" | sed -e 's/^/btree-map, /' >> bench.txt
+./map-rcu/build/bench-map-rcu "$@" | sed -e 's/^/rcu-map, /' >> bench.txt
+
+# the cost of the subtree sizes of map_rank() and map_select()
+./map-linux/build/bench-map-linux-ostat "$@" | sed -e 's/^/old-map-ostat, /' >> bench.txt
+./map-jemalloc/build/bench-map-jemalloc-ostat "$@" | sed -e 's/^/proposed-map-ostat, /' >> bench.txt
+
+# The multi-threaded and the storm benchmarks only report total times, of
+# their own workloads, so they go to a file of their own.
+rm -f bench-threads.txt
+case " $* " in
+*" -l "*) ;;
+*)
+    ./map-jemalloc/build/bench-map-jemalloc-shards | sed -e 's/^/proposed-map, /' > bench-threads.txt
+    ./map-rcu/build/bench-map-rcu-threads | sed -e 's/^/rcu-map, /' >> bench-threads.txt
+    ./map-linux/build/storm-map-linux | sed -e 's/^/old-map, /' >> bench-threads.txt
+    ./map-jemalloc/build/storm-map-jemalloc | sed -e 's/^/proposed-map, /' >> bench-threads.txt
+    ;;
+esac
 
 ./plot.py
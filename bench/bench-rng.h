@@ -0,0 +1,74 @@
+/*
+ * rv32emu is freely redistributable under the MIT License. See the file
+ * "LICENSE" for information on usage and redistribution of this file.
+ */
+
+/*
+ * Pseudo-random numbers for the benchmarks.
+ *
+ * xoshiro256** seeded through splitmix64, see https://prng.di.unimi.it/, so
+ * that a seed gives the same keys on every platform, unlike rand().
+ */
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+typedef struct {
+    uint64_t s[4];
+} rng_t;
+
+static inline void rng_seed(rng_t *rng, uint64_t seed)
+{
+    for (int i = 0; i < 4; i++) {
+        uint64_t z = (seed += UINT64_C(0x9e3779b97f4a7c15));
+        z = (z ^ (z >> 30)) * UINT64_C(0xbf58476d1ce4e5b9);
+        z = (z ^ (z >> 27)) * UINT64_C(0x94d049bb133111eb);
+        rng->s[i] = z ^ (z >> 31);
+    }
+}
+
+static inline uint64_t rotl(uint64_t x, int k)
+{
+    return (x << k) | (x >> (64 - k));
+}
+
+static inline uint64_t rng_next(rng_t *rng)
+{
+    uint64_t *s = rng->s;
+    uint64_t result = rotl(s[1] * 5, 7) * 9, t = s[1] << 17;
+    s[2] ^= s[0];
+    s[3] ^= s[1];
+    s[1] ^= s[2];
+    s[0] ^= s[3];
+    s[2] ^= t;
+    s[3] = rotl(s[3], 45);
+    return result;
+}
+
+/* Uniform in [0, @n), rejecting the draws that would bias the modulo */
+static inline size_t rng_below(rng_t *rng, size_t n)
+{
+    uint64_t limit = UINT64_MAX - UINT64_MAX % n, x;
+    do
+        x = rng_next(rng);
+    while (x >= limit);
+    return (size_t) (x % n);
+}
+
+/* Uniform in [0, 1) */
+static inline double rng_unit(rng_t *rng)
+{
+    return (rng_next(rng) >> 11) * 0x1.0p-53;
+}
+
+/* Fisher-Yates shuffle of the @n elements of @a */
+static inline void shuffle(rng_t *rng, size_t *a, size_t n)
+{
+    for (size_t i = n; i > 1; i--) {
+        size_t j = rng_below(rng, i), tmp = a[i - 1];
+        a[i - 1] = a[j];
+        a[j] = tmp;
+    }
+}
@@ -0,0 +1,852 @@
+/*
+ * rv32emu is freely redistributable under the MIT License. See the file
+ * "LICENSE" for information on usage and redistribution of this file.
+ */
+
+/*
+ * Workload-driven benchmark of the maps.
+ *
+ * This driver is built once for each backend, against the map.h of the
+ * backend, as bench-map-<backend>. The optional parts of the API are measured
+ * when the build of the backend defines:
+ *   MAP_HAS_ERASE_KEY    map_erase_key(), instead of map_find() + map_erase()
+ *   MAP_HAS_INSERT_HINT  map_insert_hint()
+ *   MAP_HAS_BUILD_SORTED map_build_sorted()
+ *   MAP_HAS_ITERATION    map_last(), map_prev() and map_range_foreach()
+ *   MAP_HAS_FIND_BATCH   map_find_batch()
+ *   MAP_HAS_CACHE        map_cache_enable()
+ *   MAP_HAS_FREEZE       map_freeze() and map_frozen_find()
+ *   MAP_HAS_TYPED        MAP_DEFINE() of map-typed.h
+ *   MAP_HAS_STATS        map_stats()
+ *   MAP_HAS_LAZY_ERASE   map_lazy_enable(), for the bursts of removals
+ *   MAP_HAS_ERASE_RANGE  map_erase_range(), instead of a removal per key
+ *   MAP_ORDER_STATS      map_rank() and map_select(), on nodes that keep the
+ *                        sizes of their subtrees, built as
+ *                        bench-map-<backend>-ostat to weigh the cost of the
+ *                        sizes on the other operations
+ *
+ * usage: bench-map-<backend> [-d dists] [-l] [-M] [-m insert:find:erase]
+ *                            [-n scales] [-p] [-r reps] [-s seed] [-z theta]
+ *
+ *   -d  comma-separated distributions of the keys, among
+ *         random      every key once, in a uniformly random order
+ *         sequential  every key once, in ascending order
+ *         clustered   runs of BENCH_RUN ascending keys, in a random order
+ *         zipf        random insertions, then lookups drawn from a Zipf
+ *                     distribution whose hottest keys are scattered
+ *       (default: random,sequential)
+ *   -l  time each operation on its own, and report the percentiles of the
+ *       latencies instead of the total times
+ *   -M  print the footprint and the shape of the map once all the keys are
+ *       inserted, to stderr
+ *   -m  interleave the insertions, lookups and removals in these proportions
+ *       over the keys of the lookups, after inserting half of the keys,
+ *       instead of timing each operation in a phase of its own
+ *   -n  comma-separated numbers of keys (default: 1e3,1e4,1e5,1e6)
+ *   -p  count hardware events over each phase with perf_event_open(2)
+ *   -r  repetitions of each measure (default: 20)
+ *   -s  seed of the pseudo-random generator (default: 1)
+ *   -z  exponent of the Zipf distribution (default: 0.99)
+ *
+ * Each line of the output reads "time, distribution, operation, scale, reps",
+ * where the time in nanoseconds covers @scale operations and @reps counts the
+ * repetitions left, the format bench.sh and plot.py expect.
+ *
+ * With -p, each line goes on with the numbers of cycles, instructions, L1D
+ * read misses, LLC misses, dTLB read misses and branch mispredictions per
+ * operation, extrapolated when the kernel multiplexes the counters, and "nan"
+ * for the counters the kernel or the CPU does not provide. Only the events of
+ * user space are counted, which perf_event_paranoid up to 2 allows.
+ *
+ * With -l, each line reads "distribution, operation, scale, count, p50, p90,
+ * p99, p99.9, max", the latencies in nanoseconds of the @count operations of
+ * all the repetitions. The operations that work on many keys at once, such as
+ * the scans, the bulk loads, the bursts, the ranges erased at once and the
+ * batched lookups, are left out. Every latency includes the cost of reading
+ * the clock, a few tens of nanoseconds.
+ *
+ * With -M, the last repetition of each distribution and scale prints "dist,
+ * scale, heap, useful, extra, height, average depth, red, black" to stderr,
+ * where the useful bytes are those of the keys and values, and the extra
+ * ones all the others the map holds.
+ */
+
+#include <assert.h>
+#include <inttypes.h>
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+#endif
+
+#include "bench-rng.h"
+#include "map.h"
+#ifdef MAP_HAS_TYPED
+#include "map-typed.h"
+#endif
+
+/* length of the runs of the clustered keys */
+#define BENCH_RUN 64
+
+/* keys per call to map_find_batch() */
+#define BENCH_BATCH 64
+
+/* slots of the lookup cache */
+#define BENCH_CACHE 4096
+
+/* keys erased then inserted back by each burst */
+#define BENCH_BURST 1024
+
+/* percentage of dead nodes that triggers a purge in the lazy bursts */
+#define BENCH_LAZY 50
+
+/* keys of each range erased at once, aligned on a multiple of it */
+#define BENCH_RANGE 64
+
+/* Each power of two of the latencies is split into 2^HIST_SUB_BITS buckets,
+ * so that every bucket is within 1 / 2^HIST_SUB_BITS of its values.
+ */
+#define HIST_SUB_BITS 5
+#define HIST_BUCKETS (64 << HIST_SUB_BITS)
+
+/* operations timed at once with -l */
+#define BENCH_HISTS 32
+
+/* The comparators of the backends return either int or map_cmp_t */
+typedef __typeof__(map_cmp_int(NULL, NULL)) bench_cmp_t;
+
+static bench_cmp_t bench_cmp_sizet(const void *arg0, const void *arg1)
+{
+    size_t a = *(const size_t *) arg0, b = *(const size_t *) arg1;
+    return (a < b) ? _CMP_LESS : (a > b) ? _CMP_GREATER : _CMP_EQUAL;
+}
+
+#ifdef MAP_HAS_TYPED
+MAP_DEFINE(sizetmap, size_t, size_t, MAP_CMP_SCALAR)
+#endif
+
+/* The keys 0 to @scale - 1, in the orders of a distribution */
+typedef struct {
+    const char *dist;
+    size_t scale;
+    size_t *order;   /* every key once, for the insertions and removals */
+    size_t *lookups; /* @scale keys to look up */
+    size_t *sorted;  /* every key once, ascending */
+} workload_t;
+
+static bool workload_init(workload_t *w,
+                          const char *dist,
+                          size_t scale,
+                          double theta,
+                          rng_t *rng)
+{
+    w->dist = dist;
+    w->scale = scale;
+    w->order = malloc(scale * sizeof(size_t));
+    w->lookups = malloc(scale * sizeof(size_t));
+    w->sorted = malloc(scale * sizeof(size_t));
+    assert(w->order && w->lookups && w->sorted);
+
+    for (size_t i = 0; i < scale; i++)
+        w->sorted[i] = w->order[i] = i;
+
+    if (!strcmp(dist, "random") || !strcmp(dist, "zipf")) {
+        shuffle(rng, w->order, scale);
+    } else if (!strcmp(dist, "clustered")) {
+        size_t runs = (scale + BENCH_RUN - 1) / BENCH_RUN, k = 0;
+        size_t *run = malloc(runs * sizeof(size_t));
+        assert(run);
+        for (size_t i = 0; i < runs; i++)
+            run[i] = i;
+        shuffle(rng, run, runs);
+        for (size_t i = 0; i < runs; i++) {
+            for (size_t j = run[i] * BENCH_RUN;
+                 j < (run[i] + 1) * BENCH_RUN && j < scale; j++)
+                w->order[k++] = j;
+        }
+        free(run);
+    } else if (strcmp(dist, "sequential")) {
+        return false;
+    }
+
+    if (strcmp(dist, "zipf")) {
+        memcpy(w->lookups, w->order, scale * sizeof(size_t));
+        return true;
+    }
+
+    /* rank r is drawn with a weight of 1 / r^theta, and is the key at r in
+     * the random order.
+     */
+    double *cdf = malloc(scale * sizeof(double)), sum = 0;
+    assert(cdf);
+    for (size_t i = 0; i < scale; i++)
+        cdf[i] = (sum += pow((double) (i + 1), -theta));
+    for (size_t i = 0; i < scale; i++) {
+        double u = rng_unit(rng) * sum;
+        size_t lo = 0, hi = scale - 1;
+        while (lo < hi) {
+            size_t mid = (lo + hi) / 2;
+            if (cdf[mid] < u)
+                lo = mid + 1;
+            else
+                hi = mid;
+        }
+        w->lookups[i] = w->order[lo];
+    }
+    free(cdf);
+    return true;
+}
+
+static void workload_free(workload_t *w)
+{
+    free(w->order);
+    free(w->lookups);
+    free(w->sorted);
+}
+
+/* Log-bucketed histogram of latencies, after HdrHistogram */
+typedef struct {
+    char dist[32], op[32];
+    uint64_t count, max;
+    uint64_t buckets[HIST_BUCKETS];
+} hist_t;
+
+/* The histograms of the current distribution and scale, if -l is given */
+static bool latency;
+static hist_t hists[BENCH_HISTS];
+static size_t n_hists;
+
+static inline uint64_t now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/* Bucket of @value: the values below 2^(HIST_SUB_BITS + 1) have one bucket
+ * each, and above, the HIST_SUB_BITS bits after the leading one of @value
+ * pick one of the buckets of its power of two.
+ */
+static inline unsigned hist_bucket(uint64_t value)
+{
+    int msb = 63 - __builtin_clzll(value | 1);
+    int shift = msb > HIST_SUB_BITS ? msb - HIST_SUB_BITS : 0;
+    return (unsigned) ((shift << HIST_SUB_BITS) + (value >> shift));
+}
+
+/* Largest value in @bucket */
+static uint64_t hist_value(unsigned bucket)
+{
+    if (bucket < (2 << HIST_SUB_BITS))
+        return bucket;
+    int shift = (bucket >> HIST_SUB_BITS) - 1;
+    uint64_t top = bucket - ((uint64_t) shift << HIST_SUB_BITS);
+    return ((top + 1) << shift) - 1;
+}
+
+static inline void hist_record(hist_t *h, uint64_t value)
+{
+    h->buckets[hist_bucket(value)]++;
+    h->count++;
+    if (value > h->max)
+        h->max = value;
+}
+
+/* Smallest latency not exceeded by the fraction @q of the operations */
+static uint64_t hist_quantile(const hist_t *h, double q)
+{
+    uint64_t rank = (uint64_t) ceil(q * h->count), seen = 0;
+    for (unsigned i = 0; i < HIST_BUCKETS; i++) {
+        seen += h->buckets[i];
+        if (seen >= rank && seen)
+            return hist_value(i) < h->max ? hist_value(i) : h->max;
+    }
+    return h->max;
+}
+
+/* Histogram of the operations @op, or NULL when the latencies are not
+ * recorded.
+ */
+static hist_t *hist_get(const char *dist, const char *op)
+{
+    if (!latency)
+        return NULL;
+    for (size_t i = 0; i < n_hists; i++) {
+        if (!strcmp(hists[i].dist, dist) && !strcmp(hists[i].op, op))
+            return hists + i;
+    }
+    assert(n_hists < BENCH_HISTS);
+    hist_t *h = hists + n_hists++;
+    memset(h, 0, sizeof(*h));
+    snprintf(h->dist, sizeof(h->dist), "%s", dist);
+    snprintf(h->op, sizeof(h->op), "%s", op);
+    return h;
+}
+
+/* Print the percentiles of the histograms, and start over */
+static void hist_report(size_t scale)
+{
+    for (size_t i = 0; i < n_hists; i++) {
+        const hist_t *h = hists + i;
+        printf("%s, %s, %zu, %" PRIu64 ", %" PRIu64 ", %" PRIu64 ", %" PRIu64
+               ", %" PRIu64 ", %" PRIu64 "\n",
+               h->dist, h->op, scale, h->count, hist_quantile(h, 0.5),
+               hist_quantile(h, 0.9), hist_quantile(h, 0.99),
+               hist_quantile(h, 0.999), h->max);
+    }
+    n_hists = 0;
+}
+
+/* Run the statement @op, timing it into the histogram @h unless NULL */
+#define TIMED(h, op)                            \
+    do {                                        \
+        uint64_t start_ = (h) ? now_ns() : 0;   \
+        op;                                     \
+        if (h)                                  \
+            hist_record(h, now_ns() - start_);  \
+    } while (0)
+
+/* Hardware event counters of -p */
+#define N_COUNTERS 6
+
+static const char *const counter_names[N_COUNTERS] = {
+    "cycles",      "instructions", "l1d-misses",
+    "llc-misses",  "dtlb-misses",  "branch-misses",
+};
+
+/* The descriptors of the counters, -1 when not counted */
+static int counters[N_COUNTERS] = {-1, -1, -1, -1, -1, -1};
+static bool counting;
+
+/* Value of a counter, and the times it was enabled and running */
+typedef struct {
+    uint64_t value, enabled, running;
+} counter_read_t;
+
+/* Start of a phase */
+typedef struct {
+    struct timespec time;
+    counter_read_t counts[N_COUNTERS];
+} phase_t;
+
+#ifdef __linux__
+static int counter_open(int i)
+{
+#define CACHE_MISS(cache)                                              \
+    (PERF_COUNT_HW_CACHE_##cache | (PERF_COUNT_HW_CACHE_OP_READ << 8) | \
+     (PERF_COUNT_HW_CACHE_RESULT_MISS << 16))
+    static const struct {
+        uint32_t type;
+        uint64_t config;
+    } events[N_COUNTERS] = {
+        {PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES},
+        {PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS},
+        {PERF_TYPE_HW_CACHE, CACHE_MISS(L1D)},
+        {PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES},
+        {PERF_TYPE_HW_CACHE, CACHE_MISS(DTLB)},
+        {PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES},
+    };
+#undef CACHE_MISS
+    struct perf_event_attr attr;
+
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = events[i].type;
+    attr.config = events[i].config;
+    attr.read_format =
+        PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    return (int) syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+}
+#else
+static int counter_open(int i)
+{
+    (void) i;
+    return -1;
+}
+#endif
+
+/* Open the counters, warning about those that are not available */
+static void counters_open(void)
+{
+    counting = true;
+    for (int i = 0; i < N_COUNTERS; i++) {
+        counters[i] = counter_open(i);
+        if (counters[i] < 0)
+            fprintf(stderr, "bench: %s not counted\n", counter_names[i]);
+    }
+}
+
+static void counters_read(counter_read_t *counts)
+{
+    for (int i = 0; i < N_COUNTERS; i++) {
+        if (counters[i] < 0 ||
+            read(counters[i], counts + i, sizeof(*counts)) != sizeof(*counts))
+            memset(counts + i, 0, sizeof(*counts));
+    }
+}
+
+static void phase_begin(phase_t *phase)
+{
+    if (counting)
+        counters_read(phase->counts);
+    clock_gettime(CLOCK_MONOTONIC, &phase->time);
+}
+
+/* Print the time since @before, for @w->scale operations @op */
+static void report(const phase_t *before,
+                   const workload_t *w,
+                   const char *dist,
+                   const char *op,
+                   size_t reps)
+{
+    struct timespec after;
+    counter_read_t counts[N_COUNTERS];
+    clock_gettime(CLOCK_MONOTONIC, &after);
+    if (counting)
+        counters_read(counts);
+    if (latency)
+        return;
+    double result = (after.tv_sec - before->time.tv_sec) * 1000000000UL +
+                    (after.tv_nsec - before->time.tv_nsec);
+    printf("%f, %s, %s, %zu, %zu", result, dist, op, w->scale, reps);
+
+    for (int i = 0; counting && i < N_COUNTERS; i++) {
+        const counter_read_t *c0 = before->counts + i, *c1 = counts + i;
+        uint64_t running = c1->running - c0->running;
+        if (!running) {
+            printf(", nan");
+            continue;
+        }
+        /* scale up to the whole phase, if the counter was multiplexed */
+        double value = (double) (c1->value - c0->value) *
+                       (c1->enabled - c0->enabled) / running;
+        printf(", %.3f", value / w->scale);
+    }
+    printf("\n");
+}
+
+/* Print the footprint and the shape of the map, with -M */
+static bool memory;
+
+static void report_stats(map_t tree, const workload_t *w, size_t reps)
+{
+#ifdef MAP_HAS_STATS
+    if (!memory || reps != 1)
+        return;
+    map_stats_t stats;
+    map_stats(tree, &stats);
+    size_t useful = stats.key_bytes + stats.data_bytes;
+    fprintf(stderr, "%s, %zu, %zu, %zu, %zu, %zu, %.2f, %zu, %zu\n", w->dist,
+            w->scale, stats.heap_bytes, useful, stats.heap_bytes - useful,
+            stats.height, stats.avg_depth, stats.red, stats.black);
+#else
+    (void) tree, (void) w, (void) reps;
+#endif
+}
+
+static bool erase_key(map_t tree, size_t *key)
+{
+#ifdef MAP_HAS_ERASE_KEY
+    return map_erase_key(tree, key);
+#else
+    map_iter_t my_it;
+    map_find(tree, &my_it, key);
+    if (map_at_end(tree, &my_it))
+        return false;
+    map_erase(tree, &my_it);
+    return true;
+#endif
+}
+
+#ifdef MAP_HAS_ITERATION
+static bool count_element(void *key, void *data, void *ctx)
+{
+    (void) key, (void) data;
+    (*(size_t *) ctx)++;
+    return true;
+}
+#endif
+
+static void run_bursts(map_t tree, const workload_t *w)
+{
+    for (size_t i = 0; i < w->scale; i += BENCH_BURST) {
+        size_t end = i + BENCH_BURST < w->scale ? i + BENCH_BURST : w->scale;
+        for (size_t j = i; j < end; j++)
+            erase_key(tree, w->order + j);
+        for (size_t j = i; j < end; j++)
+            map_insert(tree, w->order + j, w->order + j);
+    }
+}
+
+/* One phase per operation, each over all the keys */
+static void run_phases(const workload_t *w, size_t reps)
+{
+    const char *dist = w->dist;
+    size_t scale = w->scale;
+    phase_t before;
+
+    map_iter_t my_it;
+    hist_t *h;
+
+    map_t tree = map_init(size_t, size_t, bench_cmp_sizet);
+
+    h = hist_get(dist, "insert");
+    phase_begin(&before);
+    for (size_t i = 0; i < scale; i++)
+        TIMED(h, map_insert(tree, w->order + i, w->order + i));
+    report(&before, w, dist, "insert", reps);
+    report_stats(tree, w, reps);
+
+    h = hist_get(dist, "find");
+    phase_begin(&before);
+    for (size_t i = 0; i < scale; i++)
+        TIMED(h, map_find(tree, &my_it, w->lookups + i));
+    report(&before, w, dist, "find", reps);
+
+#ifdef MAP_HAS_FIND_BATCH
+    map_iter_t batch_its[BENCH_BATCH];
+    phase_begin(&before);
+    for (size_t i = 0; i < scale; i += BENCH_BATCH)
+        map_find_batch(tree, w->lookups + i,
+                       scale - i < BENCH_BATCH ? scale - i : BENCH_BATCH,
+                       batch_its);
+    report(&before, w, dist, "find-batch", reps);
+#endif
+
+#ifdef MAP_HAS_CACHE
+    map_cache_enable(tree, BENCH_CACHE);
+    h = hist_get(dist, "find-cached");
+    phase_begin(&before);
+    for (size_t i = 0; i < scale; i++)
+        TIMED(h, map_find(tree, &my_it, w->lookups + i));
+    report(&before, w, dist, "find-cached", reps);
+    map_cache_enable(tree, 0);
+#endif
+
+#ifdef MAP_ORDER_STATS
+    /* keep the ranks from being optimized away */
+    size_t volatile rank;
+    h = hist_get(dist, "rank");
+    phase_begin(&before);
+    for (size_t i = 0; i < scale; i++)
+        TIMED(h, rank = map_rank(tree, w->lookups + i));
+    report(&before, w, dist, "rank", reps);
+    (void) rank;
+
+    /* the keys run from 0 to @scale - 1, so they are ranks as well */
+    h = hist_get(dist, "select");
+    phase_begin(&before);
+    for (size_t i = 0; i < scale; i++)
+        TIMED(h, map_select(tree, &my_it, w->lookups[i]));
+    report(&before, w, dist, "select", reps);
+#endif
+
+#ifdef MAP_HAS_FREEZE
+    phase_begin(&before);
+    map_frozen_t frozen = map_freeze(
+        tree, sizeof(size_t) == 8 ? MAP_KEY_UINT64 : MAP_KEY_UINT32);
+    report(&before, w, dist, "freeze", reps);
+
+    h = hist_get(dist, "find-frozen");
+    phase_begin(&before);
+    for (size_t i = 0; i < scale; i++)
+        TIMED(h, map_frozen_find(frozen, w->lookups + i));
+    report(&before, w, dist, "find-frozen", reps);
+    map_frozen_delete(frozen);
+#endif
+
+#ifdef MAP_HAS_ITERATION
+    /* Full scan in descending order */
+    map_iter_t scan_it;
+    phase_begin(&before);
+    for (map_last(tree, &scan_it); !map_at_end(tree, &scan_it);
+         map_prev(tree, &scan_it))
+        ;
+    report(&before, w, dist, "scan", reps);
+
+    /* Range scans of 64 keys, visiting every element once in total */
+    size_t visited = 0;
+    phase_begin(&before);
+    for (size_t i = 0; i < scale / 64; i++) {
+        size_t hi = w->lookups[i] + 64;
+        map_range_foreach(tree, w->lookups + i, &hi, count_element, &visited);
+    }
+    report(&before, w, dist, "range", reps);
+#endif
+
+    /* Bursts of removals, each followed by the insertion of the same keys,
+     * over every key once.
+     */
+    phase_begin(&before);
+    run_bursts(tree, w);
+    report(&before, w, dist, "burst", reps);
+
+#ifdef MAP_HAS_LAZY_ERASE
+    map_lazy_enable(tree, BENCH_LAZY);
+    phase_begin(&before);
+    run_bursts(tree, w);
+    report(&before, w, dist, "burst-lazy", reps);
+    map_lazy_enable(tree, 0);
+#endif
+
+    h = hist_get(dist, "erase");
+    phase_begin(&before);
+    for (size_t i = 0; i < scale; i++)
+        TIMED(h, erase_key(tree, w->order + i));
+    report(&before, w, dist, "erase", reps);
+
+    /* Ranges of keys erased at once, in the order of their first keys */
+    for (size_t i = 0; i < scale; i++)
+        map_insert(tree, w->order + i, w->order + i);
+    phase_begin(&before);
+    for (size_t i = 0; i < scale; i++) {
+        size_t lo = w->order[i], hi = lo + BENCH_RANGE;
+        if (lo % BENCH_RANGE)
+            continue;
+#ifdef MAP_HAS_ERASE_RANGE
+        map_erase_range(tree, &lo, &hi);
+#else
+        for (size_t key = lo; key < hi && key < scale; key++)
+            erase_key(tree, &key);
+#endif
+    }
+    report(&before, w, dist, "erase-range", reps);
+
+#ifdef MAP_HAS_BUILD_SORTED
+    /* Bulk-load, to be compared against the inserts */
+    phase_begin(&before);
+    map_build_sorted(tree, w->sorted, w->sorted, scale);
+    report(&before, w, dist, "build", reps);
+    map_clear(tree);
+#endif
+
+#ifdef MAP_HAS_INSERT_HINT
+    /* Inserts in the reverse order, each hinted by the previous one */
+    map_iter_t hint = {.node = NULL};
+    h = hist_get(dist, "insert-hint");
+    phase_begin(&before);
+    for (size_t i = scale; i-- > 0;)
+        TIMED(h, map_insert_hint(tree, &hint, w->order + i, w->order + i));
+    report(&before, w, dist, "insert-hint", reps);
+#endif
+
+    map_delete(tree);
+
+#ifdef MAP_HAS_TYPED
+    /* Same phases, on a map generated by MAP_DEFINE() */
+    char typed[64];
+    snprintf(typed, sizeof(typed), "%s-typed", dist);
+    sizetmap_t *map = sizetmap_new();
+
+    h = hist_get(typed, "insert");
+    phase_begin(&before);
+    for (size_t i = 0; i < scale; i++)
+        TIMED(h, sizetmap_insert(map, w->order[i], w->order[i]));
+    report(&before, w, typed, "insert", reps);
+
+    /* keep the inlined lookups from being optimized away */
+    size_t *volatile found;
+    h = hist_get(typed, "find");
+    phase_begin(&before);
+    for (size_t i = 0; i < scale; i++)
+        TIMED(h, found = sizetmap_find(map, w->lookups[i]));
+    report(&before, w, typed, "find", reps);
+    (void) found;
+
+    h = hist_get(typed, "erase");
+    phase_begin(&before);
+    for (size_t i = 0; i < scale; i++)
+        TIMED(h, sizetmap_erase(map, w->order[i]));
+    report(&before, w, typed, "erase", reps);
+
+    sizetmap_delete(map);
+#endif
+}
+
+/* @scale operations drawn in the proportions of @mix, on the keys of the
+ * lookups, with half of the keys in the map at first. Not every backend
+ * accepts duplicate keys, so the keys in the map are tracked aside, and the
+ * insertion of a key already there turns into the lookup that rejecting it
+ * would take.
+ */
+static void run_mixed(const workload_t *w,
+                      const unsigned mix[3],
+                      const char *op,
+                      rng_t *rng,
+                      size_t reps)
+{
+    size_t scale = w->scale;
+    unsigned total = mix[0] + mix[1] + mix[2];
+    unsigned char *ops = malloc(scale);
+    bool *present = calloc(scale, sizeof(bool));
+    assert(ops && present);
+
+    /* draw the operations before the timing starts */
+    for (size_t i = 0; i < scale; i++) {
+        size_t r = rng_below(rng, total);
+        ops[i] = (r < mix[0]) ? 0 : (r < mix[0] + mix[1]) ? 1 : 2;
+    }
+
+    /* one histogram for each kind of operation */
+    hist_t *hs[3] = {NULL};
+    if (latency) {
+        static const char *const kinds[3] = {"insert", "find", "erase"};
+        for (int k = 0; k < 3; k++) {
+            char name[80];
+            snprintf(name, sizeof(name), "%s-%s", op, kinds[k]);
+            hs[k] = hist_get(w->dist, name);
+        }
+    }
+
+    map_t tree = map_init(size_t, size_t, bench_cmp_sizet);
+    for (size_t i = 0; i < scale / 2; i++) {
+        map_insert(tree, w->order + i, w->order + i);
+        present[w->order[i]] = true;
+    }
+
+    phase_t before;
+    phase_begin(&before);
+    for (size_t i = 0; i < scale; i++) {
+        size_t *key = w->lookups + i;
+        map_iter_t my_it;
+        hist_t *h = hs[ops[i]];
+        uint64_t start = h ? now_ns() : 0;
+        switch (ops[i]) {
+        case 0:
+            if (present[*key]) {
+                map_find(tree, &my_it, key);
+                break;
+            }
+            map_insert(tree, key, key);
+            present[*key] = true;
+            break;
+        case 1:
+            map_find(tree, &my_it, key);
+            break;
+        default:
+            erase_key(tree, key);
+            present[*key] = false;
+            break;
+        }
+        if (h)
+            hist_record(h, now_ns() - start);
+    }
+    report(&before, w, w->dist, op, reps);
+
+    map_delete(tree);
+    free(present);
+    free(ops);
+}
+
+/* Parse "a,b,c" into @out, returning the number of items, at most @max */
+static size_t parse_list(char *arg, char **out, size_t max)
+{
+    size_t n = 0;
+    for (char *tok = strtok(arg, ","); tok && n < max; tok = strtok(NULL, ","))
+        out[n++] = tok;
+    return n;
+}
+
+static void usage(const char *prog)
+{
+    fprintf(stderr,
+            "usage: %s [-d random,sequential,clustered,zipf] [-l] [-M] "
+            "[-m insert:find:erase]\n"
+            "       [-n scales] [-p] [-r reps] [-s seed] [-z theta]\n",
+            prog);
+    exit(1);
+}
+
+int main(int argc, char *argv[])
+{
+    char default_dists[] = "random,sequential";
+    char default_scales[] = "1e3,1e4,1e5,1e6";
+    char *dist_arg = default_dists, *scale_arg = default_scales;
+    char *mix_arg = NULL;
+    size_t reps = 20;
+    uint64_t seed = 1;
+    double theta = 0.99;
+    unsigned mix[3] = {0};
+
+    int opt;
+    while ((opt = getopt(argc, argv, "d:lMm:n:pr:s:z:")) != -1) {
+        switch (opt) {
+        case 'd':
+            dist_arg = optarg;
+            break;
+        case 'l':
+            latency = true;
+            break;
+        case 'M':
+            memory = true;
+            break;
+        case 'm':
+            mix_arg = optarg;
+            if (sscanf(optarg, "%u:%u:%u", mix, mix + 1, mix + 2) != 3 ||
+                !(mix[0] + mix[1] + mix[2]))
+                usage(argv[0]);
+            break;
+        case 'n':
+            scale_arg = optarg;
+            break;
+        case 'p':
+            counting = true;
+            break;
+        case 'r':
+            reps = strtoul(optarg, NULL, 0);
+            break;
+        case 's':
+            seed = strtoull(optarg, NULL, 0);
+            break;
+        case 'z':
+            theta = strtod(optarg, NULL);
+            break;
+        default:
+            usage(argv[0]);
+        }
+    }
+
+    char *dists[8], *scales[16];
+    size_t n_dists = parse_list(dist_arg, dists, 8);
+    size_t n_scales = parse_list(scale_arg, scales, 16);
+
+    char mix_op[64];
+    if (mix_arg)
+        snprintf(mix_op, sizeof(mix_op), "mixed-%u:%u:%u", mix[0], mix[1],
+                 mix[2]);
+
+    if (counting)
+        counters_open();
+
+    rng_t rng;
+    rng_seed(&rng, seed);
+    for (size_t d = 0; d < n_dists; d++) {
+        for (size_t s = 0; s < n_scales; s++) {
+            size_t scale = (size_t) strtod(scales[s], NULL);
+            if (!scale)
+                usage(argv[0]);
+
+            for (size_t r = reps; r > 0; r--) {
+                /* fresh keys for each repetition */
+                workload_t w;
+                if (!workload_init(&w, dists[d], scale, theta, &rng))
+                    usage(argv[0]);
+                if (mix_arg)
+                    run_mixed(&w, mix, mix_op, &rng, r);
+                else
+                    run_phases(&w, r);
+                workload_free(&w);
+            }
+            hist_report(scale);
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,247 @@
+/*
+ * rv32emu is freely redistributable under the MIT License. See the file
+ * "LICENSE" for information on usage and redistribution of this file.
+ */
+
+/*
+ * Replay of recorded traces of map operations, see trace.h.
+ *
+ * This driver is built once for each backend, like bench.c, as
+ * replay-map-<backend>. The trace is mapped in memory and its arrays are
+ * used in place, so that the timed loop does no more than dispatch the
+ * operations on the map. The keys are erased with map_erase_key() when the
+ * build defines MAP_HAS_ERASE_KEY, and found then erased otherwise.
+ *
+ * usage: replay-map-<backend> [-k int|uint|bytes] [-r reps] trace...
+ *
+ *   -k  comparison of the keys, which must match that of the recorded map:
+ *       signed or unsigned integers, for keys of 1, 2, 4 or 8 bytes, or the
+ *       bytes in memory order (default: uint)
+ *   -r  repetitions of each trace (default: 20)
+ *
+ * Each line of the output reads "time, trace, replay, operations, reps", in
+ * the format of bench.c, where the trace is named after its file.
+ */
+
+#include <fcntl.h>
+#include <libgen.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "map.h"
+#include "trace.h"
+
+/* The comparators of the backends return either int or map_cmp_t */
+typedef __typeof__(map_cmp_int(NULL, NULL)) replay_cmp_t;
+
+#define REPLAY_CMP(name, type)                                          \
+    static replay_cmp_t name(const void *arg0, const void *arg1)        \
+    {                                                                   \
+        type a = *(const type *) arg0, b = *(const type *) arg1;        \
+        return (a < b) ? _CMP_LESS : (a > b) ? _CMP_GREATER : _CMP_EQUAL; \
+    }
+
+REPLAY_CMP(replay_cmp_i8, int8_t)
+REPLAY_CMP(replay_cmp_i16, int16_t)
+REPLAY_CMP(replay_cmp_i32, int32_t)
+REPLAY_CMP(replay_cmp_i64, int64_t)
+REPLAY_CMP(replay_cmp_u8, uint8_t)
+REPLAY_CMP(replay_cmp_u16, uint16_t)
+REPLAY_CMP(replay_cmp_u32, uint32_t)
+REPLAY_CMP(replay_cmp_u64, uint64_t)
+
+/* Size of the keys compared by replay_cmp_bytes() */
+static size_t replay_key_size;
+
+static replay_cmp_t replay_cmp_bytes(const void *arg0, const void *arg1)
+{
+    int cmp = memcmp(arg0, arg1, replay_key_size);
+    return (cmp < 0) ? _CMP_LESS : (cmp > 0) ? _CMP_GREATER : _CMP_EQUAL;
+}
+
+typedef replay_cmp_t (*replay_cmp_fn)(const void *, const void *);
+
+/* Comparator of the keys of @size bytes, NULL if @kind cannot compare them */
+static replay_cmp_fn replay_comparator(const char *kind, size_t size)
+{
+    static const replay_cmp_fn ints[] = {replay_cmp_i8, replay_cmp_i16,
+                                         replay_cmp_i32, replay_cmp_i64};
+    static const replay_cmp_fn uints[] = {replay_cmp_u8, replay_cmp_u16,
+                                          replay_cmp_u32, replay_cmp_u64};
+    int order;
+
+    if (!strcmp(kind, "bytes")) {
+        replay_key_size = size;
+        return replay_cmp_bytes;
+    }
+    switch (size) {
+    case 1:
+        order = 0;
+        break;
+    case 2:
+        order = 1;
+        break;
+    case 4:
+        order = 2;
+        break;
+    case 8:
+        order = 3;
+        break;
+    default:
+        return NULL;
+    }
+    if (!strcmp(kind, "int"))
+        return ints[order];
+    if (!strcmp(kind, "uint"))
+        return uints[order];
+    return NULL;
+}
+
+/* A trace mapped in memory */
+typedef struct {
+    const trace_header_t *header;
+    size_t size;
+    const unsigned char *ops;
+    const char *keys, *values;
+} trace_t;
+
+static bool trace_open(trace_t *trace, const char *path)
+{
+    int fd = open(path, O_RDONLY);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) < 0 ||
+        (size_t) st.st_size < sizeof(trace_header_t)) {
+        if (fd >= 0)
+            close(fd);
+        return false;
+    }
+
+    int flags = MAP_PRIVATE;
+#ifdef MAP_POPULATE
+    /* fault the pages in now rather than during the replay */
+    flags |= MAP_POPULATE;
+#endif
+    void *base = mmap(NULL, st.st_size, PROT_READ, flags, fd, 0);
+    close(fd);
+    if (base == MAP_FAILED)
+        return false;
+
+    const trace_header_t *h = base;
+    trace->header = h;
+    trace->size = st.st_size;
+    if (memcmp(h->magic, TRACE_MAGIC, sizeof(h->magic)) ||
+        h->version != TRACE_VERSION || trace_size(h) > trace->size) {
+        munmap(base, st.st_size);
+        return false;
+    }
+
+    trace->ops = (const unsigned char *) base + trace_ops_offset(h);
+    trace->keys = (const char *) base + trace_keys_offset(h);
+    trace->values = (const char *) base + trace_values_offset(h);
+    return true;
+}
+
+static void trace_close(trace_t *trace)
+{
+    munmap((void *) trace->header, trace->size);
+}
+
+/* Replay the operations of @trace on a new map, and return the time taken */
+static double replay(const trace_t *trace, replay_cmp_fn cmp)
+{
+    const trace_header_t *h = trace->header;
+    size_t key_size = h->key_size, data_size = h->data_size;
+    const char *value = trace->values;
+    map_t tree = map_new(key_size, data_size, cmp);
+    struct timespec before, after;
+
+    clock_gettime(CLOCK_MONOTONIC, &before);
+    for (size_t i = 0; i < h->count; i++) {
+        void *key = (void *) (trace->keys + i * key_size);
+        map_iter_t my_it;
+        switch (trace->ops[i]) {
+        case TRACE_INSERT:
+            map_insert(tree, key, (void *) value);
+            value += data_size;
+            break;
+        case TRACE_FIND:
+            map_find(tree, &my_it, key);
+            break;
+        case TRACE_ERASE:
+#ifdef MAP_HAS_ERASE_KEY
+            map_erase_key(tree, key);
+#else
+            map_find(tree, &my_it, key);
+            if (!map_at_end(tree, &my_it))
+                map_erase(tree, &my_it);
+#endif
+            break;
+        case TRACE_CLEAR:
+            map_clear(tree);
+            break;
+        }
+    }
+    clock_gettime(CLOCK_MONOTONIC, &after);
+
+    map_delete(tree);
+    return (after.tv_sec - before.tv_sec) * 1000000000UL +
+           (after.tv_nsec - before.tv_nsec);
+}
+
+static void usage(const char *prog)
+{
+    fprintf(stderr, "usage: %s [-k int|uint|bytes] [-r reps] trace...\n",
+            prog);
+    exit(1);
+}
+
+int main(int argc, char *argv[])
+{
+    const char *kind = "uint";
+    size_t reps = 20;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "k:r:")) != -1) {
+        switch (opt) {
+        case 'k':
+            kind = optarg;
+            break;
+        case 'r':
+            reps = strtoul(optarg, NULL, 0);
+            break;
+        default:
+            usage(argv[0]);
+        }
+    }
+    if (optind == argc)
+        usage(argv[0]);
+
+    for (int i = optind; i < argc; i++) {
+        trace_t trace;
+        if (!trace_open(&trace, argv[i])) {
+            fprintf(stderr, "%s: cannot read the trace %s\n", argv[0],
+                    argv[i]);
+            return 1;
+        }
+
+        replay_cmp_fn cmp = replay_comparator(kind, trace.header->key_size);
+        if (!cmp) {
+            fprintf(stderr, "%s: cannot compare keys of %u bytes as %s\n",
+                    argv[0], trace.header->key_size, kind);
+            return 1;
+        }
+
+        char *name = basename(argv[i]);
+        for (size_t r = reps; r > 0; r--)
+            printf("%f, %s, %s, %zu, %zu\n", replay(&trace, cmp), name,
+                   "replay", (size_t) trace.header->count, r);
+        trace_close(&trace);
+    }
+    return 0;
+}
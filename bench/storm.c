@@ -0,0 +1,190 @@
+/*
+ * rv32emu is freely redistributable under the MIT License. See the file
+ * "LICENSE" for information on usage and redistribution of this file.
+ */
+
+/*
+ * Invalidation storms on an interval map.
+ *
+ * The emulator keeps its translated blocks of guest code in a map, and every
+ * store to guest memory has to drop the blocks whose ranges of addresses
+ * overlap the bytes written. Self-modifying code, or a loader writing over
+ * code that ran before, turns this into storms of invalidations. This driver
+ * lays out @scale blocks over a region of code, of 4 to 64 bytes each, some
+ * of them overlapping. A storm then writes one page of the region word by
+ * word, each store dropping the blocks it overlaps, and the dropped blocks
+ * are translated again, that is inserted back, once the storm is over.
+ *
+ * It is built against map.h with MAP_INTERVALS as storm-map-<backend>. The
+ * blocks to drop are found either by map_overlap_foreach(), the "overlap"
+ * method, or by a scan of all the blocks, the "scan" method, which is all a
+ * map of exact keys offers. Scans take quadratic time, so they stop at
+ * STORM_SCAN_MAX blocks.
+ *
+ * usage: storm-map-<backend> [-n scales] [-r reps] [-s seed]
+ *
+ *   -n  comma-separated numbers of blocks (default: 1e3,1e4,1e5)
+ *   -r  repetitions of each measure (default: 10)
+ *   -s  seed of the pseudo-random generator (default: 1)
+ *
+ * Each line of the output reads "time, storm, method, scale, reps", in the
+ * format of bench.c, where the time covers @scale stores.
+ */
+
+#include <assert.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "map.h"
+
+/* bytes of the region of code for each block */
+#define STORM_STRIDE 32
+
+/* bytes written by a storm */
+#define STORM_PAGE 4096
+
+/* blocks up to which the scans are timed */
+#define STORM_SCAN_MAX 10000
+
+/* splitmix64, enough to lay out the blocks */
+static uint64_t storm_rand(uint64_t *state)
+{
+    uint64_t z = (*state += UINT64_C(0x9e3779b97f4a7c15));
+    z = (z ^ (z >> 30)) * UINT64_C(0xbf58476d1ce4e5b9);
+    z = (z ^ (z >> 27)) * UINT64_C(0x94d049bb133111eb);
+    return z ^ (z >> 31);
+}
+
+/* The blocks dropped by the stores of a storm */
+typedef struct {
+    map_interval_t *blocks;
+    size_t count;
+} dropped_t;
+
+static bool drop_block(void *key, void *data, void *ctx)
+{
+    dropped_t *d = ctx;
+    (void) data;
+    d->blocks[d->count++] = *(map_interval_t *) key;
+    return true;
+}
+
+/* Find the blocks overlapping [@lo, @hi) by a scan of the whole map */
+static void scan_overlaps(map_t map, uint64_t lo, uint64_t hi, dropped_t *d)
+{
+    map_iter_t it;
+    for (map_first(map, &it); !map_at_end(map, &it); map_next(map, &it)) {
+        map_interval_t *block = it.node->key;
+        if (block->start < hi && block->end > lo)
+            drop_block(block, it.node->data, d);
+    }
+}
+
+/* Run storms on @scale blocks until @scale stores are done, and return the
+ * time taken.
+ */
+static double run_storms(size_t scale, bool scan, uint64_t seed)
+{
+    uint64_t region = (uint64_t) scale * STORM_STRIDE, state = seed;
+    map_t map = map_init(map_interval_t, size_t, map_cmp_interval);
+    dropped_t d = {.blocks = malloc(scale * sizeof(map_interval_t))};
+    uint64_t *pages = malloc((scale / (STORM_PAGE / 4) + 1) * sizeof(*pages));
+    assert(d.blocks && pages);
+
+    /* blocks at word boundaries, which spill over the next ones at times */
+    for (size_t i = 0; i < scale; i++) {
+        map_interval_t block;
+        block.start = i * STORM_STRIDE + 4 * (storm_rand(&state) % 4);
+        block.end = block.start + 4 * (1 + storm_rand(&state) % 16);
+        map_insert(map, &block, &i);
+    }
+
+    /* draw the pages before the timing starts */
+    size_t stores = 0, n_pages = 0;
+    for (; stores < scale; stores += STORM_PAGE / 4)
+        pages[n_pages++] = storm_rand(&state) % (region / STORM_PAGE + 1) *
+                           STORM_PAGE;
+
+    struct timespec before, after;
+    clock_gettime(CLOCK_MONOTONIC, &before);
+    stores = 0;
+    for (size_t p = 0; p < n_pages; p++) {
+        d.count = 0;
+        for (uint64_t addr = pages[p];
+             addr < pages[p] + STORM_PAGE && stores < scale;
+             addr += 4, stores++) {
+            size_t first = d.count;
+            if (scan)
+                scan_overlaps(map, addr, addr + 4, &d);
+            else
+                map_overlap_foreach(map, addr, addr + 4, drop_block, &d);
+            for (size_t i = first; i < d.count; i++)
+                map_erase_key(map, d.blocks + i);
+        }
+
+        /* the code runs again, and is translated again */
+        for (size_t i = 0; i < d.count; i++)
+            map_insert(map, d.blocks + i, NULL);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &after);
+
+    map_delete(map);
+    free(d.blocks);
+    free(pages);
+    return (after.tv_sec - before.tv_sec) * 1000000000UL +
+           (after.tv_nsec - before.tv_nsec);
+}
+
+static void usage(const char *prog)
+{
+    fprintf(stderr, "usage: %s [-n scales] [-r reps] [-s seed]\n", prog);
+    exit(1);
+}
+
+int main(int argc, char *argv[])
+{
+    char default_scales[] = "1e3,1e4,1e5";
+    char *scale_arg = default_scales;
+    size_t reps = 10;
+    uint64_t seed = 1;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "n:r:s:")) != -1) {
+        switch (opt) {
+        case 'n':
+            scale_arg = optarg;
+            break;
+        case 'r':
+            reps = strtoul(optarg, NULL, 0);
+            break;
+        case 's':
+            seed = strtoull(optarg, NULL, 0);
+            break;
+        default:
+            usage(argv[0]);
+        }
+    }
+
+    for (char *s = strtok(scale_arg, ","); s; s = strtok(NULL, ",")) {
+        size_t scale = (size_t) strtod(s, NULL);
+        if (!scale)
+            usage(argv[0]);
+
+        /* the same storms for both methods, fresh ones for each repetition */
+        for (size_t r = reps; r > 0; r--) {
+            uint64_t rep_seed = seed + r;
+            printf("%f, %s, %s, %zu, %zu\n",
+                   run_storms(scale, false, rep_seed), "storm", "overlap",
+                   scale, r);
+            if (scale <= STORM_SCAN_MAX)
+                printf("%f, %s, %s, %zu, %zu\n",
+                       run_storms(scale, true, rep_seed), "storm", "scan",
+                       scale, r);
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,194 @@
+/*
+ * rv32emu is freely redistributable under the MIT License. See the file
+ * "LICENSE" for information on usage and redistribution of this file.
+ */
+
+/*
+ * Recording shim of the map operations, see trace.h.
+ *
+ * Compile this file against the map.h of the program, and link it with
+ *   -Wl,--wrap=map_new,--wrap=map_insert,--wrap=map_find,--wrap=map_erase
+ *   -Wl,--wrap=map_clear,--wrap=map_delete
+ * so that the calls of the program go through the wrappers below, with no
+ * change to its sources. When the environment sets MAP_TRACE to a path, the
+ * operations on one map are written there as a trace, once the map is
+ * deleted or the program exits. MAP_TRACE_MAP picks the map by the order of
+ * creation, from 0, the default.
+ *
+ * The key of an erased element is read through its iterator, by
+ * TRACE_ITER_KEY(), which fits the backends whose iterators point to their
+ * node.
+ */
+
+#include <assert.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "map.h"
+#include "trace.h"
+
+#ifndef TRACE_ITER_KEY
+#define TRACE_ITER_KEY(it) ((it)->node->key)
+#endif
+
+/* The comparators of the backends return either int or map_cmp_t */
+typedef __typeof__(map_cmp_int(NULL, NULL)) trace_cmp_t;
+
+/* The functions of the map, renamed by --wrap */
+extern __typeof__(map_new) __real_map_new;
+extern __typeof__(map_insert) __real_map_insert;
+extern __typeof__(map_find) __real_map_find;
+extern __typeof__(map_erase) __real_map_erase;
+extern __typeof__(map_clear) __real_map_clear;
+extern __typeof__(map_delete) __real_map_delete;
+
+/* The trace being recorded, kept in memory until it is written */
+static struct {
+    bool started;
+    const char *path;
+    long target, created;
+    map_t map; /* NULL when no map is recorded */
+    size_t key_size, data_size;
+    unsigned char *ops;
+    char *keys, *values;
+    size_t count, n_values, capacity, values_capacity;
+} trace;
+
+static void trace_append(trace_op_t op, const void *key)
+{
+    if (trace.count == trace.capacity) {
+        trace.capacity = trace.capacity ? trace.capacity * 2 : 4096;
+        trace.ops = realloc(trace.ops, trace.capacity);
+        trace.keys = realloc(trace.keys, trace.capacity * trace.key_size);
+        assert(trace.ops && trace.keys);
+    }
+
+    char *slot = trace.keys + trace.count * trace.key_size;
+    if (key)
+        memcpy(slot, key, trace.key_size);
+    else
+        memset(slot, 0, trace.key_size);
+    trace.ops[trace.count++] = (unsigned char) op;
+}
+
+static void trace_append_value(const void *value)
+{
+    if (trace.n_values == trace.values_capacity) {
+        trace.values_capacity =
+            trace.values_capacity ? trace.values_capacity * 2 : 4096;
+        trace.values =
+            realloc(trace.values, trace.values_capacity * trace.data_size);
+        assert(trace.values);
+    }
+
+    char *slot = trace.values + trace.n_values++ * trace.data_size;
+    if (value)
+        memcpy(slot, value, trace.data_size);
+    else
+        memset(slot, 0, trace.data_size);
+}
+
+/* Write @size bytes of @data, then pad up to TRACE_ALIGN */
+static bool trace_write_array(FILE *file, const void *data, size_t size)
+{
+    static const char zeros[TRACE_ALIGN];
+    return fwrite(data, 1, size, file) == size &&
+           fwrite(zeros, 1, trace_align(size) - size, file) ==
+               trace_align(size) - size;
+}
+
+/* Write the trace, and stop recording */
+static void trace_write(void)
+{
+    if (!trace.map)
+        return;
+    trace.map = NULL;
+
+    trace_header_t header = {
+        .version = TRACE_VERSION,
+        .key_size = (uint32_t) trace.key_size,
+        .data_size = (uint32_t) trace.data_size,
+        .count = trace.count,
+        .values = trace.n_values,
+    };
+    memcpy(header.magic, TRACE_MAGIC, sizeof(header.magic));
+
+    FILE *file = fopen(trace.path, "wb");
+    if (!file ||
+        !trace_write_array(file, &header, sizeof(header)) ||
+        !trace_write_array(file, trace.ops, trace.count) ||
+        !trace_write_array(file, trace.keys, trace.count * trace.key_size) ||
+        !trace_write_array(file, trace.values,
+                           trace.n_values * trace.data_size))
+        fprintf(stderr, "map trace: cannot write %s\n", trace.path);
+    if (file)
+        fclose(file);
+
+    free(trace.ops);
+    free(trace.keys);
+    free(trace.values);
+}
+
+map_t __wrap_map_new(size_t s1,
+                     size_t s2,
+                     trace_cmp_t (*cmp)(const void *, const void *))
+{
+    map_t obj = __real_map_new(s1, s2, cmp);
+
+    if (!trace.started) {
+        trace.started = true;
+        trace.path = getenv("MAP_TRACE");
+        const char *target = getenv("MAP_TRACE_MAP");
+        trace.target = target ? atol(target) : 0;
+        if (trace.path)
+            atexit(trace_write);
+    }
+
+    if (trace.path && trace.created++ == trace.target) {
+        trace.map = obj;
+        trace.key_size = s1, trace.data_size = s2;
+    }
+    return obj;
+}
+
+bool __wrap_map_insert(map_t obj, void *key, void *val)
+{
+    bool inserted = __real_map_insert(obj, key, val);
+    if (obj == trace.map) {
+        trace_append(inserted ? TRACE_INSERT : TRACE_FIND, key);
+        if (inserted)
+            trace_append_value(val);
+    }
+    return inserted;
+}
+
+void __wrap_map_find(map_t obj, map_iter_t *it, void *key)
+{
+    if (obj == trace.map)
+        trace_append(TRACE_FIND, key);
+    __real_map_find(obj, it, key);
+}
+
+void __wrap_map_erase(map_t obj, map_iter_t *it)
+{
+    /* erasing the end is a no-op */
+    if (obj == trace.map && !map_at_end(obj, it))
+        trace_append(TRACE_ERASE, TRACE_ITER_KEY(it));
+    __real_map_erase(obj, it);
+}
+
+void __wrap_map_clear(map_t obj)
+{
+    if (obj == trace.map)
+        trace_append(TRACE_CLEAR, NULL);
+    __real_map_clear(obj);
+}
+
+void __wrap_map_delete(map_t obj)
+{
+    if (obj == trace.map)
+        trace_write();
+    __real_map_delete(obj);
+}
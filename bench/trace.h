@@ -0,0 +1,74 @@
+/*
+ * rv32emu is freely redistributable under the MIT License. See the file
+ * "LICENSE" for information on usage and redistribution of this file.
+ */
+
+/*
+ * Binary traces of the operations on a map.
+ *
+ * A trace holds the operations of one map, as recorded by trace-record.c,
+ * so that replay.c can drive any backend with them. The file is laid out as
+ * arrays that the replay uses in place, once mapped in memory:
+ *   1. the header;
+ *   2. the operations, one trace_op_t byte each;
+ *   3. the keys of the operations, @key_size bytes each;
+ *   4. the values of the TRACE_INSERT operations, @data_size bytes each.
+ * Every array starts on a TRACE_ALIGN boundary of the file. The integers,
+ * keys and values are stored in the byte order of the recording machine.
+ */
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define TRACE_MAGIC "MAPTRACE"
+#define TRACE_VERSION 1
+#define TRACE_ALIGN 8
+
+/* The key of TRACE_CLEAR is blank. Insertions that found their key in the
+ * map are recorded as TRACE_FIND, since that is all they did, so that every
+ * backend replays the same contents whether or not it accepts duplicates.
+ */
+typedef enum {
+    TRACE_INSERT = 0,
+    TRACE_FIND,
+    TRACE_ERASE,
+    TRACE_CLEAR,
+} trace_op_t;
+
+typedef struct {
+    char magic[8];
+    uint32_t version;
+    uint32_t key_size, data_size;
+    uint32_t reserved;
+    uint64_t count;  /* operations */
+    uint64_t values; /* TRACE_INSERT operations */
+} trace_header_t;
+
+static inline size_t trace_align(size_t size)
+{
+    return (size + TRACE_ALIGN - 1) & ~(size_t) (TRACE_ALIGN - 1);
+}
+
+/* Offsets of the arrays in the file, and size of the file */
+static inline size_t trace_ops_offset(const trace_header_t *h)
+{
+    (void) h;
+    return trace_align(sizeof(trace_header_t));
+}
+
+static inline size_t trace_keys_offset(const trace_header_t *h)
+{
+    return trace_ops_offset(h) + trace_align(h->count);
+}
+
+static inline size_t trace_values_offset(const trace_header_t *h)
+{
+    return trace_keys_offset(h) + trace_align(h->count * h->key_size);
+}
+
+static inline size_t trace_size(const trace_header_t *h)
+{
+    return trace_values_offset(h) + h->values * h->data_size;
+}
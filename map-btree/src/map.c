@@ -0,0 +1,636 @@
+/*
+ * rv32emu is freely redistributable under the MIT License. See the file
+ * "LICENSE" for information on usage and redistribution of this file.
+ */
+
+/* A B+tree keeps all the elements in its leaves, in order, and the inner
+ * nodes only hold the separators between their children. Every node spans a
+ * whole number of cache lines and is aligned to a cache line, so that the
+ * keys compared at a level are fetched together. All the leaves are at the
+ * same depth.
+ *
+ * Inner node (@count children, @count - 1 separators):
+ *   | count | child[0] ... child[cap - 1] | key[0] ... key[cap - 2] |
+ * child[i] holds the keys in [key[i - 1], key[i]).
+ *
+ * Leaf (@count elements):
+ *   | count | next | key[0] ... key[cap - 1] | data[0] ... data[cap - 1] |
+ */
+
+#include <assert.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "map.h"
+
+#define BT_CACHE_LINE 64
+
+/* Nodes are sized for this many bytes, and then hold between the minimum and
+ * the maximum number of keys.
+ */
+#define BT_NODE_SIZE 512
+#define BT_MIN_FANOUT 16
+#define BT_MAX_FANOUT 64
+
+/* A node other than the root has at least two children, so the depth of a
+ * tree is bounded by the bits of a size.
+ */
+#define BT_MAX_HEIGHT (sizeof(size_t) * 8)
+
+/* The key and the data arrays are aligned so that the elements are. */
+#define MAP_ALIGN sizeof(uint64_t)
+
+static inline size_t map_align(size_t size)
+{
+    return (size + MAP_ALIGN - 1) & ~(MAP_ALIGN - 1);
+}
+
+typedef struct {
+    uint32_t count;
+    void *child[];
+} bt_inner_t;
+
+typedef struct map_leaf {
+    uint32_t count;
+    struct map_leaf *next;
+} map_leaf_t;
+
+struct map_internal {
+    void *root;      /* a leaf if @height is 0, NULL if the map is empty */
+    unsigned height; /* levels of inner nodes */
+
+    /* properties */
+    size_t key_size, data_size;
+
+    /* layout of the nodes: capacity, size and offset of the arrays */
+    uint32_t inner_cap, leaf_cap;
+    size_t inner_size, leaf_size;
+    size_t inner_key_offset, leaf_data_offset;
+
+    map_cmp_t (*comparator)(const void *, const void *);
+
+    /* room for two keys, moved up between the levels of a split */
+    char scratch[];
+};
+
+typedef struct {
+    bt_inner_t *node;
+    uint32_t pos; /* index of the child the path goes through */
+} bt_path_entry_t;
+
+/* Node accessors */
+static inline void *bt_inner_key(const map_t bt,
+                                 const bt_inner_t *node,
+                                 uint32_t i)
+{
+    return (char *) node + bt->inner_key_offset + i * bt->key_size;
+}
+
+static inline void *bt_leaf_key(const map_t bt,
+                                const map_leaf_t *leaf,
+                                uint32_t i)
+{
+    return (char *) (leaf + 1) + i * bt->key_size;
+}
+
+static inline void *bt_leaf_data(const map_t bt,
+                                 const map_leaf_t *leaf,
+                                 uint32_t i)
+{
+    return (char *) leaf + bt->leaf_data_offset + i * bt->data_size;
+}
+
+static inline size_t bt_round_line(size_t size)
+{
+    return (size + BT_CACHE_LINE - 1) & ~(size_t) (BT_CACHE_LINE - 1);
+}
+
+static void *bt_alloc(size_t size)
+{
+    void *node = NULL;
+    int err = posix_memalign(&node, BT_CACHE_LINE, size);
+    assert(!err && node);
+    (void) err;
+    return node;
+}
+
+/* Index of the first of the @n keys at @keys greater than (or equal to, if
+ * not @upper) @key.
+ */
+static inline uint32_t bt_search(const map_t bt,
+                                 const char *keys,
+                                 uint32_t n,
+                                 const void *key,
+                                 bool upper)
+{
+    uint32_t lo = 0;
+    while (n) {
+        uint32_t half = n / 2;
+        map_cmp_t cmp =
+            (bt->comparator)(key, keys + (lo + half) * bt->key_size);
+        if (cmp == _CMP_GREATER || (upper && cmp == _CMP_EQUAL)) {
+            lo += half + 1;
+            n -= half + 1;
+        } else {
+            n = half;
+        }
+    }
+    return lo;
+}
+
+/* Go down to the leaf that holds @key or would, recording the inner nodes in
+ * @path if any. Return the position of @key in the leaf, and whether it is
+ * there in @found.
+ */
+static map_leaf_t *bt_descend(const map_t bt,
+                              const void *key,
+                              bt_path_entry_t *path,
+                              uint32_t *pos,
+                              bool *found)
+{
+    void *node = bt->root;
+    for (unsigned level = 0; level < bt->height; level++) {
+        bt_inner_t *inner = node;
+        uint32_t i = bt_search(bt, bt_inner_key(bt, inner, 0),
+                               inner->count - 1, key, true);
+        if (path) {
+            path[level].node = inner;
+            path[level].pos = i;
+        }
+        node = inner->child[i];
+    }
+
+    map_leaf_t *leaf = node;
+    *pos = bt_search(bt, bt_leaf_key(bt, leaf, 0), leaf->count, key, false);
+    *found = *pos < leaf->count &&
+             (bt->comparator)(key, bt_leaf_key(bt, leaf, *pos)) == _CMP_EQUAL;
+    return leaf;
+}
+
+/* Leaf helpers */
+static void bt_leaf_insert_at(map_t bt,
+                              map_leaf_t *leaf,
+                              uint32_t pos,
+                              const void *key,
+                              const void *val)
+{
+    size_t ksize = bt->key_size, vsize = bt->data_size;
+    uint32_t tail = leaf->count - pos;
+
+    memmove(bt_leaf_key(bt, leaf, pos + 1), bt_leaf_key(bt, leaf, pos),
+            tail * ksize);
+    memmove(bt_leaf_data(bt, leaf, pos + 1), bt_leaf_data(bt, leaf, pos),
+            tail * vsize);
+
+    /* If the parameter passed in is NULL, make the element blank instead of
+     * a segfault.
+     */
+    if (!key)
+        memset(bt_leaf_key(bt, leaf, pos), 0, ksize);
+    else
+        memcpy(bt_leaf_key(bt, leaf, pos), key, ksize);
+
+    if (!val)
+        memset(bt_leaf_data(bt, leaf, pos), 0, vsize);
+    else
+        memcpy(bt_leaf_data(bt, leaf, pos), val, vsize);
+
+    leaf->count++;
+}
+
+/* Move @n elements from @src at @from to @dst at @to */
+static void bt_leaf_move(map_t bt,
+                         map_leaf_t *dst,
+                         uint32_t to,
+                         map_leaf_t *src,
+                         uint32_t from,
+                         uint32_t n)
+{
+    memmove(bt_leaf_key(bt, dst, to), bt_leaf_key(bt, src, from),
+            n * bt->key_size);
+    memmove(bt_leaf_data(bt, dst, to), bt_leaf_data(bt, src, from),
+            n * bt->data_size);
+}
+
+/* Split the full @leaf while inserting the element at @pos, and return the
+ * new right sibling. An append to the last leaf leaves it full and starts
+ * the new one with the element alone, so that ascending keys pack the
+ * leaves.
+ */
+static map_leaf_t *bt_leaf_split(map_t bt,
+                                 map_leaf_t *leaf,
+                                 uint32_t pos,
+                                 const void *key,
+                                 const void *val,
+                                 bool append)
+{
+    uint32_t cap = leaf->count;
+    uint32_t n_left = append ? cap : (cap + 2) / 2;
+
+    map_leaf_t *right = bt_alloc(bt->leaf_size);
+    right->next = leaf->next;
+    leaf->next = right;
+
+    if (pos < n_left) {
+        right->count = cap - n_left + 1;
+        bt_leaf_move(bt, right, 0, leaf, n_left - 1, right->count);
+        leaf->count = n_left - 1;
+        bt_leaf_insert_at(bt, leaf, pos, key, val);
+    } else {
+        right->count = cap - n_left;
+        bt_leaf_move(bt, right, 0, leaf, n_left, right->count);
+        leaf->count = n_left;
+        bt_leaf_insert_at(bt, right, pos - n_left, key, val);
+    }
+    return right;
+}
+
+/* Inner node helpers */
+
+/* Insert the separator @key and the child @child right after @pos */
+static void bt_inner_insert_at(map_t bt,
+                               bt_inner_t *node,
+                               uint32_t pos,
+                               const void *key,
+                               void *child)
+{
+    uint32_t tail = node->count - pos - 1;
+
+    memmove(node->child + pos + 2, node->child + pos + 1,
+            tail * sizeof(void *));
+    memmove(bt_inner_key(bt, node, pos + 1), bt_inner_key(bt, node, pos),
+            tail * bt->key_size);
+    node->child[pos + 1] = child;
+    memcpy(bt_inner_key(bt, node, pos), key, bt->key_size);
+    node->count++;
+}
+
+/* Remove the separator at @pos and the child right after it */
+static void bt_inner_remove_at(map_t bt, bt_inner_t *node, uint32_t pos)
+{
+    uint32_t tail = node->count - pos - 2;
+
+    memmove(node->child + pos + 1, node->child + pos + 2,
+            tail * sizeof(void *));
+    memmove(bt_inner_key(bt, node, pos), bt_inner_key(bt, node, pos + 1),
+            tail * bt->key_size);
+    node->count--;
+}
+
+/* Split the full @node while inserting @key and @child after @pos, like
+ * bt_leaf_split(). The separator between the halves leaves the node for the
+ * parent, and is copied to @up. Return the new right sibling.
+ */
+static bt_inner_t *bt_inner_split(map_t bt,
+                                  bt_inner_t *node,
+                                  uint32_t pos,
+                                  const void *key,
+                                  void *child,
+                                  bool append,
+                                  void *up)
+{
+    size_t ksize = bt->key_size;
+    uint32_t cap = node->count;
+    /* an append keeps two children on the right, see bt_rebalance() */
+    uint32_t n_left = append ? cap - 1 : (cap + 2) / 2;
+
+    bt_inner_t *right = bt_alloc(bt->inner_size);
+    if (pos + 1 < n_left) {
+        /* the new child goes to the left half */
+        right->count = cap - n_left + 1;
+        memcpy(right->child, node->child + n_left - 1,
+               right->count * sizeof(void *));
+        memcpy(bt_inner_key(bt, right, 0), bt_inner_key(bt, node, n_left - 1),
+               (cap - n_left) * ksize);
+        memcpy(up, bt_inner_key(bt, node, n_left - 2), ksize);
+        node->count = n_left - 1;
+        bt_inner_insert_at(bt, node, pos, key, child);
+    } else if (pos + 1 == n_left) {
+        /* the new child starts the right half */
+        right->count = cap - n_left + 1;
+        right->child[0] = child;
+        memcpy(right->child + 1, node->child + n_left,
+               (cap - n_left) * sizeof(void *));
+        memcpy(bt_inner_key(bt, right, 0), bt_inner_key(bt, node, n_left - 1),
+               (cap - n_left) * ksize);
+        memcpy(up, key, ksize);
+        node->count = n_left;
+    } else {
+        right->count = cap - n_left;
+        memcpy(right->child, node->child + n_left,
+               right->count * sizeof(void *));
+        memcpy(bt_inner_key(bt, right, 0), bt_inner_key(bt, node, n_left),
+               (cap - n_left - 1) * ksize);
+        memcpy(up, bt_inner_key(bt, node, n_left - 1), ksize);
+        node->count = n_left;
+        bt_inner_insert_at(bt, right, pos - n_left, key, child);
+    }
+    return right;
+}
+
+/* The child at @pos of @parent, a leaf, fell below half full. Even it out
+ * with a sibling, or merge the two if they fit in one leaf. Return true if
+ * they were merged, so that @parent lost a child.
+ */
+static bool bt_leaf_fix(map_t bt, bt_inner_t *parent, uint32_t pos)
+{
+    uint32_t k = pos ? pos - 1 : pos;
+    map_leaf_t *a = parent->child[k], *b = parent->child[k + 1];
+
+    if (a->count + b->count <= bt->leaf_cap) {
+        bt_leaf_move(bt, a, a->count, b, 0, b->count);
+        a->count += b->count;
+        a->next = b->next;
+        free(b);
+        bt_inner_remove_at(bt, parent, k);
+        return true;
+    }
+
+    if (a->count > b->count) {
+        uint32_t n = (a->count - b->count) / 2;
+        bt_leaf_move(bt, b, n, b, 0, b->count);
+        bt_leaf_move(bt, b, 0, a, a->count - n, n);
+        a->count -= n;
+        b->count += n;
+    } else {
+        uint32_t n = (b->count - a->count) / 2;
+        bt_leaf_move(bt, a, a->count, b, 0, n);
+        bt_leaf_move(bt, b, 0, b, n, b->count - n);
+        a->count += n;
+        b->count -= n;
+    }
+    memcpy(bt_inner_key(bt, parent, k), bt_leaf_key(bt, b, 0), bt->key_size);
+    return false;
+}
+
+/* Same as bt_leaf_fix() for an inner child, whose separators rotate through
+ * the one in @parent.
+ */
+static bool bt_inner_fix(map_t bt, bt_inner_t *parent, uint32_t pos)
+{
+    size_t ksize = bt->key_size;
+    uint32_t k = pos ? pos - 1 : pos;
+    bt_inner_t *a = parent->child[k], *b = parent->child[k + 1];
+    void *sep = bt_inner_key(bt, parent, k);
+
+    if (a->count + b->count <= bt->inner_cap) {
+        memcpy(bt_inner_key(bt, a, a->count - 1), sep, ksize);
+        memcpy(bt_inner_key(bt, a, a->count), bt_inner_key(bt, b, 0),
+               (b->count - 1) * ksize);
+        memcpy(a->child + a->count, b->child, b->count * sizeof(void *));
+        a->count += b->count;
+        free(b);
+        bt_inner_remove_at(bt, parent, k);
+        return true;
+    }
+
+    if (a->count > b->count) {
+        uint32_t n = (a->count - b->count) / 2;
+        memmove(b->child + n, b->child, b->count * sizeof(void *));
+        memmove(bt_inner_key(bt, b, n), bt_inner_key(bt, b, 0),
+                (b->count - 1) * ksize);
+        memcpy(b->child, a->child + a->count - n, n * sizeof(void *));
+        memcpy(bt_inner_key(bt, b, n - 1), sep, ksize);
+        memcpy(bt_inner_key(bt, b, 0), bt_inner_key(bt, a, a->count - n),
+               (n - 1) * ksize);
+        memcpy(sep, bt_inner_key(bt, a, a->count - n - 1), ksize);
+        a->count -= n;
+        b->count += n;
+    } else {
+        uint32_t n = (b->count - a->count) / 2;
+        memcpy(bt_inner_key(bt, a, a->count - 1), sep, ksize);
+        memcpy(bt_inner_key(bt, a, a->count), bt_inner_key(bt, b, 0),
+               (n - 1) * ksize);
+        memcpy(a->child + a->count, b->child, n * sizeof(void *));
+        memcpy(sep, bt_inner_key(bt, b, n - 1), ksize);
+        memmove(b->child, b->child + n, (b->count - n) * sizeof(void *));
+        memmove(bt_inner_key(bt, b, 0), bt_inner_key(bt, b, n),
+                (b->count - n - 1) * ksize);
+        a->count += n;
+        b->count -= n;
+    }
+    return false;
+}
+
+/* Restore the occupancy of the nodes along @path after the removal of an
+ * element from @leaf. Every node other than the root keeps at least two
+ * children, or one element for a leaf, so that a sibling is always at hand.
+ */
+static void bt_rebalance(map_t bt, bt_path_entry_t *path, map_leaf_t *leaf)
+{
+    if (!bt->height) {
+        if (!leaf->count) {
+            free(leaf);
+            bt->root = NULL;
+        }
+        return;
+    }
+    if (leaf->count >= bt->leaf_cap / 2)
+        return;
+
+    for (unsigned level = bt->height; level--;) {
+        bt_inner_t *parent = path[level].node;
+        bool merged = (level == bt->height - 1)
+                          ? bt_leaf_fix(bt, parent, path[level].pos)
+                          : bt_inner_fix(bt, parent, path[level].pos);
+        if (!merged)
+            return;
+
+        if (!level) {
+            /* a root with a single child gives way to it */
+            if (parent->count == 1) {
+                bt->root = parent->child[0];
+                bt->height--;
+                free(parent);
+            }
+            return;
+        }
+        if (parent->count >= bt->inner_cap / 2)
+            return;
+    }
+}
+
+/* Release the subtree of @node, whose inner nodes span @height levels */
+static void bt_free(void *node, unsigned height)
+{
+    if (height) {
+        bt_inner_t *inner = node;
+        for (uint32_t i = 0; i < inner->count; i++)
+            bt_free(inner->child[i], height - 1);
+    }
+    free(node);
+}
+
+/* Constructor */
+map_t map_new(size_t s1,
+              size_t s2,
+              map_cmp_t (*cmp)(const void *, const void *))
+{
+    map_t tree = malloc(sizeof(struct map_internal) + 2 * s1);
+    assert(tree);
+
+    tree->key_size = s1, tree->data_size = s2;
+    tree->comparator = cmp;
+    tree->root = NULL;
+    tree->height = 0;
+
+    /* Take the largest fanout that fits in BT_NODE_SIZE, within the bounds,
+     * and round the node up to whole cache lines.
+     */
+    uint32_t cap = BT_MAX_FANOUT;
+    size_t key_offset = map_align(sizeof(bt_inner_t) + cap * sizeof(void *));
+    while (cap > BT_MIN_FANOUT &&
+           key_offset + (cap - 1) * s1 > BT_NODE_SIZE) {
+        cap--;
+        key_offset = map_align(sizeof(bt_inner_t) + cap * sizeof(void *));
+    }
+    tree->inner_cap = cap;
+    tree->inner_key_offset = key_offset;
+    tree->inner_size = bt_round_line(key_offset + (cap - 1) * s1);
+
+    cap = BT_MAX_FANOUT;
+    while (cap > BT_MIN_FANOUT &&
+           sizeof(map_leaf_t) + map_align(cap * s1) + cap * s2 > BT_NODE_SIZE)
+        cap--;
+    tree->leaf_cap = cap;
+    tree->leaf_data_offset = sizeof(map_leaf_t) + map_align(cap * s1);
+    tree->leaf_size = bt_round_line(tree->leaf_data_offset + cap * s2);
+    return tree;
+}
+
+/* Add function */
+bool map_insert(map_t obj, void *key, void *val)
+{
+    bt_path_entry_t path[BT_MAX_HEIGHT];
+    uint32_t pos;
+    bool found;
+
+    if (!obj->root) {
+        map_leaf_t *leaf = bt_alloc(obj->leaf_size);
+        leaf->count = 0;
+        leaf->next = NULL;
+        obj->root = leaf;
+    }
+
+    map_leaf_t *leaf = bt_descend(obj, key, path, &pos, &found);
+    if (found)
+        return false;
+
+    if (leaf->count < obj->leaf_cap) {
+        bt_leaf_insert_at(obj, leaf, pos, key, val);
+        return true;
+    }
+
+    /* The split goes up the path until a node has room for the separator */
+    bool append = pos == leaf->count && !leaf->next;
+    void *child = bt_leaf_split(obj, leaf, pos, key, val, append);
+    char *sep = obj->scratch, *up = obj->scratch + obj->key_size;
+    memcpy(sep, bt_leaf_key(obj, child, 0), obj->key_size);
+
+    for (unsigned level = obj->height; level--;) {
+        bt_inner_t *node = path[level].node;
+        if (node->count < obj->inner_cap) {
+            bt_inner_insert_at(obj, node, path[level].pos, sep, child);
+            return true;
+        }
+
+        child = bt_inner_split(obj, node, path[level].pos, sep, child,
+                               append, up);
+        char *tmp = sep;
+        sep = up;
+        up = tmp;
+    }
+
+    /* the root was split as well */
+    bt_inner_t *root = bt_alloc(obj->inner_size);
+    root->count = 2;
+    root->child[0] = obj->root;
+    root->child[1] = child;
+    memcpy(bt_inner_key(obj, root, 0), sep, obj->key_size);
+    obj->root = root;
+    obj->height++;
+    assert(obj->height < BT_MAX_HEIGHT);
+    return true;
+}
+
+/* Get functions */
+void map_find(map_t obj, map_iter_t *it, void *key)
+{
+    uint32_t pos;
+    bool found;
+
+    it->node = NULL;
+    if (!obj->root)
+        return;
+
+    map_leaf_t *leaf = bt_descend(obj, key, NULL, &pos, &found);
+    if (!found)
+        return;
+
+    it->node = leaf;
+    it->key = bt_leaf_key(obj, leaf, pos);
+    it->data = bt_leaf_data(obj, leaf, pos);
+}
+
+bool map_empty(map_t obj)
+{
+    return !obj->root;
+}
+
+/* Iteration */
+bool map_at_end(map_t UNUSED, map_iter_t *it)
+{
+    return !(it->node);
+}
+
+/* Remove functions */
+void map_erase(map_t obj, map_iter_t *it)
+{
+    if (!it->node)
+        return;
+
+    bool erased = map_erase_key(obj, it->key);
+    assert(erased);
+    (void) erased;
+}
+
+/* Remove the element of @key, and return false if it is not in the map. The
+ * inner nodes have no parent pointer, so the removal of an iterator descends
+ * by its key as well.
+ */
+bool map_erase_key(map_t obj, void *key)
+{
+    bt_path_entry_t path[BT_MAX_HEIGHT];
+    uint32_t pos;
+    bool found;
+
+    if (!obj->root)
+        return false;
+
+    map_leaf_t *leaf = bt_descend(obj, key, path, &pos, &found);
+    if (!found)
+        return false;
+
+    /* @key may point into the leaf, and is not used past this point */
+    bt_leaf_move(obj, leaf, pos, leaf, pos + 1, leaf->count - pos - 1);
+    leaf->count--;
+    bt_rebalance(obj, path, leaf);
+    return true;
+}
+
+/* Empty map */
+void map_clear(map_t obj)
+{
+    if (obj->root)
+        bt_free(obj->root, obj->height);
+    obj->root = NULL;
+    obj->height = 0;
+}
+
+/* Destructor */
+void map_delete(map_t obj)
+{
+    map_clear(obj);
+    free(obj);
+}
@@ -0,0 +1,84 @@
+/*
+ * rv32emu is freely redistributable under the MIT License. See the file
+ * "LICENSE" for information on usage and redistribution of this file.
+ */
+
+/*
+ * C Implementation for C++ std::map using B+tree.
+ *
+ * Any data type can be stored in a map, just like std::map.
+ * A map instance requires the specification of two file types:
+ *   1. the key;
+ *   2. what data type the tree node will store;
+ *
+ * It will also require a comparison function to sort the tree.
+ *
+ * This variant trades the binary tree for a B+tree whose nodes span a few
+ * cache lines and hold 16 to 64 keys each, so that a lookup among a million
+ * elements visits four or five nodes instead of twenty. The elements live in
+ * the leaves, and the inner nodes only keep copies of keys to guide the
+ * search.
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+
+typedef enum { _CMP_LESS = -1, _CMP_EQUAL = 0, _CMP_GREATER = 1 } map_cmp_t;
+
+typedef struct map_internal *map_t;
+
+/* The elements move within and across the leaves as the map changes, so an
+ * iterator is invalidated by the next insertion or removal.
+ *
+ * @node: the leaf holding the element, NULL at the end
+ * @key: pointer to the key of the element, inside the leaf
+ * @data: pointer to the value of the element, inside the leaf
+ */
+typedef struct {
+    struct map_leaf *node;
+    void *key, *data;
+} map_iter_t;
+
+#define map_iter_value(it, type) (*(type *) (it)->data)
+
+/* Integer comparison */
+static inline map_cmp_t map_cmp_int(const void *arg0, const void *arg1)
+{
+    int *a = (int *) arg0;
+    int *b = (int *) arg1;
+    return (*a < *b) ? _CMP_LESS : (*a > *b) ? _CMP_GREATER : _CMP_EQUAL;
+}
+
+/* Unsigned integer comparison */
+static inline map_cmp_t map_cmp_uint(const void *arg0, const void *arg1)
+{
+    unsigned int *a = (unsigned int *) arg0;
+    unsigned int *b = (unsigned int *) arg1;
+    return (*a < *b) ? _CMP_LESS : (*a > *b) ? _CMP_GREATER : _CMP_EQUAL;
+}
+
+/* Constructor */
+map_t map_new(size_t, size_t, map_cmp_t (*cmp)(const void *, const void *));
+
+/* Add function */
+bool map_insert(map_t, void *, void *);
+
+/* Get functions */
+void map_find(map_t, map_iter_t *, void *);
+bool map_empty(map_t);
+
+/* Iteration */
+bool map_at_end(map_t, map_iter_t *);
+
+/* Remove functions */
+void map_erase(map_t, map_iter_t *);
+bool map_erase_key(map_t, void *);
+void map_clear(map_t);
+
+/* Destructor */
+void map_delete(map_t);
+
+#define map_init(key_type, element_type, __func) \
+    map_new(sizeof(key_type), sizeof(element_type), __func)
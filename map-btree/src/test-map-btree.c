@@ -0,0 +1,212 @@
+#include <assert.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "map.h"
+
+static void swap(int *x, int *y)
+{
+    int tmp = *x;
+    *x = *y;
+    *y = tmp;
+}
+
+enum { N_NODES = 10000 };
+
+/* return 0 on success; non-zero values on failure */
+static int test_map_mixed_operations()
+{
+    int ret = 0;
+    map_t tree = map_init(int, int, map_cmp_uint);
+
+    int key[N_NODES], val[N_NODES];
+
+    /*
+     *  Generate data for insertion
+     */
+    for (int i = 0; i < N_NODES; i++) {
+        key[i] = i;
+        val[i] = i + 1;
+    }
+
+    /* Fisher-Yates shuffle, keeping each key paired with its value */
+    for (int i = N_NODES - 1; i > 0; i--) {
+        int pos = rand() % (i + 1);
+        swap(&key[i], &key[pos]);
+        swap(&val[i], &val[pos]);
+    }
+
+    /* add first 1/2 items */
+    for (int i = 0; i < N_NODES / 2; i++) {
+        map_iter_t my_it;
+        map_insert(tree, key + i, val + i);
+        map_find(tree, &my_it, key + i);
+        if (!my_it.node) {
+            ret = 1;
+            goto free_tree;
+        }
+        assert(map_iter_value(&my_it, int) == val[i]);
+    }
+
+    /* remove first 1/4 items */
+    for (int i = 0; i < N_NODES / 4; i++) {
+        map_iter_t my_it;
+        map_find(tree, &my_it, key + i);
+        if (map_at_end(tree, &my_it))
+            continue;
+        map_erase(tree, &my_it);
+        map_find(tree, &my_it, key + i);
+        if (my_it.node) {
+            ret = 1;
+            goto free_tree;
+        }
+    }
+
+    /* add the rest */
+    for (int i = N_NODES / 2 + 1; i < N_NODES; i++) {
+        map_iter_t my_it;
+        map_insert(tree, key + i, val + i);
+        map_find(tree, &my_it, key + i);
+        if (!my_it.node) {
+            ret = 1; /* test fail */
+            goto free_tree;
+        }
+        assert(map_iter_value(&my_it, int) == val[i]);
+    }
+
+
+    /* remove 2nd quarter of items */
+    for (int i = N_NODES / 4 + 1; i < N_NODES / 2; i++) {
+        map_iter_t my_it;
+        map_find(tree, &my_it, key + i);
+        if (map_at_end(tree, &my_it)) {
+            ret = 1; /* test fail */
+            goto free_tree;
+        }
+        map_erase(tree, &my_it);
+        map_find(tree, &my_it, key + i);
+        if (my_it.node) {
+            ret = 1; /* test fail */
+            goto free_tree;
+        }
+    }
+
+free_tree:
+    map_clear(tree);
+    map_delete(tree);
+    return ret;
+}
+
+/* The map must remain usable after map_clear() freed all its nodes */
+static int test_map_clear_reuse()
+{
+    int ret = 0;
+    map_t tree = map_init(int, int, map_cmp_int);
+
+    for (int round = 0; round < 3; round++) {
+        for (int i = 0; i < N_NODES; i++) {
+            int val = i * 2;
+            map_insert(tree, &i, &val);
+        }
+
+        /* merge leaves by erasing every third key, for the next round to
+         * split them again
+         */
+        for (int i = 0; i < N_NODES; i += 3) {
+            map_iter_t my_it;
+            map_find(tree, &my_it, &i);
+            map_erase(tree, &my_it);
+        }
+
+        for (int i = 0; i < N_NODES; i++) {
+            map_iter_t my_it;
+            map_find(tree, &my_it, &i);
+            if ((i % 3 == 0) != map_at_end(tree, &my_it) ||
+                (!map_at_end(tree, &my_it) &&
+                 map_iter_value(&my_it, int) != i * 2)) {
+                ret = 1;
+                goto free_tree;
+            }
+        }
+
+        map_clear(tree);
+        if (!map_empty(tree)) {
+            ret = 1;
+            goto free_tree;
+        }
+    }
+
+free_tree:
+    map_delete(tree);
+    return ret;
+}
+
+/* Enough elements for the tree to grow several levels, and shrink back */
+static int test_map_split_merge()
+{
+    int ret = 0;
+    map_t tree = map_init(int, int, map_cmp_int);
+    enum { N = N_NODES * 10 };
+
+    /* appends pack the leaves */
+    for (int i = 0; i < N; i++) {
+        int val = -i;
+        if (!map_insert(tree, &i, &val)) {
+            ret = 1;
+            goto free_tree;
+        }
+    }
+
+    /* removals from the middle borrow from and merge with the siblings */
+    for (int i = N / 4; i < N; i += 2) {
+        if (!map_erase_key(tree, &i) || map_erase_key(tree, &i)) {
+            ret = 1;
+            goto free_tree;
+        }
+    }
+
+    /* inserts in random order split the half empty nodes */
+    for (int i = 0; i < N; i++) {
+        int k = rand() % N, val = -k;
+        map_insert(tree, &k, &val);
+    }
+
+    for (int i = 0; i < N; i++) {
+        map_iter_t my_it;
+        map_find(tree, &my_it, &i);
+        if (!map_at_end(tree, &my_it) &&
+            (*(int *) my_it.key != i || map_iter_value(&my_it, int) != -i)) {
+            ret = 1;
+            goto free_tree;
+        }
+        /* the keys below N / 4 and the odd keys were never removed */
+        if (map_at_end(tree, &my_it) && (i < N / 4 || (i - N / 4) % 2)) {
+            ret = 1;
+            goto free_tree;
+        }
+    }
+
+    for (int i = N; i-- > 0;)
+        map_erase_key(tree, &i);
+    if (!map_empty(tree))
+        ret = 1;
+
+free_tree:
+    map_delete(tree);
+    return ret;
+}
+
+int main(int argc, char *argv[])
+{
+    (void) argc;
+    (void) argv;
+
+    srand((unsigned) time(NULL));
+    int ret = test_map_mixed_operations();
+    ret |= test_map_clear_reuse();
+    ret |= test_map_split_merge();
+    printf("%s", (ret == 0) ? "PASS" : "FAIL");
+    return ret;
+}
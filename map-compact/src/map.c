@@ -0,0 +1,729 @@
+/*
+ * rv32emu is freely redistributable under the MIT License. See the file
+ * "LICENSE" for information on usage and redistribution of this file.
+ */
+
+/* This map implementation follows the one in map-jemalloc, which heavily
+ * relies on the rb.h header file from jemalloc, but replaces the node
+ * pointers by 32-bit indices into a single node array.
+ * Reference:
+ *   https://github.com/jemalloc/jemalloc/blob/dev/include/jemalloc/internal/rb.h
+ */
+
+#include <assert.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "map.h"
+
+#if defined(__GNUC__) || defined(__clang__)
+#define __UNREACHABLE __builtin_unreachable()
+#else /* unspported compilers */
+/* clang-format off */
+#define __UNREACHABLE do { /* nop */ } while (0)
+/* clang-format on */
+#endif
+
+struct map_internal {
+    uint32_t root;
+
+    /* node array: slot 0 is reserved for the null link */
+    char *nodes;
+    uint32_t count, capacity;
+    uint32_t free_list; /* released slots, linked through their left link */
+
+    /* properties */
+    size_t key_size, data_size;
+    size_t data_offset, node_size;
+
+    map_cmp_t (*comparator)(const void *, const void *);
+};
+
+/* The right link gives up its lowest bit to the color. */
+#define RB_MAX_NODES (UINT32_MAX >> 1)
+
+/* Each node is reachable by at most 31 bits of index, so the depth of a
+ * tree is bounded by twice that many levels.
+ */
+#define RB_MAX_DEPTH 64
+
+#define RB_NIL 0
+
+typedef enum { RB_BLACK = 0, RB_RED } map_color_t;
+
+/* Node accessors */
+static inline map_node_t *rb_node(const map_t rb, uint32_t node)
+{
+    return (map_node_t *) (rb->nodes + (size_t) node * rb->node_size);
+}
+
+static inline void *rb_node_key(const map_t rb, uint32_t node)
+{
+    return rb_node(rb, node) + 1;
+}
+
+static inline void *rb_node_data(const map_t rb, uint32_t node)
+{
+    return (char *) rb_node(rb, node) + rb->data_offset;
+}
+
+/* Left accessors */
+static inline uint32_t rb_node_get_left(const map_t rb, uint32_t node)
+{
+    return rb_node(rb, node)->left;
+}
+
+static inline void rb_node_set_left(map_t rb, uint32_t node, uint32_t left)
+{
+    rb_node(rb, node)->left = left;
+}
+
+/* Right accessors */
+static inline uint32_t rb_node_get_right(const map_t rb, uint32_t node)
+{
+    return rb_node(rb, node)->right_red >> 1;
+}
+
+static inline void rb_node_set_right(map_t rb, uint32_t node, uint32_t right)
+{
+    map_node_t *n = rb_node(rb, node);
+    n->right_red = (right << 1) | (n->right_red & 1);
+}
+
+/* Color accessors */
+static inline map_color_t rb_node_get_color(const map_t rb, uint32_t node)
+{
+    return rb_node(rb, node)->right_red & 1;
+}
+
+static inline void rb_node_set_color(map_t rb,
+                                     uint32_t node,
+                                     map_color_t color)
+{
+    map_node_t *n = rb_node(rb, node);
+    n->right_red = (n->right_red & ~1U) | color;
+}
+
+static inline void rb_node_set_red(map_t rb, uint32_t node)
+{
+    rb_node(rb, node)->right_red |= 1;
+}
+
+static inline void rb_node_set_black(map_t rb, uint32_t node)
+{
+    rb_node(rb, node)->right_red &= ~1U;
+}
+
+/* Node initializer */
+static inline void rb_node_init(map_t rb, uint32_t node)
+{
+    assert(node != RB_NIL);
+    rb_node_set_left(rb, node, RB_NIL);
+    rb_node(rb, node)->right_red = RB_NIL;
+    rb_node_set_red(rb, node);
+}
+
+/* Internal helper macros */
+#define rb_node_rotate_left(rb, x_node, r_node)                          \
+    do {                                                                 \
+        (r_node) = rb_node_get_right((rb), (x_node));                    \
+        rb_node_set_right((rb), (x_node),                                \
+                          rb_node_get_left((rb), (r_node)));             \
+        rb_node_set_left((rb), (r_node), (x_node));                      \
+    } while (0)
+
+#define rb_node_rotate_right(rb, x_node, r_node)                         \
+    do {                                                                 \
+        (r_node) = rb_node_get_left((rb), (x_node));                     \
+        rb_node_set_left((rb), (x_node),                                 \
+                         rb_node_get_right((rb), (r_node)));             \
+        rb_node_set_right((rb), (r_node), (x_node));                     \
+    } while (0)
+
+typedef struct {
+    uint32_t node;
+    map_cmp_t cmp;
+} rb_path_entry_t;
+
+static inline uint32_t rb_search(map_t rb, const void *key)
+{
+    uint32_t ret = rb->root;
+    while (ret) {
+        map_cmp_t cmp = (rb->comparator)(key, rb_node_key(rb, ret));
+        switch (cmp) {
+        case _CMP_EQUAL:
+            return ret;
+        case _CMP_LESS:
+            ret = rb_node_get_left(rb, ret);
+            break;
+        case _CMP_GREATER:
+            ret = rb_node_get_right(rb, ret);
+            break;
+        default:
+            __UNREACHABLE;
+            break;
+        }
+    }
+    return ret;
+}
+
+/* Traverse through red-black tree node and find the search target node,
+ * recording the path in @path from the root. Return the node holding @key if
+ * any. Otherwise, @*pathpp is left at the null link where @key belongs.
+ */
+static uint32_t rb_insert_search(map_t rb,
+                                 const void *key,
+                                 rb_path_entry_t *path,
+                                 rb_path_entry_t **pathpp)
+{
+    rb_path_entry_t *pathp;
+
+    path->node = rb->root;
+    for (pathp = path; pathp->node; pathp++) {
+        map_cmp_t cmp = pathp->cmp =
+            (rb->comparator)(key, rb_node_key(rb, pathp->node));
+        switch (cmp) {
+        case _CMP_LESS:
+            pathp[1].node = rb_node_get_left(rb, pathp->node);
+            break;
+        case _CMP_GREATER:
+            pathp[1].node = rb_node_get_right(rb, pathp->node);
+            break;
+        case _CMP_EQUAL:
+            return pathp->node;
+        default:
+            __UNREACHABLE;
+            break;
+        }
+    }
+    *pathpp = pathp;
+    return RB_NIL;
+}
+
+/* Link @node at the null link @pathp found by rb_insert_search() */
+static void rb_insert_fixup(map_t rb,
+                            rb_path_entry_t *path,
+                            rb_path_entry_t *pathp,
+                            uint32_t node)
+{
+    rb_node_init(rb, node);
+    pathp->node = node;
+
+    assert(!rb_node_get_left(rb, node));
+    assert(!rb_node_get_right(rb, node));
+
+    /* Go from target node back to root node and fix color accordingly */
+    for (pathp--; (uintptr_t) pathp >= (uintptr_t) path; pathp--) {
+        uint32_t cnode = pathp->node;
+        if (pathp->cmp == _CMP_LESS) {
+            uint32_t left = pathp[1].node;
+            rb_node_set_left(rb, cnode, left);
+            if (rb_node_get_color(rb, left) == RB_BLACK)
+                return;
+            uint32_t leftleft = rb_node_get_left(rb, left);
+            if (leftleft && (rb_node_get_color(rb, leftleft) == RB_RED)) {
+                /* fix up 4-node */
+                uint32_t tnode;
+                rb_node_set_black(rb, leftleft);
+                rb_node_rotate_right(rb, cnode, tnode);
+                cnode = tnode;
+            }
+        } else {
+            uint32_t right = pathp[1].node;
+            rb_node_set_right(rb, cnode, right);
+            if (rb_node_get_color(rb, right) == RB_BLACK)
+                return;
+            uint32_t left = rb_node_get_left(rb, cnode);
+            if (left && (rb_node_get_color(rb, left) == RB_RED)) {
+                /* split 4-node */
+                rb_node_set_black(rb, left);
+                rb_node_set_black(rb, right);
+                rb_node_set_red(rb, cnode);
+            } else {
+                /* lean left */
+                uint32_t tnode;
+                map_color_t tcolor = rb_node_get_color(rb, cnode);
+                rb_node_rotate_left(rb, cnode, tnode);
+                rb_node_set_color(rb, tnode, tcolor);
+                rb_node_set_red(rb, cnode);
+                cnode = tnode;
+            }
+        }
+        pathp->node = cnode;
+    }
+
+    /* set root, and make it black */
+    rb->root = path->node;
+    rb_node_set_black(rb, rb->root);
+}
+
+static void rb_remove(map_t rb, uint32_t node)
+{
+    rb_path_entry_t path[RB_MAX_DEPTH];
+    rb_path_entry_t *pathp = RB_NIL, *nodep = RB_NIL;
+
+    /* Traverse through red-black tree node and find the search target node. */
+    path->node = rb->root;
+    pathp = path;
+    while (pathp->node) {
+        map_cmp_t cmp = pathp->cmp =
+            (rb->comparator)(rb_node_key(rb, node),
+                             rb_node_key(rb, pathp->node));
+        if (cmp == _CMP_LESS) {
+            pathp[1].node = rb_node_get_left(rb, pathp->node);
+        } else {
+            pathp[1].node = rb_node_get_right(rb, pathp->node);
+            if (cmp == _CMP_EQUAL) {
+                /* find node's successor, in preparation for swap */
+                pathp->cmp = _CMP_GREATER;
+                nodep = pathp;
+                for (pathp++; pathp->node; pathp++) {
+                    pathp->cmp = _CMP_LESS;
+                    pathp[1].node = rb_node_get_left(rb, pathp->node);
+                }
+                break;
+            }
+        }
+        pathp++;
+    }
+    assert(nodep && nodep->node == node);
+
+    pathp--;
+    if (pathp->node != node) {
+        /* swap node with its successor */
+        map_color_t tcolor = rb_node_get_color(rb, pathp->node);
+        rb_node_set_color(rb, pathp->node, rb_node_get_color(rb, node));
+        rb_node_set_left(rb, pathp->node, rb_node_get_left(rb, node));
+
+        /* If the node's successor is its right child, the following code may
+         * behave incorrectly for the right child pointer.
+         * However, it is not a problem as the pointer will be correctly set
+         * when the successor is pruned.
+         */
+        rb_node_set_right(rb, pathp->node, rb_node_get_right(rb, node));
+        rb_node_set_color(rb, node, tcolor);
+
+        /* The child pointers of the pruned leaf node are never accessed again,
+         * so there is no need to set them to RB_NIL.
+         */
+        nodep->node = pathp->node;
+        pathp->node = node;
+        if (nodep == path) {
+            rb->root = nodep->node;
+        } else {
+            if (nodep[-1].cmp == _CMP_LESS)
+                rb_node_set_left(rb, nodep[-1].node, nodep->node);
+            else
+                rb_node_set_right(rb, nodep[-1].node, nodep->node);
+        }
+    } else {
+        uint32_t left = rb_node_get_left(rb, node);
+        if (left) {
+            /* node has no successor, but it has a left child.
+             * Splice node out, without losing the left child.
+             */
+            assert(rb_node_get_color(rb, node) == RB_BLACK);
+            assert(rb_node_get_color(rb, left) == RB_RED);
+            rb_node_set_black(rb, left);
+            if (pathp == path) {
+                /* the subtree rooted at the node's left child has not
+                 * changed, and it is now the root.
+                 */
+                rb->root = left;
+            } else {
+                if (pathp[-1].cmp == _CMP_LESS)
+                    rb_node_set_left(rb, pathp[-1].node, left);
+                else
+                    rb_node_set_right(rb, pathp[-1].node, left);
+            }
+            return;
+        } else if (pathp == path) {
+            /* the tree only contained one node */
+            rb->root = RB_NIL;
+            return;
+        }
+    }
+
+    /* The invariant has been established that the node has no right child
+     * (morally speaking; the right child was not explicitly nulled out if
+     * swapped with its successor). Furthermore, the only nodes with
+     * out-of-date summaries exist in path[0], path[1], ..., pathp[-1].
+     */
+    if (rb_node_get_color(rb, pathp->node) == RB_RED) {
+        /* prune red node, which requires no fixup */
+        assert(pathp[-1].cmp == _CMP_LESS);
+        rb_node_set_left(rb, pathp[-1].node, RB_NIL);
+        return;
+    }
+
+    /* The node to be pruned is black, so unwind until balance is restored. */
+    pathp->node = RB_NIL;
+    for (pathp--; (uintptr_t) pathp >= (uintptr_t) path; pathp--) {
+        assert(pathp->cmp != _CMP_EQUAL);
+        if (pathp->cmp == _CMP_LESS) {
+            rb_node_set_left(rb, pathp->node, pathp[1].node);
+            if (rb_node_get_color(rb, pathp->node) == RB_RED) {
+                uint32_t right = rb_node_get_right(rb, pathp->node);
+                uint32_t rightleft = rb_node_get_left(rb, right);
+                uint32_t tnode;
+                if (rightleft && (rb_node_get_color(rb, rightleft) == RB_RED)) {
+                    /* In the following diagrams, ||, //, and \\
+                     * indicate the path to the removed node.
+                     *
+                     *      ||
+                     *    pathp(r)
+                     *  //        \
+                     * (b)        (b)
+                     *           /
+                     *          (r)
+                     */
+                    rb_node_set_black(rb, pathp->node);
+                    rb_node_rotate_right(rb, right, tnode);
+                    rb_node_set_right(rb, pathp->node, tnode);
+                    rb_node_rotate_left(rb, pathp->node, tnode);
+                } else {
+                    /*      ||
+                     *    pathp(r)
+                     *  //        \
+                     * (b)        (b)
+                     *           /
+                     *          (b)
+                     */
+                    rb_node_rotate_left(rb, pathp->node, tnode);
+                }
+
+                /* Balance restored, but rotation modified subtree root. */
+                assert((uintptr_t) pathp > (uintptr_t) path);
+                if (pathp[-1].cmp == _CMP_LESS)
+                    rb_node_set_left(rb, pathp[-1].node, tnode);
+                else
+                    rb_node_set_right(rb, pathp[-1].node, tnode);
+                return;
+            } else {
+                uint32_t right = rb_node_get_right(rb, pathp->node);
+                uint32_t rightleft = rb_node_get_left(rb, right);
+                if (rightleft && (rb_node_get_color(rb, rightleft) == RB_RED)) {
+                    /*      ||
+                     *    pathp(b)
+                     *  //        \
+                     * (b)        (b)
+                     *           /
+                     *          (r)
+                     */
+                    uint32_t tnode;
+                    rb_node_set_black(rb, rightleft);
+                    rb_node_rotate_right(rb, right, tnode);
+                    rb_node_set_right(rb, pathp->node, tnode);
+                    rb_node_rotate_left(rb, pathp->node, tnode);
+                    /* Balance restored, but rotation modified subtree root,
+                     * which may actually be the tree root.
+                     */
+                    if (pathp == path) {
+                        /* set root */
+                        rb->root = tnode;
+                    } else {
+                        if (pathp[-1].cmp == _CMP_LESS)
+                            rb_node_set_left(rb, pathp[-1].node, tnode);
+                        else
+                            rb_node_set_right(rb, pathp[-1].node, tnode);
+                    }
+                    return;
+                } else {
+                    /*      ||
+                     *    pathp(b)
+                     *  //        \
+                     * (b)        (b)
+                     *           /
+                     *          (b)
+                     */
+                    uint32_t tnode;
+                    rb_node_set_red(rb, pathp->node);
+                    rb_node_rotate_left(rb, pathp->node, tnode);
+                    pathp->node = tnode;
+                }
+            }
+        } else {
+            rb_node_set_right(rb, pathp->node, pathp[1].node);
+            uint32_t left = rb_node_get_left(rb, pathp->node);
+            if (rb_node_get_color(rb, left) == RB_RED) {
+                uint32_t tnode;
+                uint32_t leftright = rb_node_get_right(rb, left);
+                uint32_t leftrightleft = rb_node_get_left(rb, leftright);
+                if (leftrightleft &&
+                    (rb_node_get_color(rb, leftrightleft) == RB_RED)) {
+                    /*      ||
+                     *    pathp(b)
+                     *   /        \\
+                     * (r)        (b)
+                     *   \
+                     *   (b)
+                     *   /
+                     * (r)
+                     */
+                    uint32_t unode;
+                    rb_node_set_black(rb, leftrightleft);
+                    rb_node_rotate_right(rb, pathp->node, unode);
+                    rb_node_rotate_right(rb, pathp->node, tnode);
+                    rb_node_set_right(rb, unode, tnode);
+                    rb_node_rotate_left(rb, unode, tnode);
+                } else {
+                    /*      ||
+                     *    pathp(b)
+                     *   /        \\
+                     * (r)        (b)
+                     *   \
+                     *   (b)
+                     *   /
+                     * (b)
+                     */
+                    assert(leftright);
+                    rb_node_set_red(rb, leftright);
+                    rb_node_rotate_right(rb, pathp->node, tnode);
+                    rb_node_set_black(rb, tnode);
+                }
+
+                /* Balance restored, but rotation modified subtree root, which
+                 * may actually be the tree root.
+                 */
+                if (pathp == path) {
+                    /* set root */
+                    rb->root = tnode;
+                } else {
+                    if (pathp[-1].cmp == _CMP_LESS)
+                        rb_node_set_left(rb, pathp[-1].node, tnode);
+                    else
+                        rb_node_set_right(rb, pathp[-1].node, tnode);
+                }
+                return;
+            } else if (rb_node_get_color(rb, pathp->node) == RB_RED) {
+                uint32_t leftleft = rb_node_get_left(rb, left);
+                if (leftleft && (rb_node_get_color(rb, leftleft) == RB_RED)) {
+                    /*        ||
+                     *      pathp(r)
+                     *     /        \\
+                     *   (b)        (b)
+                     *   /
+                     * (r)
+                     */
+                    uint32_t tnode;
+                    rb_node_set_black(rb, pathp->node);
+                    rb_node_set_red(rb, left);
+                    rb_node_set_black(rb, leftleft);
+                    rb_node_rotate_right(rb, pathp->node, tnode);
+                    /* Balance restored, but rotation modified subtree root. */
+                    assert((uintptr_t) pathp > (uintptr_t) path);
+                    if (pathp[-1].cmp == _CMP_LESS)
+                        rb_node_set_left(rb, pathp[-1].node, tnode);
+                    else
+                        rb_node_set_right(rb, pathp[-1].node, tnode);
+                    return;
+                } else {
+                    /*        ||
+                     *      pathp(r)
+                     *     /        \\
+                     *   (b)        (b)
+                     *   /
+                     * (b)
+                     */
+                    rb_node_set_red(rb, left);
+                    rb_node_set_black(rb, pathp->node);
+                    /* balance restored */
+                    return;
+                }
+            } else {
+                uint32_t leftleft = rb_node_get_left(rb, left);
+                if (leftleft && (rb_node_get_color(rb, leftleft) == RB_RED)) {
+                    /*               ||
+                     *             pathp(b)
+                     *            /        \\
+                     *          (b)        (b)
+                     *          /
+                     *        (r)
+                     */
+                    uint32_t tnode;
+                    rb_node_set_black(rb, leftleft);
+                    rb_node_rotate_right(rb, pathp->node, tnode);
+                    /* Balance restored, but rotation modified subtree root,
+                     * which may actually be the tree root.
+                     */
+                    if (pathp == path) {
+                        /* set root */
+                        rb->root = tnode;
+                    } else {
+                        if (pathp[-1].cmp == _CMP_LESS)
+                            rb_node_set_left(rb, pathp[-1].node, tnode);
+                        else
+                            rb_node_set_right(rb, pathp[-1].node, tnode);
+                    }
+                    return;
+                } else {
+                    /*               ||
+                     *             pathp(b)
+                     *            /        \\
+                     *          (b)        (b)
+                     *          /
+                     *        (b)
+                     */
+                    rb_node_set_red(rb, left);
+                }
+            }
+        }
+    }
+
+    /* set root */
+    rb->root = path->node;
+    assert(rb_node_get_color(rb, rb->root) == RB_BLACK);
+}
+
+/* Take a slot from the free list, or from the end of the node array.
+ * Return RB_NIL if the array cannot grow any further.
+ */
+static uint32_t map_alloc_node(map_t obj)
+{
+    uint32_t node = obj->free_list;
+    if (node) {
+        obj->free_list = rb_node_get_left(obj, node);
+        return node;
+    }
+
+    if (obj->count == obj->capacity) {
+        /* the indices of the slots, the null one included, fit in 31 bits */
+        size_t capacity = (size_t) obj->capacity * 2;
+        if (capacity > (size_t) RB_MAX_NODES + 1)
+            capacity = (size_t) RB_MAX_NODES + 1;
+        if (capacity == obj->capacity)
+            return RB_NIL;
+
+        char *nodes = realloc(obj->nodes, capacity * obj->node_size);
+        if (!nodes)
+            return RB_NIL;
+        obj->nodes = nodes;
+        obj->capacity = (uint32_t) capacity;
+    }
+    return obj->count++;
+}
+
+static void map_free_node(map_t obj, uint32_t node)
+{
+    rb_node_set_left(obj, node, obj->free_list);
+    obj->free_list = node;
+}
+
+static uint32_t map_create_node(map_t obj, void *key, void *value)
+{
+    uint32_t node = map_alloc_node(obj);
+    if (!node)
+        return RB_NIL;
+
+    /* copy over the key and values.
+     * If the parameter passed in is NULL, make the element blank instead of
+     * a segfault.
+     */
+    if (!key)
+        memset(rb_node_key(obj, node), 0, obj->key_size);
+    else
+        memcpy(rb_node_key(obj, node), key, obj->key_size);
+
+    if (!value)
+        memset(rb_node_data(obj, node), 0, obj->data_size);
+    else
+        memcpy(rb_node_data(obj, node), value, obj->data_size);
+
+    return node;
+}
+
+/* Constructor */
+map_t map_new(size_t s1,
+              size_t s2,
+              map_cmp_t (*cmp)(const void *, const void *))
+{
+    map_t tree = malloc(sizeof(struct map_internal));
+    assert(tree);
+
+    /* Keep the slots as small as the key and the data allow: 4-byte
+     * alignment suffices unless one of them is made of 8-byte words.
+     */
+    size_t align = (s1 % 8 == 0 || s2 % 8 == 0) ? 8 : 4;
+    tree->key_size = s1, tree->data_size = s2;
+    tree->data_offset =
+        (sizeof(map_node_t) + s1 + align - 1) & ~(align - 1);
+    tree->node_size = (tree->data_offset + s2 + align - 1) & ~(align - 1);
+    tree->comparator = cmp;
+
+    tree->root = RB_NIL;
+    tree->free_list = RB_NIL;
+    tree->count = 1; /* the null slot */
+    tree->capacity = 16;
+    tree->nodes = malloc(tree->capacity * tree->node_size);
+    assert(tree->nodes);
+
+    /* the null slot is a black node without children */
+    memset(tree->nodes, 0, tree->node_size);
+    return tree;
+}
+
+/* Add function */
+bool map_insert(map_t obj, void *key, void *val)
+{
+    rb_path_entry_t path[RB_MAX_DEPTH], *pathp;
+    if (rb_insert_search(obj, key, path, &pathp))
+        return false;
+
+    uint32_t node = map_create_node(obj, key, val);
+    if (!node)
+        return false;
+    rb_insert_fixup(obj, path, pathp, node);
+    return true;
+}
+
+/* Get functions */
+void map_find(map_t obj, map_iter_t *it, void *key)
+{
+    uint32_t node = rb_search(obj, key);
+    if (!node) {
+        it->node = NULL;
+        return;
+    }
+
+    it->node = rb_node(obj, node);
+    it->key = rb_node_key(obj, node);
+    it->data = rb_node_data(obj, node);
+}
+
+bool map_empty(map_t obj)
+{
+    return !obj->root;
+}
+
+/* Iteration */
+bool map_at_end(map_t UNUSED, map_iter_t *it)
+{
+    return !(it->node);
+}
+
+/* Remove functions */
+void map_erase(map_t obj, map_iter_t *it)
+{
+    if (!it->node)
+        return;
+
+    uint32_t node = ((char *) it->node - obj->nodes) / obj->node_size;
+    rb_remove(obj, node);
+    map_free_node(obj, node);
+}
+
+/* Empty map. The node array is kept for the elements to come. */
+void map_clear(map_t obj)
+{
+    obj->root = RB_NIL;
+    obj->free_list = RB_NIL;
+    obj->count = 1;
+}
+
+/* Destructor */
+void map_delete(map_t obj)
+{
+    free(obj->nodes);
+    free(obj);
+}
@@ -0,0 +1,210 @@
+#include <assert.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "map.h"
+
+static void swap(int *x, int *y)
+{
+    int tmp = *x;
+    *x = *y;
+    *y = tmp;
+}
+
+enum { N_NODES = 10000 };
+
+/* return 0 on success; non-zero values on failure */
+static int test_map_mixed_operations()
+{
+    int ret = 0;
+    map_t tree = map_init(int, int, map_cmp_uint);
+
+    int key[N_NODES], val[N_NODES];
+
+    /*
+     *  Generate data for insertion
+     */
+    for (int i = 0; i < N_NODES; i++) {
+        key[i] = i;
+        val[i] = i + 1;
+    }
+
+    /* Fisher-Yates shuffle, keeping each key paired with its value */
+    for (int i = N_NODES - 1; i > 0; i--) {
+        int pos = rand() % (i + 1);
+        swap(&key[i], &key[pos]);
+        swap(&val[i], &val[pos]);
+    }
+
+    /* add first 1/2 items */
+    for (int i = 0; i < N_NODES / 2; i++) {
+        map_iter_t my_it;
+        map_insert(tree, key + i, val + i);
+        map_find(tree, &my_it, key + i);
+        if (!my_it.node) {
+            ret = 1;
+            goto free_tree;
+        }
+        assert(map_iter_value(&my_it, int) == val[i]);
+    }
+
+    /* remove first 1/4 items */
+    for (int i = 0; i < N_NODES / 4; i++) {
+        map_iter_t my_it;
+        map_find(tree, &my_it, key + i);
+        if (map_at_end(tree, &my_it))
+            continue;
+        map_erase(tree, &my_it);
+        map_find(tree, &my_it, key + i);
+        if (my_it.node) {
+            ret = 1;
+            goto free_tree;
+        }
+    }
+
+    /* add the rest */
+    for (int i = N_NODES / 2 + 1; i < N_NODES; i++) {
+        map_iter_t my_it;
+        map_insert(tree, key + i, val + i);
+        map_find(tree, &my_it, key + i);
+        if (!my_it.node) {
+            ret = 1; /* test fail */
+            goto free_tree;
+        }
+        assert(map_iter_value(&my_it, int) == val[i]);
+    }
+
+
+    /* remove 2nd quarter of items */
+    for (int i = N_NODES / 4 + 1; i < N_NODES / 2; i++) {
+        map_iter_t my_it;
+        map_find(tree, &my_it, key + i);
+        if (map_at_end(tree, &my_it)) {
+            ret = 1; /* test fail */
+            goto free_tree;
+        }
+        map_erase(tree, &my_it);
+        map_find(tree, &my_it, key + i);
+        if (my_it.node) {
+            ret = 1; /* test fail */
+            goto free_tree;
+        }
+    }
+
+free_tree:
+    map_clear(tree);
+    map_delete(tree);
+    return ret;
+}
+
+/* Inserting a key that is already present must leave the map untouched */
+static int test_map_insert_duplicate()
+{
+    int ret = 0;
+    map_t tree = map_init(int, int, map_cmp_int);
+
+    for (int i = 0; i < N_NODES; i++) {
+        int val = i * 2;
+        if (!map_insert(tree, &i, &val)) {
+            ret = 1;
+            goto free_tree;
+        }
+    }
+
+    for (int i = 0; i < N_NODES; i++) {
+        int val = -1;
+        if (map_insert(tree, &i, &val)) {
+            ret = 1;
+            goto free_tree;
+        }
+    }
+
+    for (int i = 0; i < N_NODES; i++) {
+        map_iter_t my_it;
+        map_find(tree, &my_it, &i);
+        if (map_at_end(tree, &my_it) || map_iter_value(&my_it, int) != i * 2) {
+            ret = 1;
+            goto free_tree;
+        }
+    }
+
+    /* No slot was taken by the rejected insertions, so the next key lands
+     * right after the last one in the node array.
+     */
+    int next = N_NODES, val = next * 2;
+    map_insert(tree, &next, &val);
+    map_iter_t first, second, last, added;
+    int k0 = 0, k1 = 1, kn = N_NODES - 1;
+    map_find(tree, &first, &k0);
+    map_find(tree, &second, &k1);
+    map_find(tree, &last, &kn);
+    map_find(tree, &added, &next);
+    if (map_at_end(tree, &added) ||
+        (char *) added.node - (char *) last.node !=
+            (char *) second.node - (char *) first.node) {
+        ret = 1;
+        goto free_tree;
+    }
+
+free_tree:
+    map_clear(tree);
+    map_delete(tree);
+    return ret;
+}
+
+/* The map must remain usable after its nodes were released in bulk */
+static int test_map_clear_reuse()
+{
+    int ret = 0;
+    map_t tree = map_init(int, int, map_cmp_int);
+
+    for (int round = 0; round < 3; round++) {
+        for (int i = 0; i < N_NODES; i++) {
+            int val = i * 2;
+            map_insert(tree, &i, &val);
+        }
+
+        /* punch holes so that the free list gets used by the next round */
+        for (int i = 0; i < N_NODES; i += 3) {
+            map_iter_t my_it;
+            map_find(tree, &my_it, &i);
+            map_erase(tree, &my_it);
+        }
+
+        for (int i = 0; i < N_NODES; i++) {
+            map_iter_t my_it;
+            map_find(tree, &my_it, &i);
+            if ((i % 3 == 0) != map_at_end(tree, &my_it) ||
+                (!map_at_end(tree, &my_it) &&
+                 map_iter_value(&my_it, int) != i * 2)) {
+                ret = 1;
+                goto free_tree;
+            }
+        }
+
+        map_clear(tree);
+        if (!map_empty(tree)) {
+            ret = 1;
+            goto free_tree;
+        }
+    }
+
+free_tree:
+    map_delete(tree);
+    return ret;
+}
+
+int main(int argc, char *argv[])
+{
+    (void) argc;
+    (void) argv;
+
+    srand((unsigned) time(NULL));
+    int ret = test_map_mixed_operations();
+    ret |= test_map_insert_duplicate();
+    ret |= test_map_clear_reuse();
+    printf("%s", (ret == 0) ? "PASS" : "FAIL");
+    return ret;
+}
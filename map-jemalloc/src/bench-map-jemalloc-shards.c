@@ -0,0 +1,182 @@
+/*
+ * rv32emu is freely redistributable under the MIT License. See the file
+ * "LICENSE" for information on usage and redistribution of this file.
+ */
+
+/*
+ * Insertions and removals from 1, 2, 4, ... writer threads, into one map
+ * behind a mutex and into a shardmap_t.
+ *
+ * usage: bench-map-jemalloc-shards [max-threads]
+ */
+
+#include <assert.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "bench-rng.h"
+#include "map.h"
+#include "shardmap.h"
+
+/* enough shards for the threads to rarely meet on one */
+#define N_SHARDS 64
+
+static map_cmp_t map_cmp_sizet(const void *arg0, const void *arg1)
+{
+    size_t a = *(const size_t *) arg0, b = *(const size_t *) arg1;
+    return (a < b) ? _CMP_LESS : (a > b) ? _CMP_GREATER : _CMP_EQUAL;
+}
+
+/* One map behind one lock, the baseline */
+typedef struct {
+    pthread_mutex_t lock;
+    map_t map;
+} locked_map_t;
+
+typedef struct {
+    locked_map_t *locked; /* NULL for the sharded map */
+    shardmap_t sharded;
+    bool erase;
+    size_t *key;
+    size_t n;
+    pthread_barrier_t *start;
+} worker_t;
+
+static void *worker_thread(void *arg)
+{
+    worker_t *w = arg;
+
+    pthread_barrier_wait(w->start);
+    for (size_t i = 0; i < w->n; i++) {
+        size_t *k = w->key + i;
+        if (w->sharded) {
+            if (w->erase)
+                shardmap_erase(w->sharded, k);
+            else
+                shardmap_insert(w->sharded, k, k);
+            continue;
+        }
+
+        pthread_mutex_lock(&w->locked->lock);
+        if (w->erase)
+            map_erase_key(w->locked->map, k);
+        else
+            map_insert(w->locked->map, k, k);
+        pthread_mutex_unlock(&w->locked->lock);
+    }
+    return NULL;
+}
+
+/* @scale insertions or removals split among @threads threads */
+static double perf_writers(worker_t *proto, size_t scale, unsigned threads)
+{
+    pthread_t tid[threads];
+    worker_t w[threads];
+    pthread_barrier_t start;
+
+    pthread_barrier_init(&start, NULL, threads + 1);
+    for (unsigned t = 0; t < threads; t++) {
+        size_t lo = scale * t / threads, hi = scale * (t + 1) / threads;
+        w[t] = *proto;
+        w[t].key += lo;
+        w[t].n = hi - lo;
+        w[t].start = &start;
+        pthread_create(tid + t, NULL, worker_thread, w + t);
+    }
+
+    /* the workers are all waiting for this thread at the barrier */
+    struct timespec before;
+    struct timespec after;
+    clock_gettime(CLOCK_MONOTONIC, &before);
+    pthread_barrier_wait(&start);
+    for (unsigned t = 0; t < threads; t++)
+        pthread_join(tid[t], NULL);
+    clock_gettime(CLOCK_MONOTONIC, &after);
+
+    pthread_barrier_destroy(&start);
+    return (after.tv_sec - before.tv_sec) * 1000000000UL +
+           (after.tv_nsec - before.tv_nsec);
+}
+
+static void perf_rb(rng_t *rng,
+                    const size_t scale,
+                    const size_t reps,
+                    unsigned max_threads)
+{
+    size_t *key = malloc(scale * sizeof(size_t));
+
+    for (size_t i = 0; i < scale; i++)
+        key[i] = i;
+    shuffle(rng, key, scale);
+
+    /* 1, 2, 4, ... threads, and as many as there are cores */
+    for (unsigned threads = 1;; threads *= 2) {
+        if (threads > max_threads)
+            threads = max_threads;
+
+        locked_map_t locked;
+        pthread_mutex_init(&locked.lock, NULL);
+        locked.map = map_init(size_t, size_t, map_cmp_sizet);
+        shardmap_t sharded =
+            shardmap_init(N_SHARDS, SHARDMAP_HASH, size_t, size_t,
+                          map_cmp_sizet);
+
+        char benchmark_id[32];
+        worker_t proto = {.locked = &locked, .key = key};
+        snprintf(benchmark_id, sizeof(benchmark_id), "mutex-%u", threads);
+        double result = perf_writers(&proto, scale, threads);
+        printf("%f, %s, %s, %zu, %zu\n", result, benchmark_id, "insert", scale,
+               reps);
+        proto.erase = true;
+        result = perf_writers(&proto, scale, threads);
+        printf("%f, %s, %s, %zu, %zu\n", result, benchmark_id, "erase", scale,
+               reps);
+
+        proto = (worker_t){.sharded = sharded, .key = key};
+        snprintf(benchmark_id, sizeof(benchmark_id), "shards-%u", threads);
+        result = perf_writers(&proto, scale, threads);
+        printf("%f, %s, %s, %zu, %zu\n", result, benchmark_id, "insert", scale,
+               reps);
+        proto.erase = true;
+        result = perf_writers(&proto, scale, threads);
+        printf("%f, %s, %s, %zu, %zu\n", result, benchmark_id, "erase", scale,
+               reps);
+
+        map_delete(locked.map);
+        pthread_mutex_destroy(&locked.lock);
+        shardmap_delete(sharded);
+
+        if (threads == max_threads)
+            break;
+    }
+
+    free(key);
+}
+
+int main(int argc, char *argv[])
+{
+    size_t scale[] = {/*1, 1e1, 1e2, 1e3,*/ 1e4, 1e5, 1e6 /*, 1e7, 1e8*/};
+    size_t n_scales = 3;
+    size_t reps = 20;
+
+    /* the number of threads to go up to, the online cores by default */
+    long cores = sysconf(_SC_NPROCESSORS_ONLN);
+    unsigned max_threads = (argc > 1) ? (unsigned) atoi(argv[1])
+                           : (cores > 0) ? (unsigned) cores
+                                         : 1;
+    if (max_threads == 0)
+        max_threads = 1;
+
+    rng_t rng;
+    rng_seed(&rng, 1);
+    for (size_t i = 0; i < n_scales; i++) {
+        /* the last field of the output counts the repetitions left */
+        for (size_t left = reps; left > 0; left--)
+            perf_rb(&rng, scale[i], left, max_threads);
+    }
+    return 0;
+}
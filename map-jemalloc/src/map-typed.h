@@ -0,0 +1,600 @@
+/*
+ * rv32emu is freely redistributable under the MIT License. See the file
+ * "LICENSE" for information on usage and redistribution of this file.
+ */
+
+/*
+ * Type-specialized map generator.
+ *
+ * MAP_DEFINE(name, key_type, val_type, key_cmp) emits a map whose nodes store
+ * the key and the value by value, and whose lookups call @key_cmp directly so
+ * that it can be inlined into the descent. @key_cmp takes two keys and
+ * returns a negative, zero or positive integer, just like strcmp(). For
+ * instance,
+ *
+ *   MAP_DEFINE(u32map, uint32_t, block_t *, MAP_CMP_SCALAR)
+ *
+ * defines u32map_t along with u32map_new(), u32map_insert(), u32map_find(),
+ * u32map_erase(), u32map_empty(), u32map_clear() and u32map_delete().
+ *
+ * Only the descents depend on the key type, so they are generated for each
+ * map, while the rebalancing operates on the links alone and is shared. The
+ * trees are the same left-leaning red-black trees as in map.c, which follow
+ * the rb_gen() of jemalloc.
+ */
+
+#pragma once
+
+#include <assert.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "slab.h"
+
+/* Comparison of keys that support the relational operators */
+#define MAP_CMP_SCALAR(a, b) (((a) > (b)) - ((a) < (b)))
+
+/* See RB_MAX_DEPTH in map.c */
+#define RBT_MAX_DEPTH (sizeof(void *) << 4)
+
+/* Tree linkage, which must be the first member of a generated node.
+ *
+ * @left: pointer to the left child in the tree
+ * @right_red: combination of a pointer to right child and @color (lowest
+ * bit)
+ */
+typedef struct rbt_link {
+    struct rbt_link *left, *right_red;
+} rbt_link_t;
+
+typedef struct {
+    rbt_link_t *node;
+    int cmp;
+} rbt_path_entry_t;
+
+typedef enum { RBT_BLACK = 0, RBT_RED } rbt_color_t;
+
+/* Left accessors */
+static inline rbt_link_t *rbt_get_left(const rbt_link_t *node)
+{
+    return node->left;
+}
+
+static inline void rbt_set_left(rbt_link_t *node, rbt_link_t *left)
+{
+    node->left = left;
+}
+
+/* Right accessors */
+static inline rbt_link_t *rbt_get_right(const rbt_link_t *node)
+{
+    return (rbt_link_t *) (((uintptr_t) node->right_red) & ~3);
+}
+
+static inline void rbt_set_right(rbt_link_t *node, rbt_link_t *right)
+{
+    node->right_red = (rbt_link_t *) (((uintptr_t) right) |
+                                      (((uintptr_t) node->right_red) & 1));
+}
+
+/* Color accessors */
+static inline rbt_color_t rbt_get_color(const rbt_link_t *node)
+{
+    return ((uintptr_t) node->right_red) & 1;
+}
+
+static inline void rbt_set_color(rbt_link_t *node, rbt_color_t color)
+{
+    node->right_red =
+        (rbt_link_t *) (((uintptr_t) node->right_red & ~3) | color);
+}
+
+static inline void rbt_set_red(rbt_link_t *node)
+{
+    node->right_red = (rbt_link_t *) (((uintptr_t) node->right_red) | 1);
+}
+
+static inline void rbt_set_black(rbt_link_t *node)
+{
+    node->right_red = (rbt_link_t *) (((uintptr_t) node->right_red) & ~3);
+}
+
+/* Node initializer */
+static inline void rbt_link_init(rbt_link_t *node)
+{
+    assert((((uintptr_t) node) & (0x1)) == 0); /* a pointer without marker */
+    node->left = node->right_red = NULL;
+    rbt_set_red(node);
+}
+
+#define rbt_rotate_left(x_node, r_node)                  \
+    do {                                                 \
+        (r_node) = rbt_get_right((x_node));              \
+        rbt_set_right((x_node), rbt_get_left((r_node))); \
+        rbt_set_left((r_node), (x_node));                \
+    } while (0)
+
+#define rbt_rotate_right(x_node, r_node)                 \
+    do {                                                 \
+        (r_node) = rbt_get_left((x_node));               \
+        rbt_set_left((x_node), rbt_get_right((r_node))); \
+        rbt_set_right((r_node), (x_node));               \
+    } while (0)
+
+/*
+ * Link the node recorded at @pathp, which was reached by a descent from the
+ * root recorded in @path, and restore the balance on the way back up.
+ */
+static inline void rbt_insert_fixup(rbt_link_t **root,
+                                    rbt_path_entry_t *path,
+                                    rbt_path_entry_t *pathp)
+{
+    /* Go from target node back to root node and fix color accordingly */
+    for (pathp--; (uintptr_t) pathp >= (uintptr_t) path; pathp--) {
+        rbt_link_t *cnode = pathp->node;
+        if (pathp->cmp < 0) {
+            rbt_link_t *left = pathp[1].node;
+            rbt_set_left(cnode, left);
+            if (rbt_get_color(left) == RBT_BLACK)
+                return;
+            rbt_link_t *leftleft = rbt_get_left(left);
+            if (leftleft && (rbt_get_color(leftleft) == RBT_RED)) {
+                /* fix up 4-node */
+                rbt_link_t *tnode;
+                rbt_set_black(leftleft);
+                rbt_rotate_right(cnode, tnode);
+                cnode = tnode;
+            }
+        } else {
+            rbt_link_t *right = pathp[1].node;
+            rbt_set_right(cnode, right);
+            if (rbt_get_color(right) == RBT_BLACK)
+                return;
+            rbt_link_t *left = rbt_get_left(cnode);
+            if (left && (rbt_get_color(left) == RBT_RED)) {
+                /* split 4-node */
+                rbt_set_black(left);
+                rbt_set_black(right);
+                rbt_set_red(cnode);
+            } else {
+                /* lean left */
+                rbt_link_t *tnode;
+                rbt_color_t tcolor = rbt_get_color(cnode);
+                rbt_rotate_left(cnode, tnode);
+                rbt_set_color(tnode, tcolor);
+                rbt_set_red(cnode);
+                cnode = tnode;
+            }
+        }
+        pathp->node = cnode;
+    }
+
+    /* set root, and make it black */
+    *root = path->node;
+    rbt_set_black(*root);
+}
+
+/*
+ * Unlink the node recorded at @nodep. The descent recorded in @path must
+ * continue down to the successor of the node, and @pathp must point past
+ * the last entry of it, just like in rb_remove() of map.c.
+ */
+static inline void rbt_remove_fixup(rbt_link_t **root,
+                                    rbt_path_entry_t *path,
+                                    rbt_path_entry_t *pathp,
+                                    rbt_path_entry_t *nodep)
+{
+    rbt_link_t *node = nodep->node;
+
+    pathp--;
+    if (pathp->node != node) {
+        /* swap node with its successor */
+        rbt_color_t tcolor = rbt_get_color(pathp->node);
+        rbt_set_color(pathp->node, rbt_get_color(node));
+        rbt_set_left(pathp->node, rbt_get_left(node));
+
+        /* If the node's successor is its right child, the following code may
+         * behave incorrectly for the right child pointer.
+         * However, it is not a problem as the pointer will be correctly set
+         * when the successor is pruned.
+         */
+        rbt_set_right(pathp->node, rbt_get_right(node));
+        rbt_set_color(node, tcolor);
+
+        /* The child pointers of the pruned leaf node are never accessed again,
+         * so there is no need to set them to NULL.
+         */
+        nodep->node = pathp->node;
+        pathp->node = node;
+        if (nodep == path) {
+            *root = nodep->node;
+        } else {
+            if (nodep[-1].cmp < 0)
+                rbt_set_left(nodep[-1].node, nodep->node);
+            else
+                rbt_set_right(nodep[-1].node, nodep->node);
+        }
+    } else {
+        rbt_link_t *left = rbt_get_left(node);
+        if (left) {
+            /* node has no successor, but it has a left child.
+             * Splice node out, without losing the left child.
+             */
+            assert(rbt_get_color(node) == RBT_BLACK);
+            assert(rbt_get_color(left) == RBT_RED);
+            rbt_set_black(left);
+            if (pathp == path) {
+                /* the subtree rooted at the node's left child has not
+                 * changed, and it is now the root.
+                 */
+                *root = left;
+            } else {
+                if (pathp[-1].cmp < 0)
+                    rbt_set_left(pathp[-1].node, left);
+                else
+                    rbt_set_right(pathp[-1].node, left);
+            }
+            return;
+        } else if (pathp == path) {
+            /* the tree only contained one node */
+            *root = NULL;
+            return;
+        }
+    }
+
+    /* The invariant has been established that the node has no right child
+     * (morally speaking; the right child was not explicitly nulled out if
+     * swapped with its successor). Furthermore, the only nodes with
+     * out-of-date summaries exist in path[0], path[1], ..., pathp[-1].
+     */
+    if (rbt_get_color(pathp->node) == RBT_RED) {
+        /* prune red node, which requires no fixup */
+        assert(pathp[-1].cmp < 0);
+        rbt_set_left(pathp[-1].node, NULL);
+        return;
+    }
+
+    /* The node to be pruned is black, so unwind until balance is restored. */
+    pathp->node = NULL;
+    for (pathp--; (uintptr_t) pathp >= (uintptr_t) path; pathp--) {
+        assert(pathp->cmp != 0);
+        if (pathp->cmp < 0) {
+            rbt_set_left(pathp->node, pathp[1].node);
+            if (rbt_get_color(pathp->node) == RBT_RED) {
+                rbt_link_t *right = rbt_get_right(pathp->node);
+                rbt_link_t *rightleft = rbt_get_left(right);
+                rbt_link_t *tnode;
+                if (rightleft && (rbt_get_color(rightleft) == RBT_RED)) {
+                    /* In the following diagrams, ||, //, and \ \
+                     * indicate the path to the removed node.
+                     *
+                     *      ||
+                     *    pathp(r)
+                     *  // \
+                     * (b)        (b)
+                     *           /
+                     *          (r)
+                     */
+                    rbt_set_black(pathp->node);
+                    rbt_rotate_right(right, tnode);
+                    rbt_set_right(pathp->node, tnode);
+                    rbt_rotate_left(pathp->node, tnode);
+                } else {
+                    /*      ||
+                     *    pathp(r)
+                     *  // \
+                     * (b)        (b)
+                     *           /
+                     *          (b)
+                     */
+                    rbt_rotate_left(pathp->node, tnode);
+                }
+
+                /* Balance restored, but rotation modified subtree root. */
+                assert((uintptr_t) pathp > (uintptr_t) path);
+                if (pathp[-1].cmp < 0)
+                    rbt_set_left(pathp[-1].node, tnode);
+                else
+                    rbt_set_right(pathp[-1].node, tnode);
+                return;
+            } else {
+                rbt_link_t *right = rbt_get_right(pathp->node);
+                rbt_link_t *rightleft = rbt_get_left(right);
+                if (rightleft && (rbt_get_color(rightleft) == RBT_RED)) {
+                    /*      ||
+                     *    pathp(b)
+                     *  // \
+                     * (b)        (b)
+                     *           /
+                     *          (r)
+                     */
+                    rbt_link_t *tnode;
+                    rbt_set_black(rightleft);
+                    rbt_rotate_right(right, tnode);
+                    rbt_set_right(pathp->node, tnode);
+                    rbt_rotate_left(pathp->node, tnode);
+                    /* Balance restored, but rotation modified subtree root,
+                     * which may actually be the tree root.
+                     */
+                    if (pathp == path) {
+                        /* set root */
+                        *root = tnode;
+                    } else {
+                        if (pathp[-1].cmp < 0)
+                            rbt_set_left(pathp[-1].node, tnode);
+                        else
+                            rbt_set_right(pathp[-1].node, tnode);
+                    }
+                    return;
+                } else {
+                    /*      ||
+                     *    pathp(b)
+                     *  // \
+                     * (b)        (b)
+                     *           /
+                     *          (b)
+                     */
+                    rbt_link_t *tnode;
+                    rbt_set_red(pathp->node);
+                    rbt_rotate_left(pathp->node, tnode);
+                    pathp->node = tnode;
+                }
+            }
+        } else {
+            rbt_set_right(pathp->node, pathp[1].node);
+            rbt_link_t *left = rbt_get_left(pathp->node);
+            if (rbt_get_color(left) == RBT_RED) {
+                rbt_link_t *tnode;
+                rbt_link_t *leftright = rbt_get_right(left);
+                rbt_link_t *leftrightleft = rbt_get_left(leftright);
+                if (leftrightleft &&
+                    (rbt_get_color(leftrightleft) == RBT_RED)) {
+                    /*      ||
+                     *    pathp(b)
+                     *   /        \ \
+                     * (r)        (b)
+                     * \
+                     *   (b)
+                     *   /
+                     * (r)
+                     */
+                    rbt_link_t *unode;
+                    rbt_set_black(leftrightleft);
+                    rbt_rotate_right(pathp->node, unode);
+                    rbt_rotate_right(pathp->node, tnode);
+                    rbt_set_right(unode, tnode);
+                    rbt_rotate_left(unode, tnode);
+                } else {
+                    /*      ||
+                     *    pathp(b)
+                     *   /        \ \
+                     * (r)        (b)
+                     * \
+                     *   (b)
+                     *   /
+                     * (b)
+                     */
+                    assert(leftright);
+                    rbt_set_red(leftright);
+                    rbt_rotate_right(pathp->node, tnode);
+                    rbt_set_black(tnode);
+                }
+
+                /* Balance restored, but rotation modified subtree root, which
+                 * may actually be the tree root.
+                 */
+                if (pathp == path) {
+                    /* set root */
+                    *root = tnode;
+                } else {
+                    if (pathp[-1].cmp < 0)
+                        rbt_set_left(pathp[-1].node, tnode);
+                    else
+                        rbt_set_right(pathp[-1].node, tnode);
+                }
+                return;
+            } else if (rbt_get_color(pathp->node) == RBT_RED) {
+                rbt_link_t *leftleft = rbt_get_left(left);
+                if (leftleft && (rbt_get_color(leftleft) == RBT_RED)) {
+                    /*        ||
+                     *      pathp(r)
+                     *     /        \ \
+                     *   (b)        (b)
+                     *   /
+                     * (r)
+                     */
+                    rbt_link_t *tnode;
+                    rbt_set_black(pathp->node);
+                    rbt_set_red(left);
+                    rbt_set_black(leftleft);
+                    rbt_rotate_right(pathp->node, tnode);
+                    /* Balance restored, but rotation modified subtree root. */
+                    assert((uintptr_t) pathp > (uintptr_t) path);
+                    if (pathp[-1].cmp < 0)
+                        rbt_set_left(pathp[-1].node, tnode);
+                    else
+                        rbt_set_right(pathp[-1].node, tnode);
+                    return;
+                } else {
+                    /*        ||
+                     *      pathp(r)
+                     *     /        \ \
+                     *   (b)        (b)
+                     *   /
+                     * (b)
+                     */
+                    rbt_set_red(left);
+                    rbt_set_black(pathp->node);
+                    /* balance restored */
+                    return;
+                }
+            } else {
+                rbt_link_t *leftleft = rbt_get_left(left);
+                if (leftleft && (rbt_get_color(leftleft) == RBT_RED)) {
+                    /*               ||
+                     *             pathp(b)
+                     *            /        \ \
+                     *          (b)        (b)
+                     *          /
+                     *        (r)
+                     */
+                    rbt_link_t *tnode;
+                    rbt_set_black(leftleft);
+                    rbt_rotate_right(pathp->node, tnode);
+                    /* Balance restored, but rotation modified subtree root,
+                     * which may actually be the tree root.
+                     */
+                    if (pathp == path) {
+                        /* set root */
+                        *root = tnode;
+                    } else {
+                        if (pathp[-1].cmp < 0)
+                            rbt_set_left(pathp[-1].node, tnode);
+                        else
+                            rbt_set_right(pathp[-1].node, tnode);
+                    }
+                    return;
+                } else {
+                    /*               ||
+                     *             pathp(b)
+                     *            /        \ \
+                     *          (b)        (b)
+                     *          /
+                     *        (b)
+                     */
+                    rbt_set_red(left);
+                }
+            }
+        }
+    }
+
+    /* set root */
+    *root = path->node;
+    assert(rbt_get_color(*root) == RBT_BLACK);
+}
+
+/*
+ * Generate a map named @name, which maps @key_type to @val_type and orders
+ * the keys by @key_cmp. All the functions are static, so a map can be
+ * generated in every translation unit that needs it.
+ */
+#define MAP_DEFINE(name, key_type, val_type, key_cmp)                       \
+    typedef struct name##_node {                                            \
+        rbt_link_t link; /* must come first */                              \
+        key_type key;                                                       \
+        val_type value;                                                     \
+    } name##_node_t;                                                        \
+                                                                            \
+    typedef struct {                                                        \
+        rbt_link_t *root;                                                   \
+        slab_t slab;                                                        \
+    } name##_t;                                                             \
+                                                                            \
+    static inline key_type *name##_key(rbt_link_t *node)                    \
+    {                                                                       \
+        return &((name##_node_t *) node)->key;                              \
+    }                                                                       \
+                                                                            \
+    /* Constructor */                                                       \
+    static inline name##_t *name##_new(void)                                \
+    {                                                                       \
+        name##_t *map = malloc(sizeof(name##_t));                           \
+        assert(map);                                                        \
+        map->root = NULL;                                                   \
+        slab_init(&map->slab, sizeof(name##_node_t));                       \
+        return map;                                                         \
+    }                                                                       \
+                                                                            \
+    /* Add function. Return false if the key is already in the map. */      \
+    static inline bool name##_insert(name##_t *map,                         \
+                                     key_type key,                          \
+                                     val_type value)                        \
+    {                                                                       \
+        rbt_path_entry_t path[RBT_MAX_DEPTH];                               \
+        rbt_path_entry_t *pathp;                                            \
+                                                                            \
+        path->node = map->root;                                             \
+        for (pathp = path; pathp->node; pathp++) {                          \
+            int c = pathp->cmp = key_cmp(key, *name##_key(pathp->node));    \
+            if (c == 0)                                                     \
+                return false;                                               \
+            pathp[1].node = (c < 0) ? rbt_get_left(pathp->node)             \
+                                    : rbt_get_right(pathp->node);           \
+        }                                                                   \
+                                                                            \
+        name##_node_t *node = slab_alloc(&map->slab);                       \
+        node->key = key;                                                    \
+        node->value = value;                                                \
+        rbt_link_init(&node->link);                                         \
+        pathp->node = &node->link;                                          \
+        rbt_insert_fixup(&map->root, path, pathp);                          \
+        return true;                                                        \
+    }                                                                       \
+                                                                            \
+    /* Get functions. Return the value of @key, or NULL if it is absent. */ \
+    static inline val_type *name##_find(name##_t *map, key_type key)        \
+    {                                                                       \
+        rbt_link_t *node = map->root;                                       \
+        while (node) {                                                      \
+            int c = key_cmp(key, *name##_key(node));                        \
+            if (c == 0)                                                     \
+                return &((name##_node_t *) node)->value;                    \
+            node = (c < 0) ? rbt_get_left(node) : rbt_get_right(node);      \
+        }                                                                   \
+        return NULL;                                                        \
+    }                                                                       \
+                                                                            \
+    static inline bool name##_empty(name##_t *map)                          \
+    {                                                                       \
+        return !map->root;                                                  \
+    }                                                                       \
+                                                                            \
+    /* Remove functions. Return false if the key is not in the map. */      \
+    static inline bool name##_erase(name##_t *map, key_type key)            \
+    {                                                                       \
+        rbt_path_entry_t path[RBT_MAX_DEPTH];                               \
+        rbt_path_entry_t *pathp, *nodep = NULL;                             \
+                                                                            \
+        path->node = map->root;                                             \
+        for (pathp = path; pathp->node; pathp++) {                          \
+            int c = key_cmp(key, *name##_key(pathp->node));                 \
+            if (c < 0) {                                                    \
+                pathp->cmp = -1;                                            \
+                pathp[1].node = rbt_get_left(pathp->node);                  \
+                continue;                                                   \
+            }                                                               \
+                                                                            \
+            pathp->cmp = 1;                                                 \
+            pathp[1].node = rbt_get_right(pathp->node);                     \
+            if (c == 0) {                                                   \
+                /* find node's successor, in preparation for swap */        \
+                nodep = pathp;                                              \
+                for (pathp++; pathp->node; pathp++) {                       \
+                    pathp->cmp = -1;                                        \
+                    pathp[1].node = rbt_get_left(pathp->node);              \
+                }                                                           \
+                break;                                                      \
+            }                                                               \
+        }                                                                   \
+        if (!nodep)                                                         \
+            return false;                                                   \
+                                                                            \
+        rbt_link_t *node = nodep->node;                                     \
+        rbt_remove_fixup(&map->root, path, pathp, nodep);                   \
+        slab_free(&map->slab, node);                                        \
+        return true;                                                        \
+    }                                                                       \
+                                                                            \
+    static inline void name##_clear(name##_t *map)                          \
+    {                                                                       \
+        slab_reset(&map->slab);                                             \
+        map->root = NULL;                                                   \
+    }                                                                       \
+                                                                            \
+    /* Destructor */                                                        \
+    static inline void name##_delete(name##_t *map)                         \
+    {                                                                       \
+        slab_destroy(&map->slab);                                           \
+        free(map);                                                          \
+    }
@@ -19,6 +19,7 @@
 #include <string.h>
 
 #include "map.h"
+#include "slab.h"
 
 #if defined(__GNUC__) || defined(__clang__)
 #define __UNREACHABLE __builtin_unreachable()
@@ -28,15 +29,18 @@
 /* clang-format on */
 #endif
 
-/* TODO: Avoid relying on key_size and data_size */
-struct map_internal {
-    map_node_t *root;
-
-    /* properties */
-    size_t key_size, data_size;
+#if defined(__GNUC__) || defined(__clang__)
+#define __PREFETCH(x) __builtin_prefetch(x)
+#else /* unspported compilers */
+#define __PREFETCH(x) ((void) (x))
+#endif
 
-    map_cmp_t (*comparator)(const void *, const void *);
-};
+/* Vector compares for the frozen snapshots, see map_freeze() */
+#if (defined(__GNUC__) || defined(__clang__)) && \
+    (defined(__SSE2__) || defined(__AVX2__))
+#include <immintrin.h>
+#define FZ_SIMD 1
+#endif
 
 /* Each node in the red-black tree consumes at least 1 byte of space (for the
  * linkage if nothing else), so there are a maximum of sizeof(void *) << 3
@@ -45,10 +49,66 @@ struct map_internal {
  * a tree to twice the binary logarithm (base 2) of the number of elements in
  * the tree; the following bound applies.
  */
-#define RB_MAX_DEPTH (sizeof(void *) << 4)
+#define RB_MAX_DEPTH MAP_MAX_DEPTH
+
+/* Marks an iterator whose path has not been recorded yet */
+#define RB_PATH_UNKNOWN ((size_t) -1)
+
+typedef struct {
+    map_node_t *node;
+    map_cmp_t cmp;
+} rb_path_entry_t;
+
+/* TODO: Avoid relying on key_size and data_size */
+struct map_internal {
+    map_node_t *root;
+
+    /* properties */
+    size_t key_size, data_size, size;
+
+    /* nodes, along with their keys and data, are carved from the slab, which
+     * the maps split from one another share
+     */
+    slab_t *slab;
+
+    map_cmp_t (*comparator)(const void *, const void *);
+
+    /* The greatest element, NULL if the map is empty or if it is not known
+     * since a removal or a bulk-load. Keys past it are appended along @tail,
+     * the path from the root to it, without descending from the root.
+     * @tail_count is RB_PATH_UNKNOWN when an update may have reshaped it.
+     */
+    map_node_t *max;
+    size_t tail_count;
+    rb_path_entry_t tail[RB_MAX_DEPTH];
+
+    /* Lookup cache of map_find(), NULL if it is off. Each slot holds a node
+     * whose key hashes to it, or NULL.
+     */
+    map_node_t **cache;
+    size_t cache_mask;
+    size_t cache_hits, cache_misses;
+
+    /* Deferred removal: the percentage of dead nodes that triggers a purge,
+     * 0 when the elements are removed right away, and the dead nodes still in
+     * the tree, which @size leaves out.
+     */
+    unsigned lazy;
+    size_t dead;
+};
 
 typedef enum { RB_BLACK = 0, RB_RED } map_color_t;
 
+/* The key and the data are laid out right after the node. Both are rounded
+ * up to this alignment so that the data following the key is aligned.
+ */
+#define MAP_ALIGN sizeof(uint64_t)
+
+static inline size_t map_align(size_t size)
+{
+    return (size + MAP_ALIGN - 1) & ~(MAP_ALIGN - 1);
+}
+
 /* Left accessors */
 static inline map_node_t *rb_node_get_left(const map_node_t *node)
 {
@@ -69,7 +129,7 @@ static inline map_node_t *rb_node_get_right(const map_node_t *node)
 static inline void rb_node_set_right(map_node_t *node, map_node_t *right)
 {
     node->right_red = (map_node_t *) (((uintptr_t) right) |
-                                      (((uintptr_t) node->right_red) & 1));
+                                      (((uintptr_t) node->right_red) & 3));
 }
 
 /* Color accessors */
@@ -81,7 +141,7 @@ static inline map_color_t rb_node_get_color(const map_node_t *node)
 static inline void rb_node_set_color(map_node_t *node, map_color_t color)
 {
     node->right_red =
-        (map_node_t *) (((uintptr_t) node->right_red & ~3) | color);
+        (map_node_t *) (((uintptr_t) node->right_red & ~1) | color);
 }
 
 static inline void rb_node_set_red(map_node_t *node)
@@ -91,7 +151,62 @@ static inline void rb_node_set_red(map_node_t *node)
 
 static inline void rb_node_set_black(map_node_t *node)
 {
-    node->right_red = (map_node_t *) (((uintptr_t) node->right_red) & ~3);
+    node->right_red = (map_node_t *) (((uintptr_t) node->right_red) & ~1);
+}
+
+/* Dead mark accessors, the second bit of @right_red. A dead node stays in the
+ * tree as a plain node until it is purged, but holds no element.
+ */
+static inline bool rb_node_is_dead(const map_node_t *node)
+{
+    return ((uintptr_t) node->right_red) & 2;
+}
+
+static inline void rb_node_set_dead(map_node_t *node, bool dead)
+{
+    node->right_red = (map_node_t *) (((uintptr_t) node->right_red & ~2) |
+                                      ((uintptr_t) dead << 1));
+}
+
+/* Summaries of the subtrees kept in the nodes: the number of elements with
+ * MAP_ORDER_STATS, and the greatest end of the ranges of the keys with
+ * MAP_INTERVALS. Without either, there is nothing to maintain.
+ */
+#ifdef MAP_ORDER_STATS
+static inline size_t rb_node_get_size(const map_node_t *node)
+{
+    return node ? node->size : 0;
+}
+#endif
+
+#ifdef MAP_INTERVALS
+static inline uint64_t rb_node_get_end(const map_node_t *node)
+{
+    return ((const map_interval_t *) node->key)->end;
+}
+
+static inline uint64_t rb_node_get_max_end(const map_node_t *node)
+{
+    return node ? node->max_end : 0;
+}
+#endif
+
+/* Recompute the summary of @node from those of its children */
+static inline void rb_node_update(map_node_t *node)
+{
+#ifdef MAP_ORDER_STATS
+    node->size = 1 + rb_node_get_size(rb_node_get_left(node)) +
+                 rb_node_get_size(rb_node_get_right(node));
+#endif
+#ifdef MAP_INTERVALS
+    uint64_t end = rb_node_get_end(node);
+    uint64_t left = rb_node_get_max_end(rb_node_get_left(node));
+    uint64_t right = rb_node_get_max_end(rb_node_get_right(node));
+    if (left > end)
+        end = left;
+    node->max_end = right > end ? right : end;
+#endif
+    (void) node;
 }
 
 /* Node initializer */
@@ -99,16 +214,21 @@ static inline void rb_node_init(map_node_t *node)
 {
     assert((((uintptr_t) node) & (0x1)) == 0); /* a pointer without marker */
     rb_node_set_left(node, NULL);
-    rb_node_set_right(node, NULL);
+    node->right_red = NULL; /* no mark left over from the slab either */
     rb_node_set_red(node);
+    rb_node_update(node);
 }
 
-/* Internal helper macros */
+/* Internal helper macros. A rotation only changes the subtrees of the two
+ * nodes it swaps, the lower one first.
+ */
 #define rb_node_rotate_left(x_node, r_node)                      \
     do {                                                         \
         (r_node) = rb_node_get_right((x_node));                  \
         rb_node_set_right((x_node), rb_node_get_left((r_node))); \
         rb_node_set_left((r_node), (x_node));                    \
+        rb_node_update((x_node));                                \
+        rb_node_update((r_node));                                \
     } while (0)
 
 #define rb_node_rotate_right(x_node, r_node)                     \
@@ -116,12 +236,49 @@ static inline void rb_node_init(map_node_t *node)
         (r_node) = rb_node_get_left((x_node));                   \
         rb_node_set_left((x_node), rb_node_get_right((r_node))); \
         rb_node_set_right((r_node), (x_node));                   \
+        rb_node_update((x_node));                                \
+        rb_node_update((r_node));                                \
     } while (0)
 
-typedef struct {
-    map_node_t *node;
-    map_cmp_t cmp;
-} rb_path_entry_t;
+/* Account for the element of @node, as it is linked, in the summaries of
+ * its ancestors, the nodes from @path up to @end, excluded. The rotations of
+ * the fixup then keep the summaries right on their own.
+ */
+static inline void rb_path_link(rb_path_entry_t *path,
+                                rb_path_entry_t *end,
+                                const map_node_t *node)
+{
+#ifndef MAP_INTERVALS
+    (void) node;
+#endif
+#if defined(MAP_ORDER_STATS) || defined(MAP_INTERVALS)
+    for (; path < end; path++) {
+#ifdef MAP_ORDER_STATS
+        path->node->size++;
+#endif
+#ifdef MAP_INTERVALS
+        if (path->node->max_end < node->max_end)
+            path->node->max_end = node->max_end;
+#endif
+    }
+#else
+    (void) path, (void) end;
+#endif
+}
+
+/* Recompute the summaries of the nodes from @end, excluded, up to @path, once
+ * the subtrees below them are final: the ancestors of an unlinked element,
+ * above the point where rebalancing stopped.
+ */
+static inline void rb_path_update(rb_path_entry_t *path, rb_path_entry_t *end)
+{
+#if defined(MAP_ORDER_STATS) || defined(MAP_INTERVALS)
+    while (end-- > path)
+        rb_node_update(end->node);
+#else
+    (void) path, (void) end;
+#endif
+}
 
 static inline map_node_t *rb_search(map_t rb, const map_node_t *node)
 {
@@ -145,17 +302,24 @@ static inline map_node_t *rb_search(map_t rb, const map_node_t *node)
     return ret;
 }
 
-static void rb_insert(map_t rb, map_node_t *node)
+/* rb_search(), to which a dead node is no match */
+static inline map_node_t *rb_search_live(map_t rb, const map_node_t *node)
 {
-    rb_path_entry_t path[RB_MAX_DEPTH];
-    rb_path_entry_t *pathp;
-    rb_node_init(node);
+    map_node_t *ret = rb_search(rb, node);
+    return (ret && !rb_node_is_dead(ret)) ? ret : NULL;
+}
 
-    /* Traverse through red-black tree node and find the search target node. */
-    path->node = rb->root;
-    for (pathp = path; pathp->node; pathp++) {
-        map_cmp_t cmp = pathp->cmp =
-            (rb->comparator)(node->key, pathp->node->key);
+/* Descend from the node of @pathp towards @key, recording the path from
+ * there on. Return the node holding @key if any, with @*pathpp at its entry.
+ * Otherwise, @*pathpp is left at the null link where @key belongs.
+ */
+static map_node_t *rb_insert_descend(map_t rb,
+                                     const void *key,
+                                     rb_path_entry_t *pathp,
+                                     rb_path_entry_t **pathpp)
+{
+    for (; pathp->node; pathp++) {
+        map_cmp_t cmp = pathp->cmp = (rb->comparator)(key, pathp->node->key);
         switch (cmp) {
         case _CMP_LESS:
             pathp[1].node = rb_node_get_left(pathp->node);
@@ -163,17 +327,39 @@ static void rb_insert(map_t rb, map_node_t *node)
         case _CMP_GREATER:
             pathp[1].node = rb_node_get_right(pathp->node);
             break;
+        case _CMP_EQUAL:
+            *pathpp = pathp;
+            return pathp->node;
         default:
-            /* igore duplicate key */
             __UNREACHABLE;
             break;
         }
     }
-    pathp->node = node;
+    *pathpp = pathp;
+    return NULL;
+}
 
-    assert(!rb_node_get_left(node));
-    assert(!rb_node_get_right(node));
+/* Traverse through red-black tree node and find the search target node,
+ * recording the path in @path from the root.
+ */
+static map_node_t *rb_insert_search(map_t rb,
+                                    const void *key,
+                                    rb_path_entry_t *path,
+                                    rb_path_entry_t **pathpp)
+{
+    path->node = rb->root;
+    return rb_insert_descend(rb, key, path, pathpp);
+}
 
+/* Fix the colors up from the red node of @pathp, whose subtrees are of the
+ * same black height, relinking the subtrees along @path on the way. Return
+ * the highest entry the fixup reached: the nodes above it are left alone,
+ * and so is its own node unless it is @path, holding the new root, which
+ * may be red.
+ */
+static rb_path_entry_t *rb_relink(rb_path_entry_t *path,
+                                  rb_path_entry_t *pathp)
+{
     /* Go from target node back to root node and fix color accordingly */
     for (pathp--; (uintptr_t) pathp >= (uintptr_t) path; pathp--) {
         map_node_t *cnode = pathp->node;
@@ -181,7 +367,7 @@ static void rb_insert(map_t rb, map_node_t *node)
             map_node_t *left = pathp[1].node;
             rb_node_set_left(cnode, left);
             if (rb_node_get_color(left) == RB_BLACK)
-                return;
+                return pathp;
             map_node_t *leftleft = rb_node_get_left(left);
             if (leftleft && (rb_node_get_color(leftleft) == RB_RED)) {
                 /* fix up 4-node */
@@ -194,7 +380,7 @@ static void rb_insert(map_t rb, map_node_t *node)
             map_node_t *right = pathp[1].node;
             rb_node_set_right(cnode, right);
             if (rb_node_get_color(right) == RB_BLACK)
-                return;
+                return pathp;
             map_node_t *left = rb_node_get_left(cnode);
             if (left && (rb_node_get_color(left) == RB_RED)) {
                 /* split 4-node */
@@ -213,13 +399,40 @@ static void rb_insert(map_t rb, map_node_t *node)
         }
         pathp->node = cnode;
     }
+    return path;
+}
 
-    /* set root, and make it black */
-    rb->root = path->node;
-    rb_node_set_black(rb->root);
+/* Link @node at the null link @pathp found by rb_insert_search(). Return the
+ * highest entry the fixup reached, as rb_relink() does.
+ */
+static rb_path_entry_t *rb_insert_fixup(map_t rb,
+                                        rb_path_entry_t *path,
+                                        rb_path_entry_t *pathp,
+                                        map_node_t *node)
+{
+    rb_node_init(node);
+    pathp->node = node;
+    rb_path_link(path, pathp, node);
+
+    assert(!rb_node_get_left(node));
+    assert(!rb_node_get_right(node));
+
+    rb_path_entry_t *top = rb_relink(path, pathp);
+    if (top == path) {
+        /* set root, and make it black */
+        rb->root = path->node;
+        rb_node_set_black(rb->root);
+    }
+    return top;
 }
 
-static void rb_remove(map_t rb, map_node_t *node)
+/* Unlink the node holding @key, and return it. The path to the node and to
+ * its successor is recorded by a single descent, which drives the
+ * rebalancing. The summaries of the nodes of the path are recomputed on the
+ * way back up, each level before its rotations, which rely on them. Return
+ * NULL if @key is not in the tree.
+ */
+static map_node_t *rb_remove(map_t rb, const void *key)
 {
     rb_path_entry_t path[RB_MAX_DEPTH];
     rb_path_entry_t *pathp = NULL, *nodep = NULL;
@@ -229,7 +442,7 @@ static void rb_remove(map_t rb, map_node_t *node)
     pathp = path;
     while (pathp->node) {
         map_cmp_t cmp = pathp->cmp =
-            (rb->comparator)(node->data, pathp->node->data);
+            (rb->comparator)(key, pathp->node->key);
         if (cmp == _CMP_LESS) {
             pathp[1].node = rb_node_get_left(pathp->node);
         } else {
@@ -247,7 +460,9 @@ static void rb_remove(map_t rb, map_node_t *node)
         }
         pathp++;
     }
-    assert(nodep && nodep->node == node);
+    if (!nodep)
+        return NULL;
+    map_node_t *node = nodep->node;
 
     pathp--;
     if (pathp->node != node) {
@@ -297,11 +512,12 @@ static void rb_remove(map_t rb, map_node_t *node)
                 else
                     rb_node_set_right(pathp[-1].node, left);
             }
-            return;
+            rb_path_update(path, pathp);
+            return node;
         } else if (pathp == path) {
             /* the tree only contained one node */
             rb->root = NULL;
-            return;
+            return node;
         }
     }
 
@@ -314,7 +530,8 @@ static void rb_remove(map_t rb, map_node_t *node)
         /* prune red node, which requires no fixup */
         assert(pathp[-1].cmp == _CMP_LESS);
         rb_node_set_left(pathp[-1].node, NULL);
-        return;
+        rb_path_update(path, pathp);
+        return node;
     }
 
     /* The node to be pruned is black, so unwind until balance is restored. */
@@ -323,6 +540,7 @@ static void rb_remove(map_t rb, map_node_t *node)
         assert(pathp->cmp != _CMP_EQUAL);
         if (pathp->cmp == _CMP_LESS) {
             rb_node_set_left(pathp->node, pathp[1].node);
+            rb_node_update(pathp->node);
             if (rb_node_get_color(pathp->node) == RB_RED) {
                 map_node_t *right = rb_node_get_right(pathp->node);
                 map_node_t *rightleft = rb_node_get_left(right);
@@ -359,7 +577,8 @@ static void rb_remove(map_t rb, map_node_t *node)
                     rb_node_set_left(pathp[-1].node, tnode);
                 else
                     rb_node_set_right(pathp[-1].node, tnode);
-                return;
+                rb_path_update(path, pathp);
+                return node;
             } else {
                 map_node_t *right = rb_node_get_right(pathp->node);
                 map_node_t *rightleft = rb_node_get_left(right);
@@ -388,7 +607,8 @@ static void rb_remove(map_t rb, map_node_t *node)
                         else
                             rb_node_set_right(pathp[-1].node, tnode);
                     }
-                    return;
+                    rb_path_update(path, pathp);
+                    return node;
                 } else {
                     /*      ||
                      *    pathp(b)
@@ -405,6 +625,7 @@ static void rb_remove(map_t rb, map_node_t *node)
             }
         } else {
             rb_node_set_right(pathp->node, pathp[1].node);
+            rb_node_update(pathp->node);
             map_node_t *left = rb_node_get_left(pathp->node);
             if (rb_node_get_color(left) == RB_RED) {
                 map_node_t *tnode;
@@ -455,7 +676,8 @@ static void rb_remove(map_t rb, map_node_t *node)
                     else
                         rb_node_set_right(pathp[-1].node, tnode);
                 }
-                return;
+                rb_path_update(path, pathp);
+                return node;
             } else if (rb_node_get_color(pathp->node) == RB_RED) {
                 map_node_t *leftleft = rb_node_get_left(left);
                 if (leftleft && (rb_node_get_color(leftleft) == RB_RED)) {
@@ -477,7 +699,8 @@ static void rb_remove(map_t rb, map_node_t *node)
                         rb_node_set_left(pathp[-1].node, tnode);
                     else
                         rb_node_set_right(pathp[-1].node, tnode);
-                    return;
+                    rb_path_update(path, pathp);
+                    return node;
                 } else {
                     /*        ||
                      *      pathp(r)
@@ -489,7 +712,8 @@ static void rb_remove(map_t rb, map_node_t *node)
                     rb_node_set_red(left);
                     rb_node_set_black(pathp->node);
                     /* balance restored */
-                    return;
+                    rb_path_update(path, pathp);
+                    return node;
                 }
             } else {
                 map_node_t *leftleft = rb_node_get_left(left);
@@ -516,7 +740,8 @@ static void rb_remove(map_t rb, map_node_t *node)
                         else
                             rb_node_set_right(pathp[-1].node, tnode);
                     }
-                    return;
+                    rb_path_update(path, pathp);
+                    return node;
                 } else {
                     /*               ||
                      *             pathp(b)
@@ -534,34 +759,17 @@ static void rb_remove(map_t rb, map_node_t *node)
     /* set root */
     rb->root = path->node;
     assert(rb_node_get_color(rb->root) == RB_BLACK);
+    return node;
 }
 
-static void rb_destroy_recurse(map_t rb, map_node_t *node)
-{
-    if (!node)
-        return;
-
-    rb_destroy_recurse(rb, rb_node_get_left(node));
-    rb_node_set_left((node), NULL);
-    rb_destroy_recurse(rb, rb_node_get_right(node));
-    rb_node_set_right((node), NULL);
-    free(node->key);
-    free(node->data);
-    free(node);
-}
-
-static map_node_t *map_create_node(void *key,
-                                   void *value,
-                                   size_t ksize,
-                                   size_t vsize)
+static map_node_t *map_create_node(map_t obj, void *key, void *value)
 {
-    map_node_t *node = malloc(sizeof(map_node_t));
-    assert(node);
+    map_node_t *node = slab_alloc(obj->slab);
+    size_t ksize = obj->key_size, vsize = obj->data_size;
+    obj->size++;
 
-    /* allocate memory for the keys and data */
-    node->key = malloc(ksize), node->data = malloc(vsize);
-    assert(node->key);
-    assert(node->data);
+    node->key = node + 1;
+    node->data = (char *) node->key + map_align(ksize);
 
     /* copy over the key and values.
      * If the parameter passed in is NULL, make the element blank instead of
@@ -580,6 +788,215 @@ static map_node_t *map_create_node(void *key,
     return node;
 }
 
+/* State of a bulk-load: the sorted elements and the next one to be placed */
+typedef struct {
+    map_t obj;
+    char *keys, *vals;
+    map_node_t **nodes; /* the nodes to reuse in order, if not NULL */
+    size_t next;
+} rb_build_t;
+
+/* The largest subtree of the given black height only consists of 3-nodes,
+ * and thus holds 3^height - 1 elements. Saturate instead of overflowing.
+ */
+static size_t rb_build_max_size(unsigned height)
+{
+    size_t size = 1;
+    while (height--) {
+        if (size > SIZE_MAX / 3)
+            return SIZE_MAX;
+        size *= 3;
+    }
+    return size - 1;
+}
+
+/* Create the node of the next element in order */
+static map_node_t *rb_build_node(rb_build_t *b, map_color_t color)
+{
+    if (b->nodes) {
+        map_node_t *node = b->nodes[b->next++];
+        rb_node_init(node);
+        rb_node_set_color(node, color);
+        return node;
+    }
+
+    map_t obj = b->obj;
+    void *key = b->keys + b->next * obj->key_size;
+    void *val = b->vals ? b->vals + b->next * obj->data_size : NULL;
+
+    assert(!b->next ||
+           (obj->comparator)((char *) key - obj->key_size, key) == _CMP_LESS);
+    b->next++;
+
+    map_node_t *node = map_create_node(obj, key, val);
+    rb_node_init(node);
+    rb_node_set_color(node, color);
+    return node;
+}
+
+/* Build a subtree of @n elements whose black height is @height, creating
+ * the nodes in order. Every black node is either a 2-node, or a 3-node made
+ * of a red left child, as the left-leaning tree requires. A subtree of black
+ * height h holds between 2^h - 1 and 3^h - 1 elements, so the elements are
+ * spread evenly among the children of the root, and the root becomes a
+ * 3-node only when two children cannot hold them all.
+ */
+static map_node_t *rb_build(rb_build_t *b, size_t n, unsigned height)
+{
+    if (!n)
+        return NULL;
+
+    assert(height);
+    if (n <= 2 * rb_build_max_size(height - 1) + 1) {
+        map_node_t *left = rb_build(b, (n - 1) / 2, height - 1);
+        map_node_t *node = rb_build_node(b, RB_BLACK);
+        rb_node_set_left(node, left);
+        rb_node_set_right(node, rb_build(b, n / 2, height - 1));
+        rb_node_update(node);
+        return node;
+    }
+
+    size_t n_left = (n - 2) / 3, n_mid = (n - 1) / 3;
+    map_node_t *left = rb_build(b, n_left, height - 1);
+    map_node_t *red = rb_build_node(b, RB_RED);
+    rb_node_set_left(red, left);
+    rb_node_set_right(red, rb_build(b, n_mid, height - 1));
+    rb_node_update(red);
+
+    map_node_t *node = rb_build_node(b, RB_BLACK);
+    rb_node_set_left(node, red);
+    rb_node_set_right(node, rb_build(b, n - 2 - n_left - n_mid, height - 1));
+    rb_node_update(node);
+    return node;
+}
+
+/* Record the ancestors of the node of @it below the first @it->count ones,
+ * from @node on, which map_find() and the insertions leave out.
+ */
+static void map_iter_record_path(map_t obj, map_iter_t *it, map_node_t *node)
+{
+    while (node != it->node) {
+        it->path[it->count++] = node;
+        if ((obj->comparator)(it->node->key, node->key) == _CMP_LESS)
+            node = rb_node_get_left(node);
+        else
+            node = rb_node_get_right(node);
+    }
+}
+
+/* Record the path to the greatest element from the entry @pathp on, whose
+ * node is in place already.
+ */
+static void rb_tail_record(map_t rb, rb_path_entry_t *pathp)
+{
+    if (!pathp->node) {
+        rb->max = NULL;
+        rb->tail_count = 0;
+        return;
+    }
+
+    for (;;) {
+        pathp->cmp = _CMP_GREATER;
+        map_node_t *right = rb_node_get_right(pathp->node);
+        if (!right)
+            break;
+        (++pathp)->node = right;
+    }
+    rb->max = pathp->node;
+    rb->tail_count = pathp - rb->tail + 1;
+}
+
+/* Tell whether @key goes past the greatest element */
+static bool rb_is_append(map_t rb, const void *key)
+{
+    if (!rb->max) {
+        if (!rb->root)
+            return true;
+        rb->tail->node = rb->root;
+        rb_tail_record(rb, rb->tail);
+    }
+    return (rb->comparator)(key, rb->max->key) == _CMP_GREATER;
+}
+
+/* Link a node of @key past the greatest element. The fixup climbs the tail,
+ * which only has to be recorded again below the highest entry it reached,
+ * so a run of appends takes amortized constant time.
+ */
+static map_node_t *rb_append(map_t rb, void *key, void *val)
+{
+    if (rb->tail_count == RB_PATH_UNKNOWN) {
+        rb->tail->node = rb->root;
+        rb_tail_record(rb, rb->tail);
+    }
+
+    map_node_t *node = map_create_node(rb, key, val);
+    rb_tail_record(rb, rb_insert_fixup(rb, rb->tail,
+                                       rb->tail + rb->tail_count, node));
+    return node;
+}
+
+/* Drop the tail if the fixup of an insertion along @path reached @top on it.
+ * The tail below a node off it lies in another subtree.
+ */
+static void rb_tail_check(map_t rb,
+                          rb_path_entry_t *path,
+                          rb_path_entry_t *top)
+{
+    size_t level = top - path;
+    if (rb->tail_count != RB_PATH_UNKNOWN && level < rb->tail_count &&
+        (!level || rb->tail[level].node == top->node))
+        rb->tail_count = RB_PATH_UNKNOWN;
+}
+
+/* Climb from the element of @it, whose path is recorded, to the lowest
+ * ancestor whose subtree spans @key, and fill @path down to it. Only the
+ * ancestors that bound the subtrees on the way are compared with @key.
+ * Return the entry of that ancestor, compared with @key already.
+ */
+static rb_path_entry_t *rb_hint_climb(map_t rb,
+                                      map_iter_t *it,
+                                      const void *key,
+                                      rb_path_entry_t *path)
+{
+    map_node_t *node = it->node;
+    size_t depth = it->count, level = depth;
+    map_cmp_t cmp = (rb->comparator)(key, node->key);
+
+    while (cmp != _CMP_EQUAL) {
+        /* the nearest ancestor on the side of @key bounds the subtree */
+        map_node_t *child = node, *bound = NULL;
+        while (level) {
+            map_node_t *parent = it->path[level - 1];
+            if (child == (cmp == _CMP_LESS ? rb_node_get_right(parent)
+                                           : rb_node_get_left(parent))) {
+                bound = parent;
+                break;
+            }
+            child = parent;
+            level--;
+        }
+        if (!bound)
+            break;
+
+        map_cmp_t bound_cmp = (rb->comparator)(key, bound->key);
+        if (bound_cmp != cmp && bound_cmp != _CMP_EQUAL)
+            break;
+        node = bound;
+        depth = --level;
+        cmp = bound_cmp;
+    }
+
+    for (size_t i = 0; i < depth; i++) {
+        map_node_t *child = (i + 1 < depth) ? it->path[i + 1] : node;
+        path[i].node = it->path[i];
+        path[i].cmp = (rb_node_get_left(it->path[i]) == child) ? _CMP_LESS
+                                                              : _CMP_GREATER;
+    }
+    path[depth].node = node;
+    path[depth].cmp = cmp;
+    return path + depth;
+}
+
 /* Constructor */
 map_t map_new(size_t s1,
               size_t s2,
@@ -589,59 +1006,1411 @@ map_t map_new(size_t s1,
     assert(tree);
 
     tree->key_size = s1, tree->data_size = s2;
+    tree->size = 0;
     tree->comparator = cmp;
     tree->root = NULL;
+    tree->max = NULL;
+    tree->tail_count = 0;
+    tree->cache = NULL;
+    tree->cache_mask = 0;
+    tree->cache_hits = tree->cache_misses = 0;
+    tree->lazy = 0;
+    tree->dead = 0;
+    tree->slab = slab_new(sizeof(map_node_t) + map_align(s1) + map_align(s2));
     return tree;
 }
 
-/* Add function */
+/* Add functions */
+
+/* Bring the node of a key being inserted back to life with @val if it is
+ * dead, reusing it in place. Return true if it was dead.
+ */
+static bool rb_revive(map_t obj, map_node_t *node, void *val)
+{
+    if (!rb_node_is_dead(node))
+        return false;
+
+    rb_node_set_dead(node, false);
+    obj->dead--;
+    obj->size++;
+    if (!val)
+        memset(node->data, 0, obj->data_size);
+    else
+        memcpy(node->data, val, obj->data_size);
+    return true;
+}
+
 bool map_insert(map_t obj, void *key, void *val)
 {
-    map_node_t *node = map_create_node(key, val, obj->key_size, obj->data_size);
-    rb_insert(obj, node);
+    map_iter_t it;
+    return map_insert_or_get(obj, &it, key, val);
+}
+
+/* Point @it to the element of @key, inserting it with @val if it is not in
+ * the map yet. The tree is only descended once, and nothing is allocated
+ * when the key is found. Return true if the element was inserted.
+ */
+bool map_insert_or_get(map_t obj, map_iter_t *it, void *key, void *val)
+{
+    rb_path_entry_t path[RB_MAX_DEPTH];
+    rb_path_entry_t *pathp;
+
+    it->count = RB_PATH_UNKNOWN;
+    if (rb_is_append(obj, key)) {
+        it->node = rb_append(obj, key, val);
+        return true;
+    }
+
+    it->node = rb_insert_search(obj, key, path, &pathp);
+    if (it->node)
+        return rb_revive(obj, it->node, val);
+
+    it->node = map_create_node(obj, key, val);
+    rb_tail_check(obj, path, rb_insert_fixup(obj, path, pathp, it->node));
     return true;
 }
 
-/* Get functions */
-void map_find(map_t obj, map_iter_t *it, void *key)
+/* Insert the element like map_insert_or_get(), searching from the element of
+ * @it instead of the root. The search climbs from the hint only as far as
+ * needed, so a hint next to the position of @key, such as the element
+ * inserted last while the keys come in order, makes the insertion take
+ * amortized constant time apart from rebalancing. A farther hint is slower,
+ * never wrong. On return, @it points to the element of @key with its path
+ * recorded, ready to hint the next insertion.
+ */
+bool map_insert_hint(map_t obj, map_iter_t *it, void *key, void *val)
 {
-    map_node_t tmp_node = {.key = key};
-    it->node = rb_search(obj, &tmp_node);
+    rb_path_entry_t path[RB_MAX_DEPTH];
+    rb_path_entry_t *pathp, *top;
+    size_t known = 0;
+
+    if (rb_is_append(obj, key)) {
+        it->count = RB_PATH_UNKNOWN;
+        it->node = rb_append(obj, key, val);
+        return true;
+    }
+
+    if (it->node && it->count != RB_PATH_UNKNOWN) {
+        top = rb_hint_climb(obj, it, key, path);
+        known = top - path;
+        if (top->cmp == _CMP_EQUAL) {
+            it->node = top->node;
+            it->count = known;
+            return rb_revive(obj, it->node, val);
+        }
+        pathp = top + 1;
+        pathp->node = (top->cmp == _CMP_LESS) ? rb_node_get_left(top->node)
+                                              : rb_node_get_right(top->node);
+    } else {
+        path->node = obj->root;
+        pathp = path;
+    }
+
+    bool inserted = !rb_insert_descend(obj, key, pathp, &pathp);
+    top = pathp;
+    if (inserted) {
+        map_node_t *node = map_create_node(obj, key, val);
+        top = rb_insert_fixup(obj, path, pathp, node);
+        rb_tail_check(obj, path, top);
+        it->node = node;
+    } else {
+        it->node = pathp->node;
+        inserted = rb_revive(obj, it->node, val);
+    }
+
+    /* the fixup left the ancestors above @top alone */
+    for (; known < (size_t) (top - path); known++)
+        it->path[known] = path[known].node;
+    it->count = top - path;
+    map_iter_record_path(obj, it, top->node);
+    return inserted;
 }
 
-bool map_empty(map_t obj)
+/* Insert the element, or overwrite the data in place if @key is in the map
+ * already. Return true if the element was inserted.
+ */
+bool map_upsert(map_t obj, void *key, void *val)
 {
-    return !obj->root;
+    map_iter_t it;
+    if (map_insert_or_get(obj, &it, key, val))
+        return true;
+
+    if (!val)
+        memset(it.node->data, 0, obj->data_size);
+    else
+        memcpy(it.node->data, val, obj->data_size);
+    return false;
 }
 
-/* Iteration */
-bool map_at_end(map_t UNUSED, map_iter_t *it)
+/* Fill an empty map with @n elements whose keys are sorted in ascending
+ * order, in linear time. @keys and @vals are arrays of elements of the key
+ * and the data size, and @vals may be NULL to leave the data blank.
+ * Return false if the map was not empty.
+ */
+bool map_build_sorted(map_t obj, void *keys, void *vals, size_t n)
 {
-    return !(it->node);
+    map_compact(obj);
+    if (obj->root)
+        return false;
+
+    /* the tree of 2-nodes only is the shortest one that can be built */
+    unsigned height = 0;
+    while (height + 1 < sizeof(size_t) * 8 && (n + 1) >> (height + 1))
+        height++;
+
+    rb_build_t b = {.obj = obj, .keys = keys, .vals = vals, .next = 0};
+    obj->root = rb_build(&b, n, height);
+    assert(b.next == n);
+
+    obj->max = NULL;
+    obj->tail_count = RB_PATH_UNKNOWN;
+    return true;
 }
 
-/* Remove functions */
-void map_erase(map_t obj, map_iter_t *it)
+/* Get functions */
+
+/* Set of the lookup cache for the bytes of @key: two slots, the first one
+ * for the element that hit last.
+ */
+static inline map_node_t **rb_cache_set(map_t obj, const void *key)
 {
-    if (!it->node)
+    const unsigned char *bytes = key;
+    uint64_t hash = 0;
+
+    for (size_t i = 0; i < obj->key_size; i += sizeof(uint64_t)) {
+        uint64_t word = 0;
+        size_t len = obj->key_size - i;
+        memcpy(&word, bytes + i, len < sizeof(word) ? len : sizeof(word));
+        hash = (hash ^ word) * UINT64_C(0x9e3779b97f4a7c15);
+    }
+    return obj->cache + 2 * ((size_t) (hash >> 32) & obj->cache_mask);
+}
+
+/* Only the nodes found by map_find() enter the cache, and a node stays valid
+ * until it is erased, so inserting never invalidates a slot: removing a node
+ * clears it from the set its key hashes to, and clearing the map clears all.
+ */
+static void rb_cache_forget(map_t obj, map_node_t *node)
+{
+    map_node_t **set = rb_cache_set(obj, node->key);
+    for (int way = 0; way < 2; way++) {
+        if (set[way] == node)
+            set[way] = NULL;
+    }
+}
+
+void map_cache_enable(map_t obj, size_t entries)
+{
+    free(obj->cache);
+    obj->cache = NULL;
+    obj->cache_mask = 0;
+    obj->cache_hits = obj->cache_misses = 0;
+    if (!entries)
         return;
 
-    rb_remove(obj, it->node);
-    free(it->node->key);
-    free(it->node->data);
-    free(it->node);
+    size_t sets = 1;
+    while (sets * 2 < entries)
+        sets <<= 1;
+    obj->cache = calloc(sets * 2, sizeof(map_node_t *));
+    assert(obj->cache);
+    obj->cache_mask = sets - 1;
 }
 
-/* Empty map */
-void map_clear(map_t obj)
+void map_cache_stats(map_t obj, size_t *hits, size_t *misses)
 {
-    rb_destroy_recurse(obj, obj->root);
-    obj->root = NULL;
+    *hits = obj->cache_hits;
+    *misses = obj->cache_misses;
+}
+
+void map_find(map_t obj, map_iter_t *it, void *key)
+{
+    map_node_t tmp_node = {.key = key};
+    it->count = RB_PATH_UNKNOWN;
+    if (!obj->cache) {
+        it->node = rb_search_live(obj, &tmp_node);
+        return;
+    }
+
+    map_node_t **set = rb_cache_set(obj, key);
+    for (int way = 0; way < 2; way++) {
+        map_node_t *node = set[way];
+        if (node && !memcmp(node->key, key, obj->key_size)) {
+            /* move it up, out of reach of the next miss */
+            set[way] = set[0];
+            set[0] = node;
+            obj->cache_hits++;
+            it->node = node;
+            return;
+        }
+    }
+
+    /* a miss only replaces the second slot, so that a run of keys looked up
+     * once cannot push out the element that keeps hitting.
+     */
+    obj->cache_misses++;
+    it->node = rb_search_live(obj, &tmp_node);
+    /* the set must match the bytes of the key of the node, see above */
+    if (it->node && !memcmp(it->node->key, key, obj->key_size))
+        set[1] = it->node;
+}
+
+/* Number of the lookups map_find_batch() keeps in flight */
+#define RB_BATCH 16
+
+/* Look up the @n keys laid out one after the other from @keys, and point
+ * each of @its to the element of the matching key, like map_find(). The
+ * descents are interleaved: each step of a lookup prefetches the next node
+ * of its path while the other lookups do their compares, so the cache misses
+ * of up to RB_BATCH lookups overlap instead of coming one after the other.
+ * The lookup cache is not used.
+ */
+void map_find_batch(map_t obj, const void *keys, size_t n, map_iter_t *its)
+{
+    const char *key = keys;
+    map_node_t *cur[RB_BATCH];
+    size_t idx[RB_BATCH], live = 0, next = 0;
+
+    for (size_t i = 0; i < n; i++)
+        its[i].count = RB_PATH_UNKNOWN;
+    if (!obj->root) {
+        for (size_t i = 0; i < n; i++)
+            its[i].node = NULL;
+        return;
+    }
+
+    for (; live < RB_BATCH && next < n; live++, next++) {
+        idx[live] = next;
+        cur[live] = obj->root;
+    }
+    while (live) {
+        for (size_t j = 0; j < live;) {
+            map_node_t *node = cur[j];
+            map_cmp_t cmp =
+                (obj->comparator)(key + idx[j] * obj->key_size, node->key);
+            if (cmp != _CMP_EQUAL) {
+                node = (cmp == _CMP_LESS) ? rb_node_get_left(node)
+                                          : rb_node_get_right(node);
+                if (node) {
+                    /* the key right after the node may start a new line */
+                    __PREFETCH(node);
+                    __PREFETCH((char *) (node + 1) + obj->key_size - 1);
+                    cur[j++] = node;
+                    continue;
+                }
+            }
+
+            /* this lookup is over, hand its slot to the next key */
+            its[idx[j]].node = node && !rb_node_is_dead(node) ? node : NULL;
+            if (next < n) {
+                idx[j] = next++;
+                cur[j++] = obj->root;
+            } else {
+                live--;
+                idx[j] = idx[live];
+                cur[j] = cur[live];
+            }
+        }
+    }
+}
+
+/* Point @it to the first element whose key is greater than (or equal to, if
+ * not @strict) @key, or to the last element whose key is less than (or equal
+ * to) @key if not @forward. The path of the descent is kept in @it, so that
+ * the iteration can go on from there.
+ */
+static void map_bound(map_t obj,
+                      map_iter_t *it,
+                      void *key,
+                      bool forward,
+                      bool strict)
+{
+    map_node_t *node = obj->root;
+    size_t depth = 0, found = 0;
+
+    it->node = NULL;
+    while (node) {
+        map_cmp_t cmp = (obj->comparator)(key, node->key);
+        if (cmp == _CMP_EQUAL && !strict) {
+            it->node = node;
+            found = depth;
+            break;
+        }
+
+        /* an equal key here is only met by a strict bound, and skipped */
+        it->path[depth++] = node;
+        if (cmp == _CMP_EQUAL ||
+            cmp == (forward ? _CMP_GREATER : _CMP_LESS)) {
+            node = forward ? rb_node_get_right(node) : rb_node_get_left(node);
+            continue;
+        }
+
+        /* a candidate, but a closer one may sit in the subtree towards key */
+        it->node = node;
+        found = depth - 1;
+        node = forward ? rb_node_get_left(node) : rb_node_get_right(node);
+    }
+    it->count = found;
+
+    /* the closest element lies beyond the dead nodes */
+    if (it->node && rb_node_is_dead(it->node))
+        (forward ? map_next : map_prev)(obj, it);
+}
+
+/* First element whose key is not less than @key */
+void map_lower_bound(map_t obj, map_iter_t *it, void *key)
+{
+    map_bound(obj, it, key, true, false);
+}
+
+/* First element whose key is greater than @key */
+void map_upper_bound(map_t obj, map_iter_t *it, void *key)
+{
+    map_bound(obj, it, key, true, true);
+}
+
+/* Last element whose key is not greater than @key */
+void map_floor(map_t obj, map_iter_t *it, void *key)
+{
+    map_bound(obj, it, key, false, false);
+}
+
+/* First element whose key is not less than @key, same as map_lower_bound() */
+void map_ceil(map_t obj, map_iter_t *it, void *key)
+{
+    map_bound(obj, it, key, true, false);
+}
+
+bool map_empty(map_t obj)
+{
+    return !obj->size;
+}
+
+/* Order statistics */
+
+size_t map_size(map_t obj)
+{
+    return obj->size;
+}
+
+#ifdef MAP_ORDER_STATS
+/* Number of the elements whose keys are less than @key */
+size_t map_rank(map_t obj, void *key)
+{
+    /* the sizes of the subtrees count the dead nodes */
+    map_compact(obj);
+    map_node_t *node = obj->root;
+    size_t rank = 0;
+
+    while (node) {
+        map_cmp_t cmp = (obj->comparator)(key, node->key);
+        if (cmp == _CMP_LESS) {
+            node = rb_node_get_left(node);
+            continue;
+        }
+        rank += rb_node_get_size(rb_node_get_left(node));
+        if (cmp == _CMP_EQUAL)
+            break;
+        rank++;
+        node = rb_node_get_right(node);
+    }
+    return rank;
+}
+
+/* Point @it to the element of rank @k, recording the path on the way down */
+void map_select(map_t obj, map_iter_t *it, size_t k)
+{
+    map_compact(obj);
+    map_node_t *node = obj->root;
+
+    it->count = 0;
+    it->node = NULL;
+    if (k >= obj->size)
+        return;
+
+    for (;;) {
+        size_t left = rb_node_get_size(rb_node_get_left(node));
+        if (k == left)
+            break;
+        it->path[it->count++] = node;
+        if (k < left) {
+            node = rb_node_get_left(node);
+        } else {
+            k -= left + 1;
+            node = rb_node_get_right(node);
+        }
+    }
+    it->node = node;
+}
+#endif
+
+/* Add the nodes of the subtree of @node, @depth nodes below the root, to
+ * @stats, and their depths to @depths.
+ */
+static void rb_stats(const map_node_t *node,
+                     size_t depth,
+                     map_stats_t *stats,
+                     size_t *depths)
+{
+    for (; node; node = rb_node_get_right(node)) {
+        *depths += ++depth;
+        if (depth > stats->height)
+            stats->height = depth;
+        if (rb_node_get_color(node) == RB_RED)
+            stats->red++;
+        else
+            stats->black++;
+        rb_stats(rb_node_get_left(node), depth, stats, depths);
+    }
+}
+
+void map_stats(map_t obj, map_stats_t *stats)
+{
+    size_t depths = 0;
+
+    memset(stats, 0, sizeof(*stats));
+    stats->count = obj->size;
+    stats->dead = obj->dead;
+    stats->node_bytes = (obj->size + obj->dead) * sizeof(map_node_t);
+    stats->key_bytes = (obj->size + obj->dead) * obj->key_size;
+    stats->data_bytes = (obj->size + obj->dead) * obj->data_size;
+    stats->heap_bytes = sizeof(struct map_internal) +
+                        slab_footprint(obj->slab) +
+                        (obj->cache ? (obj->cache_mask + 1) * 2 *
+                                          sizeof(map_node_t *)
+                                    : 0);
+
+    rb_stats(obj->root, 0, stats, &depths);
+    assert(stats->red + stats->black == obj->size + obj->dead);
+    if (obj->size + obj->dead)
+        stats->avg_depth = (double) depths / (obj->size + obj->dead);
+}
+
+/* Iteration */
+
+/* Descend from @node, which is a child of the last node of the path, down to
+ * its leftmost (or rightmost) descendant.
+ */
+static void map_iter_descend(map_iter_t *it, map_node_t *node, bool leftmost)
+{
+    for (;;) {
+        map_node_t *child =
+            leftmost ? rb_node_get_left(node) : rb_node_get_right(node);
+        if (!child)
+            break;
+        it->path[it->count++] = node;
+        node = child;
+    }
+    it->node = node;
+}
+
+void map_first(map_t obj, map_iter_t *it)
+{
+    it->count = 0;
+    it->node = NULL;
+    if (obj->root)
+        map_iter_descend(it, obj->root, true);
+    if (it->node && rb_node_is_dead(it->node))
+        map_next(obj, it);
+}
+
+void map_last(map_t obj, map_iter_t *it)
+{
+    it->count = 0;
+    it->node = NULL;
+    if (obj->root)
+        map_iter_descend(it, obj->root, false);
+    if (it->node && rb_node_is_dead(it->node))
+        map_prev(obj, it);
+}
+
+/* Move to the next node in order, dead or not. Each node is visited at most
+ * twice over a complete traversal, so a move takes constant time on average.
+ */
+static void rb_iter_next(map_t obj, map_iter_t *it)
+{
+    map_node_t *node = it->node;
+    if (!node)
+        return;
+
+    if (it->count == RB_PATH_UNKNOWN) {
+        it->count = 0;
+        map_iter_record_path(obj, it, obj->root);
+    }
+
+    map_node_t *right = rb_node_get_right(node);
+    if (right) {
+        it->path[it->count++] = node;
+        map_iter_descend(it, right, true);
+        return;
+    }
+
+    /* go up until coming from a left child */
+    while (it->count) {
+        map_node_t *parent = it->path[--it->count];
+        if (rb_node_get_left(parent) == node) {
+            it->node = parent;
+            return;
+        }
+        node = parent;
+    }
+    it->node = NULL;
+}
+
+/* Move to the previous node in order, dead or not */
+static void rb_iter_prev(map_t obj, map_iter_t *it)
+{
+    map_node_t *node = it->node;
+    if (!node)
+        return;
+
+    if (it->count == RB_PATH_UNKNOWN) {
+        it->count = 0;
+        map_iter_record_path(obj, it, obj->root);
+    }
+
+    map_node_t *left = rb_node_get_left(node);
+    if (left) {
+        it->path[it->count++] = node;
+        map_iter_descend(it, left, false);
+        return;
+    }
+
+    /* go up until coming from a right child */
+    while (it->count) {
+        map_node_t *parent = it->path[--it->count];
+        if (rb_node_get_right(parent) == node) {
+            it->node = parent;
+            return;
+        }
+        node = parent;
+    }
+    it->node = NULL;
+}
+
+/* Move to the next element in order */
+void map_next(map_t obj, map_iter_t *it)
+{
+    do
+        rb_iter_next(obj, it);
+    while (it->node && rb_node_is_dead(it->node));
+}
+
+/* Move to the previous element in order */
+void map_prev(map_t obj, map_iter_t *it)
+{
+    do
+        rb_iter_prev(obj, it);
+    while (it->node && rb_node_is_dead(it->node));
+}
+
+bool map_at_end(map_t UNUSED, map_iter_t *it)
+{
+    return !(it->node);
+}
+
+/* Call @cb on the elements whose keys lie in [@lo, @hi) in order, until it
+ * returns false. A NULL bound leaves that side of the range open. Only the
+ * elements in the range are visited, after a single descent to @lo.
+ */
+void map_range_foreach(map_t obj,
+                       void *lo,
+                       void *hi,
+                       bool (*cb)(void *key, void *data, void *ctx),
+                       void *ctx)
+{
+    map_iter_t it;
+
+    if (lo)
+        map_lower_bound(obj, &it, lo);
+    else
+        map_first(obj, &it);
+
+    for (; it.node; map_next(obj, &it)) {
+        if (hi && (obj->comparator)(it.node->key, hi) != _CMP_LESS)
+            break;
+        if (!cb(it.node->key, it.node->data, ctx))
+            break;
+    }
+}
+
+#ifdef MAP_INTERVALS
+/* Walk the subtree of @node for map_overlap_foreach(), recursing on the left
+ * and looping on the right. Return false once @cb has asked to stop.
+ */
+static bool rb_overlap(map_node_t *node,
+                       uint64_t lo,
+                       uint64_t hi,
+                       bool (*cb)(void *key, void *data, void *ctx),
+                       void *ctx)
+{
+    for (; node; node = rb_node_get_right(node)) {
+        /* no range of the subtree reaches @lo */
+        if (node->max_end <= lo)
+            return true;
+        if (!rb_overlap(rb_node_get_left(node), lo, hi, cb, ctx))
+            return false;
+
+        /* the ranges of the right subtree start after this one */
+        const map_interval_t *range = node->key;
+        if (range->start >= hi)
+            return true;
+        if (range->end > lo && !rb_node_is_dead(node) &&
+            !cb(node->key, node->data, ctx))
+            return false;
+    }
+    return true;
+}
+
+void map_overlap_foreach(map_t obj,
+                         uint64_t lo,
+                         uint64_t hi,
+                         bool (*cb)(void *key, void *data, void *ctx),
+                         void *ctx)
+{
+    if (lo < hi)
+        rb_overlap(obj->root, lo, hi, cb, ctx);
+}
+#endif
+
+/* Read-only snapshot */
+
+/* The integer keys of a snapshot are packed in blocks of one cache line,
+ * which form a tree of (FZ_LINE / key size + 1) children per block stored in
+ * BFS order: the Eytzinger layout, for blocks instead of single keys. A lookup
+ * compares the key with a whole block at once, and the rank of the key among
+ * the block picks the child block to go on with. Other keys are laid out as
+ * a binary Eytzinger tree and compared by the comparator of the map.
+ */
+#define FZ_LINE 64
+#define FZ_B32 (FZ_LINE / sizeof(int32_t))
+#define FZ_B64 (FZ_LINE / sizeof(int64_t))
+
+struct map_frozen {
+    map_key_kind_t kind;
+    size_t key_size, data_size;
+    map_cmp_t (*comparator)(const void *, const void *);
+
+    /* @count elements, in @blocks blocks of keys for the integer kinds */
+    size_t count, blocks;
+    void *keys;
+    char *data;
+};
+
+typedef struct {
+    map_t obj;
+    map_frozen_t fz;
+    map_iter_t it;
+    int64_t max; /* pads the last blocks */
+} fz_build_t;
+
+static void *fz_alloc(size_t size)
+{
+    void *p = NULL;
+    int err = posix_memalign(&p, FZ_LINE, size ? size : FZ_LINE);
+    assert(!err && p);
+    (void) err;
+    return p;
+}
+
+/* Map the integer keys to signed ones in the same order, for the signed
+ * vector compares.
+ */
+static inline int64_t fz_int_key(map_key_kind_t kind, const void *key)
+{
+    switch (kind) {
+    case MAP_KEY_INT32: {
+        int32_t k;
+        memcpy(&k, key, sizeof(k));
+        return k;
+    }
+    case MAP_KEY_UINT32: {
+        uint32_t k;
+        memcpy(&k, key, sizeof(k));
+        return (int32_t) (k ^ (UINT32_C(1) << 31));
+    }
+    case MAP_KEY_INT64: {
+        int64_t k;
+        memcpy(&k, key, sizeof(k));
+        return k;
+    }
+    case MAP_KEY_UINT64: {
+        uint64_t k;
+        memcpy(&k, key, sizeof(k));
+        return (int64_t) (k ^ (UINT64_C(1) << 63));
+    }
+    default:
+        __UNREACHABLE;
+        return 0;
+    }
+}
+
+/* Number of the keys of @block less than @x, which are the first ones */
+static inline unsigned fz_rank32(const int32_t *block, int32_t x)
+{
+#if defined(FZ_SIMD) && defined(__AVX2__)
+    const __m256i *v = (const __m256i *) block;
+    __m256i vx = _mm256_set1_epi32(x);
+    unsigned mask = _mm256_movemask_ps(
+        _mm256_castsi256_ps(_mm256_cmpgt_epi32(vx, _mm256_load_si256(v))));
+    mask |= _mm256_movemask_ps(_mm256_castsi256_ps(
+                _mm256_cmpgt_epi32(vx, _mm256_load_si256(v + 1))))
+            << 8;
+    return __builtin_ctz(~mask);
+#elif defined(FZ_SIMD)
+    const __m128i *v = (const __m128i *) block;
+    __m128i vx = _mm_set1_epi32(x);
+    unsigned mask = 0;
+    for (unsigned i = 0; i < 4; i++)
+        mask |= _mm_movemask_ps(_mm_castsi128_ps(
+                    _mm_cmpgt_epi32(vx, _mm_load_si128(v + i))))
+                << (4 * i);
+    return __builtin_ctz(~mask);
+#else
+    unsigned rank = 0;
+    for (unsigned i = 0; i < FZ_B32; i++)
+        rank += block[i] < x;
+    return rank;
+#endif
+}
+
+static inline unsigned fz_rank64(const int64_t *block, int64_t x)
+{
+#if defined(FZ_SIMD) && defined(__AVX2__)
+    const __m256i *v = (const __m256i *) block;
+    __m256i vx = _mm256_set1_epi64x(x);
+    unsigned mask = _mm256_movemask_pd(
+        _mm256_castsi256_pd(_mm256_cmpgt_epi64(vx, _mm256_load_si256(v))));
+    mask |= _mm256_movemask_pd(_mm256_castsi256_pd(
+                _mm256_cmpgt_epi64(vx, _mm256_load_si256(v + 1))))
+            << 4;
+    return __builtin_ctz(~mask);
+#elif defined(FZ_SIMD) && defined(__SSE4_2__)
+    const __m128i *v = (const __m128i *) block;
+    __m128i vx = _mm_set1_epi64x(x);
+    unsigned mask = 0;
+    for (unsigned i = 0; i < 4; i++)
+        mask |= _mm_movemask_pd(_mm_castsi128_pd(
+                    _mm_cmpgt_epi64(vx, _mm_load_si128(v + i))))
+                << (2 * i);
+    return __builtin_ctz(~mask);
+#else
+    unsigned rank = 0;
+    for (unsigned i = 0; i < FZ_B64; i++)
+        rank += block[i] < x;
+    return rank;
+#endif
+}
+
+/* The lookups in blocks keep the position of the least key not less than @x
+ * seen so far, which deeper blocks can only lower. No branch depends on the
+ * compares.
+ */
+static void *fz_find32(map_frozen_t fz, int32_t x)
+{
+    const int32_t *keys = fz->keys;
+    size_t k = 0, res = SIZE_MAX;
+
+    while (k < fz->blocks) {
+        unsigned i = fz_rank32(keys + k * FZ_B32, x);
+        res = (i < FZ_B32) ? k * FZ_B32 + i : res;
+        k = k * (FZ_B32 + 1) + i + 1;
+    }
+    if (res == SIZE_MAX || keys[res] != x)
+        return NULL;
+    return fz->data + res * fz->data_size;
+}
+
+static void *fz_find64(map_frozen_t fz, int64_t x)
+{
+    const int64_t *keys = fz->keys;
+    size_t k = 0, res = SIZE_MAX;
+
+    while (k < fz->blocks) {
+        unsigned i = fz_rank64(keys + k * FZ_B64, x);
+        res = (i < FZ_B64) ? k * FZ_B64 + i : res;
+        k = k * (FZ_B64 + 1) + i + 1;
+    }
+    if (res == SIZE_MAX || keys[res] != x)
+        return NULL;
+    return fz->data + res * fz->data_size;
+}
+
+/* The binary layout keeps the root at 1 and the children of i at 2i and
+ * 2i + 1, so the descent is a shift and an add.
+ */
+static void *fz_find_opaque(map_frozen_t fz, const void *key)
+{
+    const char *keys = fz->keys;
+    size_t ksize = fz->key_size, i = 1;
+
+    while (i <= fz->count) {
+        /* the four grandchildren are next to each other */
+        __PREFETCH(keys + 4 * i * ksize);
+        i = 2 * i + ((fz->comparator)(keys + i * ksize, key) == _CMP_LESS);
+    }
+
+    /* undo the moves to the right since the last move to the left, which
+     * leaves the least key not less than @key, or 0.
+     */
+    while (i & 1)
+        i >>= 1;
+    i >>= 1;
+
+    if (!i || (fz->comparator)(keys + i * ksize, key) != _CMP_EQUAL)
+        return NULL;
+    return fz->data + i * fz->data_size;
+}
+
+/* Place the elements of the map in order along the in-order traversal of the
+ * layout, from the iteration over the map.
+ */
+static void fz_build_opaque(fz_build_t *b, size_t k)
+{
+    map_frozen_t fz = b->fz;
+    if (k > fz->count)
+        return;
+
+    fz_build_opaque(b, 2 * k);
+    memcpy((char *) fz->keys + k * fz->key_size, b->it.node->key,
+           fz->key_size);
+    memcpy(fz->data + k * fz->data_size, b->it.node->data, fz->data_size);
+    map_next(b->obj, &b->it);
+    fz_build_opaque(b, 2 * k + 1);
+}
+
+/* Same for the blocks of @n keys. The slots past the last element repeat the
+ * greatest key, so that the keys stay sorted and a lookup meets the real one
+ * first.
+ */
+static void fz_build_blocks(fz_build_t *b, size_t k, unsigned n)
+{
+    map_frozen_t fz = b->fz;
+    if (k >= fz->blocks)
+        return;
+
+    for (unsigned i = 0; i < n; i++) {
+        fz_build_blocks(b, k * (n + 1) + i + 1, n);
+
+        size_t slot = k * n + i;
+        if (b->it.node) {
+            b->max = fz_int_key(fz->kind, b->it.node->key);
+            memcpy(fz->data + slot * fz->data_size, b->it.node->data,
+                   fz->data_size);
+            map_next(b->obj, &b->it);
+        }
+        if (n == FZ_B32)
+            ((int32_t *) fz->keys)[slot] = (int32_t) b->max;
+        else
+            ((int64_t *) fz->keys)[slot] = b->max;
+    }
+    fz_build_blocks(b, k * (n + 1) + n + 1, n);
+}
+
+/* Take a snapshot of the elements of the map. A @kind that does not match the
+ * size of the keys falls back to MAP_KEY_OPAQUE.
+ */
+map_frozen_t map_freeze(map_t obj, map_key_kind_t kind)
+{
+    map_frozen_t fz = malloc(sizeof(struct map_frozen));
+    assert(fz);
+
+    size_t width = (kind == MAP_KEY_INT32 || kind == MAP_KEY_UINT32)   ? 4
+                   : (kind == MAP_KEY_INT64 || kind == MAP_KEY_UINT64) ? 8
+                                                                       : 0;
+    if (width != obj->key_size)
+        kind = MAP_KEY_OPAQUE;
+
+    fz->kind = kind;
+    fz->key_size = obj->key_size, fz->data_size = obj->data_size;
+    fz->comparator = obj->comparator;
+
+    fz_build_t b = {.obj = obj, .fz = fz, .max = 0};
+    fz->count = 0;
+    for (map_first(obj, &b.it); b.it.node; map_next(obj, &b.it))
+        fz->count++;
+
+    map_first(obj, &b.it);
+    if (kind == MAP_KEY_OPAQUE) {
+        /* slot 0 is left unused */
+        fz->blocks = 0;
+        fz->keys = fz_alloc((fz->count + 1) * fz->key_size);
+        fz->data = fz_alloc((fz->count + 1) * fz->data_size);
+        fz_build_opaque(&b, 1);
+    } else {
+        unsigned n = FZ_LINE / width;
+        fz->blocks = (fz->count + n - 1) / n;
+        fz->keys = fz_alloc(fz->blocks * FZ_LINE);
+        fz->data = fz_alloc(fz->blocks * n * fz->data_size);
+        fz_build_blocks(&b, 0, n);
+    }
+    assert(!b.it.node);
+    return fz;
+}
+
+/* Return the data of @key in the snapshot, or NULL if it is not there */
+void *map_frozen_find(map_frozen_t fz, const void *key)
+{
+    switch (fz->kind) {
+    case MAP_KEY_INT32:
+    case MAP_KEY_UINT32:
+        return fz_find32(fz, (int32_t) fz_int_key(fz->kind, key));
+    case MAP_KEY_INT64:
+    case MAP_KEY_UINT64:
+        return fz_find64(fz, fz_int_key(fz->kind, key));
+    default:
+        return fz_find_opaque(fz, key);
+    }
+}
+
+void map_frozen_delete(map_frozen_t fz)
+{
+    free(fz->keys);
+    free(fz->data);
+    free(fz);
+}
+
+/* Remove functions */
+
+/* Free a node unlinked by rb_remove() */
+static void map_release_node(map_t obj, map_node_t *node)
+{
+    /* the rebalancing may have reshaped the tail */
+    obj->tail_count = RB_PATH_UNKNOWN;
+    if (node == obj->max)
+        obj->max = NULL;
+    if (obj->cache)
+        rb_cache_forget(obj, node);
+    slab_free(obj->slab, node);
+    obj->size--;
+}
+
+/* Mark a live @node dead, and purge the dead nodes once there are too many */
+static void rb_bury(map_t obj, map_node_t *node)
+{
+    rb_node_set_dead(node, true);
+    if (obj->cache)
+        rb_cache_forget(obj, node);
+    obj->size--;
+    obj->dead++;
+    if (obj->dead * 100 > (size_t) obj->lazy * (obj->size + obj->dead))
+        map_compact(obj);
+}
+
+void map_erase(map_t obj, map_iter_t *it)
+{
+    if (!it->node)
+        return;
+
+    if (obj->lazy) {
+        if (!rb_node_is_dead(it->node))
+            rb_bury(obj, it->node);
+        return;
+    }
+
+    map_node_t *node = rb_remove(obj, it->node->key);
+    assert(node == it->node);
+    map_release_node(obj, node);
+}
+
+/* Remove the element of @key in a single descent, instead of map_find()
+ * followed by map_erase(). Return false if @key is not in the map.
+ */
+bool map_erase_key(map_t obj, void *key)
+{
+    if (obj->lazy) {
+        map_node_t tmp_node = {.key = key};
+        map_node_t *node = rb_search_live(obj, &tmp_node);
+        if (!node)
+            return false;
+        rb_bury(obj, node);
+        return true;
+    }
+
+    map_node_t *node = rb_remove(obj, key);
+    if (!node)
+        return false;
+
+    map_release_node(obj, node);
+    return true;
+}
+
+/* Free @node, which is out of the tree, and take it off the counts */
+static void rb_free_node(map_t obj, map_node_t *node)
+{
+    if (rb_node_is_dead(node)) {
+        obj->dead--;
+    } else {
+        obj->size--;
+        if (obj->cache)
+            rb_cache_forget(obj, node);
+    }
+    slab_free(obj->slab, node);
+}
+
+/* Free the nodes of the subtree of @node, recursing on the left and looping
+ * on the right, whose child is read before the node is freed.
+ */
+static void rb_free_subtree(map_t obj, map_node_t *node)
+{
+    while (node) {
+        rb_free_subtree(obj, rb_node_get_left(node));
+        map_node_t *right = rb_node_get_right(node);
+        rb_free_node(obj, node);
+        node = right;
+    }
+}
+
+static void rb_cache_reset(map_t obj)
+{
+    if (obj->cache)
+        memset(obj->cache, 0,
+               (obj->cache_mask + 1) * 2 * sizeof(map_node_t *));
+}
+
+/* Empty map. All the nodes live in the slab, so there is no need to walk the
+ * tree in order to release them, unless other maps share the slab.
+ */
+void map_clear(map_t obj)
+{
+    if (obj->slab->users > 1)
+        rb_free_subtree(obj, obj->root);
+    else
+        slab_reset(obj->slab);
+    obj->size = 0;
+    obj->dead = 0;
+    obj->root = NULL;
+    obj->max = NULL;
+    obj->tail_count = 0;
+    rb_cache_reset(obj);
+}
+
+/* Deferred removal */
+
+/* Gather the live nodes of the subtree of @node in order into @nodes, from
+ * *@n on, and free the dead ones. The right child of a node is read before
+ * the node may be freed.
+ */
+static void rb_compact_collect(map_t obj,
+                               map_node_t *node,
+                               map_node_t **nodes,
+                               size_t *n)
+{
+    while (node) {
+        rb_compact_collect(obj, rb_node_get_left(node), nodes, n);
+        map_node_t *right = rb_node_get_right(node);
+        if (rb_node_is_dead(node))
+            slab_free(obj->slab, node);
+        else
+            nodes[(*n)++] = node;
+        node = right;
+    }
+}
+
+/* Purge the dead nodes, rebuilding the tree from the live ones in linear
+ * time, like map_build_sorted() but without copying a single element. The
+ * lookup cache only holds live nodes, which stay where they are.
+ */
+void map_compact(map_t obj)
+{
+    if (!obj->dead)
+        return;
+
+    map_node_t **nodes = malloc((obj->size + 1) * sizeof(map_node_t *));
+    size_t n = 0;
+    assert(nodes);
+    rb_compact_collect(obj, obj->root, nodes, &n);
+    assert(n == obj->size);
+
+    unsigned height = 0;
+    while (height + 1 < sizeof(size_t) * 8 && (n + 1) >> (height + 1))
+        height++;
+
+    rb_build_t b = {.obj = obj, .nodes = nodes, .next = 0};
+    obj->root = rb_build(&b, n, height);
+    free(nodes);
+
+    obj->dead = 0;
+    obj->max = NULL;
+    obj->tail_count = RB_PATH_UNKNOWN;
+}
+
+void map_lazy_enable(map_t obj, unsigned percent)
+{
+    obj->lazy = percent;
+    if (!percent)
+        map_compact(obj);
+}
+
+/* Split and join */
+
+/* A red-black tree on its own, whose root is black, along with its black
+ * height: the number of black nodes on every path from the root down to a
+ * null link.
+ */
+typedef struct {
+    map_node_t *root;
+    unsigned height;
+} rb_tree_t;
+
+static rb_tree_t rb_tree(map_t obj)
+{
+    rb_tree_t t = {.root = obj->root, .height = 0};
+    for (map_node_t *node = t.root; node; node = rb_node_get_left(node)) {
+        if (rb_node_get_color(node) == RB_BLACK)
+            t.height++;
+    }
+    return t;
+}
+
+/* Make a tree of the subtree of @node, a child of a node with @height black
+ * nodes on the paths below it. A red root turns black.
+ */
+static rb_tree_t rb_subtree(map_node_t *node, unsigned height)
+{
+    rb_tree_t t = {.root = node, .height = height};
+    if (node && rb_node_get_color(node) == RB_RED) {
+        rb_node_set_black(node);
+        t.height++;
+    }
+    return t;
+}
+
+/* Join @l and @r around @node, the keys of @l being less than that of @node
+ * and those of @r greater. The node is linked red in place of the subtree on
+ * the inner spine of the higher tree that is as high as the other tree, and
+ * the colors are fixed up from there as after an insertion, in time linear
+ * in the difference of the heights.
+ */
+static rb_tree_t rb_join(rb_tree_t l, map_node_t *node, rb_tree_t r)
+{
+    rb_path_entry_t path[RB_MAX_DEPTH], *pathp = path;
+    map_node_t *left = l.root, *right = r.root;
+    rb_tree_t t = {.height = l.height > r.height ? l.height : r.height};
+
+    if (l.height > r.height) {
+        /* the right links are black, so each step down passes one */
+        pathp->node = l.root;
+        for (unsigned h = l.height; h > r.height; h--, pathp++) {
+            pathp->cmp = _CMP_GREATER;
+            pathp[1].node = rb_node_get_right(pathp->node);
+        }
+        left = pathp->node;
+    } else if (l.height < r.height) {
+        pathp->node = r.root;
+        for (unsigned h = r.height;
+             h > l.height ||
+             (pathp->node && rb_node_get_color(pathp->node) == RB_RED);
+             pathp++) {
+            if (rb_node_get_color(pathp->node) == RB_BLACK)
+                h--;
+            pathp->cmp = _CMP_LESS;
+            pathp[1].node = rb_node_get_left(pathp->node);
+        }
+        right = pathp->node;
+    }
+
+    rb_node_set_left(node, left);
+    rb_node_set_right(node, right);
+    rb_node_set_red(node);
+    pathp->node = node;
+    rb_relink(path, pathp);
+    rb_path_update(path, pathp + 1);
+
+    t.root = path->node;
+    if (rb_node_get_color(t.root) == RB_RED) {
+        rb_node_set_black(t.root);
+        t.height++;
+    }
+    return t;
+}
+
+/* Split @t into the tree of the keys less than @key, which is returned, and
+ * that of the keys greater, in @*right. The node of @key, if any, is left
+ * out in @*pivot. The nodes of the path down to @key are joined bottom-up on
+ * either side, along with the subtrees hanging off the path, and the trees
+ * grow higher as they go up, so that the joins take logarithmic time in all.
+ */
+static rb_tree_t rb_split(map_t obj,
+                          rb_tree_t t,
+                          const void *key,
+                          rb_tree_t *right,
+                          map_node_t **pivot)
+{
+    rb_path_entry_t path[RB_MAX_DEPTH], *pathp = path;
+    unsigned below[RB_MAX_DEPTH]; /* black nodes below each node of @path */
+    rb_tree_t left = {.root = NULL, .height = 0};
+
+    *right = left;
+    *pivot = NULL;
+    path->node = t.root;
+    below[0] = t.height ? t.height - 1 : 0;
+    for (; pathp->node; pathp++) {
+        map_node_t *node = pathp->node;
+        unsigned h = below[pathp - path];
+        map_cmp_t cmp = pathp->cmp = (obj->comparator)(key, node->key);
+        if (cmp == _CMP_EQUAL) {
+            *pivot = node;
+            left = rb_subtree(rb_node_get_left(node), h);
+            *right = rb_subtree(rb_node_get_right(node), h);
+            break;
+        }
+
+        map_node_t *child = (cmp == _CMP_LESS) ? rb_node_get_left(node)
+                                               : rb_node_get_right(node);
+        pathp[1].node = child;
+        below[pathp - path + 1] =
+            (child && rb_node_get_color(child) == RB_BLACK) ? h - 1 : h;
+    }
+
+    /* the joins below a node of the path leave it alone */
+    while (pathp-- > path) {
+        map_node_t *node = pathp->node;
+        unsigned h = below[pathp - path];
+        if (pathp->cmp == _CMP_LESS)
+            *right = rb_join(*right, node,
+                             rb_subtree(rb_node_get_right(node), h));
+        else
+            left = rb_join(rb_subtree(rb_node_get_left(node), h), node, left);
+    }
+    return left;
+}
+
+/* Join @l and @r, the keys of @l being less than those of @r, around the
+ * least element of @r, split off first.
+ */
+static rb_tree_t rb_join2(map_t obj, rb_tree_t l, rb_tree_t r)
+{
+    if (!l.root)
+        return r;
+    if (!r.root)
+        return l;
+
+    map_node_t *least = r.root, *pivot;
+    while (rb_node_get_left(least))
+        least = rb_node_get_left(least);
+    rb_tree_t rest;
+    rb_split(obj, r, least->key, &rest, &pivot);
+    return rb_join(l, pivot, rest);
+}
+
+/* Number of the nodes in the subtree of @node */
+static size_t rb_count(const map_node_t *node)
+{
+#ifdef MAP_ORDER_STATS
+    return rb_node_get_size(node);
+#else
+    size_t count = 0;
+    for (; node; node = rb_node_get_right(node))
+        count += 1 + rb_count(rb_node_get_left(node));
+    return count;
+#endif
+}
+
+/* The tree was reshaped past what the tail can follow */
+static void rb_set_root(map_t obj, rb_tree_t t)
+{
+    obj->root = t.root;
+    obj->max = NULL;
+    obj->tail_count = RB_PATH_UNKNOWN;
+}
+
+size_t map_erase_range(map_t obj, void *lo, void *hi)
+{
+    rb_tree_t low = {.root = NULL, .height = 0}, mid = rb_tree(obj), high = low;
+    map_node_t *first = NULL, *last = NULL;
+    size_t size = obj->size;
+
+    if (lo && hi && (obj->comparator)(lo, hi) != _CMP_LESS)
+        return 0;
+    if (lo)
+        low = rb_split(obj, mid, lo, &mid, &first);
+    if (hi)
+        mid = rb_split(obj, mid, hi, &high, &last);
+
+    rb_free_subtree(obj, mid.root);
+    if (first)
+        rb_free_node(obj, first);
+    rb_set_root(obj, last ? rb_join(low, last, high)
+                          : rb_join2(obj, low, high));
+    return size - obj->size;
+}
+
+void map_split(map_t obj, void *key, map_t *right)
+{
+    map_t other = map_new(obj->key_size, obj->data_size, obj->comparator);
+    slab_release(other->slab);
+    other->slab = slab_share(obj->slab);
+    other->lazy = obj->lazy;
+
+    /* the sizes of the two parts do not tell the dead nodes apart */
+    map_compact(obj);
+
+    rb_tree_t high, none = {.root = NULL, .height = 0};
+    map_node_t *pivot;
+    rb_tree_t low = rb_split(obj, rb_tree(obj), key, &high, &pivot);
+    if (pivot)
+        high = rb_join(none, pivot, high);
+
+    rb_set_root(obj, low);
+    rb_set_root(other, high);
+    other->size = rb_count(high.root);
+    obj->size -= other->size;
+    rb_cache_reset(obj);
+    *right = other;
+}
+
+bool map_join(map_t obj, map_t other)
+{
+    if (obj == other || obj->key_size != other->key_size ||
+        obj->data_size != other->data_size ||
+        obj->comparator != other->comparator)
+        return false;
+
+    /* the nodes of @other move to the slab of @obj, or the other way round
+     * if only @obj has a slab of its own
+     */
+    bool to_other = false;
+    if (obj->slab != other->slab && other->slab->users > 1) {
+        if (obj->slab->users > 1)
+            return false;
+        to_other = true;
+    }
+
+    map_compact(obj);
+    map_compact(other);
+    if (obj->root && other->root) {
+        map_iter_t last, first;
+        map_last(obj, &last);
+        map_first(other, &first);
+        if ((obj->comparator)(last.node->key, first.node->key) != _CMP_LESS)
+            return false;
+    }
+
+    if (to_other) {
+        slab_adopt(other->slab, obj->slab);
+        slab_release(obj->slab);
+        obj->slab = slab_share(other->slab);
+    } else if (obj->slab != other->slab) {
+        slab_adopt(obj->slab, other->slab);
+    }
+
+    rb_set_root(obj, rb_join2(obj, rb_tree(obj), rb_tree(other)));
+    obj->size += other->size;
+    other->size = 0;
+    other->root = NULL;
+    other->max = NULL;
+    other->tail_count = 0;
+    rb_cache_reset(other);
+    return true;
 }
 
 /* Destructor */
 void map_delete(map_t obj)
 {
-    map_clear(obj);
+    /* the nodes go back to the maps sharing the slab, if any */
+    if (obj->slab->users > 1)
+        rb_free_subtree(obj, obj->root);
+    free(obj->cache);
+    slab_release(obj->slab);
     free(obj);
 }
@@ -18,6 +18,7 @@
 
 #include <stdbool.h>
 #include <stddef.h>
+#include <stdint.h>
 
 /* Store the key, data, and values of each element in the tree.
  * This is the main basis of the entire tree aside from the root struct.
@@ -25,21 +26,44 @@
  * @left: pointer to the left child in the tree
  * @right_red: combination of a pointer to right child and @color (lowest
  * bit)
+ * @key: pointer to the key bytes, stored right after the node
+ * @data: pointer to the value bytes, stored right after the key
+ * @size: number of the elements of the subtree, with MAP_ORDER_STATS only
+ * @max_end: greatest end of the ranges of the subtree, with MAP_INTERVALS only
+ *
+ * The key and the value share a single allocation with the node, so that
+ * inserting an element costs one allocation and a lookup stays within the
+ * cache lines of the node itself.
  *
  * The red-black tree consists of a root and nodes attached to this root.
  */
 typedef struct map_node {
-    void *key, *data;
     struct map_node *left, *right_red; /* red-black tree */
+    void *key, *data;
+#ifdef MAP_ORDER_STATS
+    size_t size;
+#endif
+#ifdef MAP_INTERVALS
+    uint64_t max_end;
+#endif
 } map_node_t;
 
 typedef enum { _CMP_LESS = -1, _CMP_EQUAL = 0, _CMP_GREATER = 1 } map_cmp_t;
 
 typedef struct map_internal *map_t;
 
+/* Bound of the depth of a tree, see RB_MAX_DEPTH in map.c */
+#define MAP_MAX_DEPTH (sizeof(void *) << 4)
+
+/* Nodes have no parent pointer, so an iterator keeps the ancestors of @node
+ * in @path[0] (the root) to @path[@count - 1] in order to move to the
+ * neighboring elements. The path is recorded on the first move after
+ * map_find(). Any insertion or removal invalidates the iterators of a map.
+ */
 typedef struct {
     map_node_t *prev, *node;
     size_t count;
+    map_node_t *path[MAP_MAX_DEPTH];
 } map_iter_t;
 
 #define map_iter_value(it, type) (*(type *) (it)->node->data)
@@ -63,20 +87,171 @@ static inline map_cmp_t map_cmp_uint(const void *arg0, const void *arg1)
 /* Constructor */
 map_t map_new(size_t, size_t, map_cmp_t (*cmp)(const void *, const void *));
 
-/* Add function */
+/* Add functions */
 bool map_insert(map_t, void *, void *);
+bool map_insert_or_get(map_t, map_iter_t *, void *, void *);
+bool map_insert_hint(map_t, map_iter_t *, void *, void *);
+bool map_upsert(map_t, void *, void *);
+bool map_build_sorted(map_t, void *, void *, size_t);
 
 /* Get functions */
 void map_find(map_t, map_iter_t *, void *);
+void map_find_batch(map_t, const void *, size_t, map_iter_t *);
+void map_lower_bound(map_t, map_iter_t *, void *);
+void map_upper_bound(map_t, map_iter_t *, void *);
+void map_floor(map_t, map_iter_t *, void *);
+void map_ceil(map_t, map_iter_t *, void *);
 bool map_empty(map_t);
 
+/* Order statistics.
+ * map_size() counts the elements in constant time. When MAP_ORDER_STATS is
+ * defined, for map.c and all of its users alike, every node also keeps the
+ * size of its subtree, at the cost of a word per node and of a pass over the
+ * path of each insertion and removal. map_rank() then counts the elements
+ * whose keys are less than @key, and map_select() points @it to the element
+ * of rank @k, from 0, or to the end past the last one, in logarithmic time.
+ */
+size_t map_size(map_t);
+#ifdef MAP_ORDER_STATS
+size_t map_rank(map_t, void *);
+void map_select(map_t, map_iter_t *, size_t);
+#endif
+
+/* Interval map.
+ * When MAP_INTERVALS is defined, for map.c and all of its users alike, the
+ * keys start with the range [@start, @end) they cover, and every node keeps
+ * the greatest end of the ranges of its subtree. The keys are ordered by
+ * map_cmp_interval(), or by any comparator that orders them by their start
+ * first. map_overlap_foreach() calls @cb on the elements whose ranges
+ * overlap [@lo, @hi), in the order of the keys, until it returns false, and
+ * @cb must not change the map. The subtrees whose ranges all end by @lo or
+ * start from @hi are skipped, so that the cost is logarithmic plus linear in
+ * the number of elements found.
+ */
+#ifdef MAP_INTERVALS
+typedef struct {
+    uint64_t start, end;
+} map_interval_t;
+
+static inline map_cmp_t map_cmp_interval(const void *arg0, const void *arg1)
+{
+    const map_interval_t *a = arg0, *b = arg1;
+    if (a->start != b->start)
+        return (a->start < b->start) ? _CMP_LESS : _CMP_GREATER;
+    return (a->end < b->end)   ? _CMP_LESS
+           : (a->end > b->end) ? _CMP_GREATER
+                               : _CMP_EQUAL;
+}
+
+void map_overlap_foreach(map_t,
+                         uint64_t,
+                         uint64_t,
+                         bool (*)(void *, void *, void *),
+                         void *);
+#endif
+
+/* Introspection.
+ * map_stats() walks the tree to report the footprint and the shape of the
+ * map. The bytes of the keys and values only count the sizes given to
+ * map_new(), so that the heap bytes less these are the overhead of the map:
+ * nodes, padding, free slots of the allocator and the map itself.
+ */
+typedef struct {
+    size_t count;      /* elements */
+    size_t dead;       /* nodes of erased elements, see map_lazy_enable() */
+    size_t node_bytes; /* nodes, without their keys and values */
+    size_t key_bytes;  /* keys */
+    size_t data_bytes; /* values */
+    size_t heap_bytes; /* all the memory held by the map */
+    size_t height;     /* nodes on the longest path, the most a lookup visits */
+    double avg_depth;  /* nodes a lookup of an element visits on average */
+    size_t red, black; /* nodes of each color */
+} map_stats_t;
+
+void map_stats(map_t, map_stats_t *);
+
 /* Iteration */
+void map_first(map_t, map_iter_t *);
+void map_last(map_t, map_iter_t *);
+void map_next(map_t, map_iter_t *);
+void map_prev(map_t, map_iter_t *);
 bool map_at_end(map_t, map_iter_t *);
+void map_range_foreach(map_t,
+                       void *,
+                       void *,
+                       bool (*)(void *, void *, void *),
+                       void *);
+
+/* Lookup cache.
+ * map_cache_enable() puts a 2-way set-associative cache of @entries slots
+ * (rounded up to a power of two) in front of map_find(), so that the keys
+ * looked up over and over skip the descent. Keys are hashed by their bytes:
+ * keys that the comparator finds equal but whose bytes differ always miss.
+ * Zero entries turn the cache off. The counters add up the lookups since it
+ * was enabled.
+ */
+void map_cache_enable(map_t, size_t);
+void map_cache_stats(map_t, size_t *, size_t *);
+
+/* Read-only snapshot.
+ * map_freeze() copies the elements of a map into an immutable array laid out
+ * for search, and the map stays free to change afterwards. Freeze it again
+ * to take the changes into account. Integer keys are searched with vector
+ * compares when their kind is given, while MAP_KEY_OPAQUE keys go through the
+ * comparator of the map.
+ */
+typedef enum {
+    MAP_KEY_OPAQUE = 0,
+    MAP_KEY_INT32,
+    MAP_KEY_UINT32,
+    MAP_KEY_INT64,
+    MAP_KEY_UINT64,
+} map_key_kind_t;
+
+typedef struct map_frozen *map_frozen_t;
+
+map_frozen_t map_freeze(map_t, map_key_kind_t);
+void *map_frozen_find(map_frozen_t, const void *);
+void map_frozen_delete(map_frozen_t);
 
 /* Remove functions */
 void map_erase(map_t, map_iter_t *);
+bool map_erase_key(map_t, void *);
 void map_clear(map_t);
 
+/* Split and join.
+ * map_erase_range() removes the elements whose keys lie in [@lo, @hi), a NULL
+ * bound leaving that side of the range open, and returns their number. The
+ * tree is split around the range and joined back in logarithmic time, plus
+ * the time to free the removed nodes, dead ones included. map_split() moves
+ * the elements whose keys are @key or greater to a new map in @*right, in
+ * logarithmic time, plus the time to count them without MAP_ORDER_STATS.
+ * map_join() moves all the elements of @other into @obj in logarithmic time,
+ * and returns false instead if the maps differ in sizes or comparator, or
+ * unless all the keys of @obj are less than those of @other. Both purge the
+ * dead nodes of map_lazy_enable() first.
+ * The maps split from one another share the allocator of their nodes, so
+ * they must not be used concurrently, and clearing or deleting one of them
+ * frees its nodes one by one. map_join() also fails when each of the two
+ * maps shares its allocator with yet other maps.
+ */
+size_t map_erase_range(map_t, void *, void *);
+void map_split(map_t, void *, map_t *);
+bool map_join(map_t, map_t);
+
+/* Deferred removal.
+ * Once map_lazy_enable() is called with a nonzero @percent, the erased
+ * elements are only marked dead, in constant time past the lookup, and stay
+ * in the tree unseen by the lookups, the iteration and map_size(). Inserting
+ * the key of a dead element brings its node back. When the dead nodes exceed
+ * @percent of the nodes, or on map_compact(), they are all purged at once
+ * and the tree is rebuilt from the live ones in linear time. map_rank() and
+ * map_select() purge them first. A @percent of 0 purges them and goes back
+ * to removing the elements right away, the default.
+ */
+void map_lazy_enable(map_t, unsigned);
+void map_compact(map_t);
+
 /* Destructor */
 void map_delete(map_t);
 
@@ -0,0 +1,242 @@
+/*
+ * rv32emu is freely redistributable under the MIT License. See the file
+ * "LICENSE" for information on usage and redistribution of this file.
+ */
+
+#include <assert.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "shardmap.h"
+
+#define SHARD_CACHE_LINE 64
+
+/* Each shard sits in cache lines of its own, so that the threads taking the
+ * locks of different shards do not contend on the lines of the locks.
+ */
+typedef struct {
+    pthread_mutex_t lock;
+    map_t map;
+} shard_t;
+
+#define SHARD_STRIDE \
+    (((sizeof(shard_t) - 1) / SHARD_CACHE_LINE + 1) * SHARD_CACHE_LINE)
+
+struct shardmap {
+    unsigned count;
+    int route;
+    size_t key_size, data_size;
+    map_cmp_t (*comparator)(const void *, const void *);
+    char *shards; /* @count shards, SHARD_STRIDE bytes apart */
+};
+
+static inline shard_t *shard_at(shardmap_t obj, unsigned i)
+{
+    return (shard_t *) (obj->shards + (size_t) i * SHARD_STRIDE);
+}
+
+/* Shard of @key */
+static inline shard_t *shard_of(shardmap_t obj, const void *key)
+{
+    const unsigned char *bytes = key;
+    uint64_t hash = 0;
+
+    if (obj->route != SHARDMAP_HASH) {
+        memcpy(&hash, key, obj->key_size);
+        return shard_at(obj, (unsigned) ((hash >> obj->route) % obj->count));
+    }
+
+    for (size_t i = 0; i < obj->key_size; i += sizeof(uint64_t)) {
+        uint64_t word = 0;
+        size_t len = obj->key_size - i;
+        memcpy(&word, bytes + i, len < sizeof(word) ? len : sizeof(word));
+        hash = (hash ^ word) * UINT64_C(0x9e3779b97f4a7c15);
+    }
+    return shard_at(obj, (unsigned) ((hash >> 32) % obj->count));
+}
+
+/* Constructor */
+shardmap_t shardmap_new(unsigned count,
+                        int route,
+                        size_t s1,
+                        size_t s2,
+                        map_cmp_t (*cmp)(const void *, const void *))
+{
+    assert(count > 0);
+    assert(route == SHARDMAP_HASH ||
+           (route >= 0 && route < 64 && s1 <= sizeof(uint64_t)));
+
+    shardmap_t obj = malloc(sizeof(struct shardmap));
+    assert(obj);
+    obj->count = count;
+    obj->route = route;
+    obj->key_size = s1, obj->data_size = s2;
+    obj->comparator = cmp;
+
+    int err = posix_memalign((void **) &obj->shards, SHARD_CACHE_LINE,
+                             (size_t) count * SHARD_STRIDE);
+    assert(!err && obj->shards);
+    (void) err;
+    for (unsigned i = 0; i < count; i++) {
+        shard_t *shard = shard_at(obj, i);
+        pthread_mutex_init(&shard->lock, NULL);
+        shard->map = map_new(s1, s2, cmp);
+    }
+    return obj;
+}
+
+/* Add functions */
+bool shardmap_insert(shardmap_t obj, void *key, void *val)
+{
+    shard_t *shard = shard_of(obj, key);
+    pthread_mutex_lock(&shard->lock);
+    bool inserted = map_insert(shard->map, key, val);
+    pthread_mutex_unlock(&shard->lock);
+    return inserted;
+}
+
+bool shardmap_upsert(shardmap_t obj, void *key, void *val)
+{
+    shard_t *shard = shard_of(obj, key);
+    pthread_mutex_lock(&shard->lock);
+    bool inserted = map_upsert(shard->map, key, val);
+    pthread_mutex_unlock(&shard->lock);
+    return inserted;
+}
+
+/* Get functions */
+
+/* Copy the data of @key to @val, unless @val is NULL. The element may change
+ * as soon as the shard is unlocked, so no pointer into it is handed out.
+ * Return false if @key is not in the map.
+ */
+bool shardmap_find(shardmap_t obj, void *key, void *val)
+{
+    shard_t *shard = shard_of(obj, key);
+    map_iter_t it;
+
+    pthread_mutex_lock(&shard->lock);
+    map_find(shard->map, &it, key);
+    bool found = !map_at_end(shard->map, &it);
+    if (found && val)
+        memcpy(val, it.node->data, obj->data_size);
+    pthread_mutex_unlock(&shard->lock);
+    return found;
+}
+
+bool shardmap_empty(shardmap_t obj)
+{
+    for (unsigned i = 0; i < obj->count; i++) {
+        shard_t *shard = shard_at(obj, i);
+        pthread_mutex_lock(&shard->lock);
+        bool empty = map_empty(shard->map);
+        pthread_mutex_unlock(&shard->lock);
+        if (!empty)
+            return false;
+    }
+    return true;
+}
+
+/* Iteration */
+
+/* Restore the heap of shards ordered by their current keys, below @pos */
+static void shard_heap_down(shardmap_t obj,
+                            unsigned *heap,
+                            unsigned size,
+                            const map_iter_t *its,
+                            unsigned pos)
+{
+    unsigned top = heap[pos];
+    for (;;) {
+        unsigned child = 2 * pos + 1;
+        if (child >= size)
+            break;
+        if (child + 1 < size &&
+            (obj->comparator)(its[heap[child + 1]].node->key,
+                              its[heap[child]].node->key) == _CMP_LESS)
+            child++;
+        if ((obj->comparator)(its[heap[child]].node->key,
+                              its[top].node->key) != _CMP_LESS)
+            break;
+        heap[pos] = heap[child];
+        pos = child;
+    }
+    heap[pos] = top;
+}
+
+/* Call @cb on all the elements in the order of their keys, until it returns
+ * false. Each shard is walked in order, and a heap of the shards by their
+ * next key merges the walks. All the shards stay locked meanwhile, so that
+ * the walk sees a consistent map, and @cb must not call into it.
+ */
+void shardmap_foreach(shardmap_t obj,
+                      bool (*cb)(void *, void *, void *),
+                      void *ctx)
+{
+    map_iter_t *its = malloc(obj->count * sizeof(map_iter_t));
+    unsigned *heap = malloc(obj->count * sizeof(unsigned));
+    unsigned size = 0;
+    assert(its && heap);
+
+    /* always lock in the same order, as other walks may run */
+    for (unsigned i = 0; i < obj->count; i++) {
+        shard_t *shard = shard_at(obj, i);
+        pthread_mutex_lock(&shard->lock);
+        map_first(shard->map, its + i);
+        if (!map_at_end(shard->map, its + i))
+            heap[size++] = i;
+    }
+    for (unsigned i = size / 2; i-- > 0;)
+        shard_heap_down(obj, heap, size, its, i);
+
+    while (size) {
+        map_iter_t *it = its + heap[0];
+        if (!cb(it->node->key, it->node->data, ctx))
+            break;
+
+        map_t map = shard_at(obj, heap[0])->map;
+        map_next(map, it);
+        if (map_at_end(map, it))
+            heap[0] = heap[--size];
+        shard_heap_down(obj, heap, size, its, 0);
+    }
+
+    for (unsigned i = 0; i < obj->count; i++)
+        pthread_mutex_unlock(&shard_at(obj, i)->lock);
+    free(heap);
+    free(its);
+}
+
+/* Remove functions */
+bool shardmap_erase(shardmap_t obj, void *key)
+{
+    shard_t *shard = shard_of(obj, key);
+    pthread_mutex_lock(&shard->lock);
+    bool erased = map_erase_key(shard->map, key);
+    pthread_mutex_unlock(&shard->lock);
+    return erased;
+}
+
+void shardmap_clear(shardmap_t obj)
+{
+    for (unsigned i = 0; i < obj->count; i++) {
+        shard_t *shard = shard_at(obj, i);
+        pthread_mutex_lock(&shard->lock);
+        map_clear(shard->map);
+        pthread_mutex_unlock(&shard->lock);
+    }
+}
+
+/* Destructor */
+void shardmap_delete(shardmap_t obj)
+{
+    for (unsigned i = 0; i < obj->count; i++) {
+        shard_t *shard = shard_at(obj, i);
+        map_delete(shard->map);
+        pthread_mutex_destroy(&shard->lock);
+    }
+    free(obj->shards);
+    free(obj);
+}
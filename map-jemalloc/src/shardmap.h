@@ -0,0 +1,59 @@
+/*
+ * rv32emu is freely redistributable under the MIT License. See the file
+ * "LICENSE" for information on usage and redistribution of this file.
+ */
+
+/*
+ * Map partitioned by key into independent shards.
+ *
+ * A shardmap holds a number of maps, each with its own lock and its own node
+ * allocator, and sends every operation to the one shard its key belongs to.
+ * Threads working on keys of different shards then run in parallel instead of
+ * queuing on a single lock.
+ *
+ * The shard of a key is picked either by a hash of the bytes of the key, which
+ * spreads any keys evenly, or by the bits of an integer key from @route up,
+ * which keeps neighbouring keys such as the addresses within a page together.
+ * Either way the order of the keys spans the shards, so the ordered walk
+ * merges the shards.
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "map.h"
+
+/* Route the keys by a hash of their bytes */
+#define SHARDMAP_HASH (-1)
+
+typedef struct shardmap *shardmap_t;
+
+/* Constructor.
+ * @shards: number of shards, at least one
+ * @route: SHARDMAP_HASH, or the shift applied to integer keys of up to eight
+ * bytes before taking them modulo @shards
+ */
+shardmap_t shardmap_new(unsigned,
+                        int,
+                        size_t,
+                        size_t,
+                        map_cmp_t (*cmp)(const void *, const void *));
+
+/* The operations below are thread-safe */
+bool shardmap_insert(shardmap_t, void *, void *);
+bool shardmap_upsert(shardmap_t, void *, void *);
+bool shardmap_find(shardmap_t, void *, void *);
+bool shardmap_erase(shardmap_t, void *);
+bool shardmap_empty(shardmap_t);
+void shardmap_foreach(shardmap_t,
+                      bool (*)(void *, void *, void *),
+                      void *);
+void shardmap_clear(shardmap_t);
+
+/* Destructor, once no other thread uses the map */
+void shardmap_delete(shardmap_t);
+
+#define shardmap_init(shards, route, key_type, element_type, __func) \
+    shardmap_new(shards, route, sizeof(key_type), sizeof(element_type), __func)
@@ -0,0 +1,161 @@
+/*
+ * rv32emu is freely redistributable under the MIT License. See the file
+ * "LICENSE" for information on usage and redistribution of this file.
+ */
+
+#include <assert.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "slab.h"
+
+/* Blocks start small so that tiny maps stay cheap, and then grow
+ * geometrically up to the maximum size.
+ */
+#define SLAB_MIN_BLOCK (4 << 10)
+#define SLAB_MAX_BLOCK (1 << 20)
+
+struct slab_block {
+    struct slab_block *next;
+    size_t size;
+    uint64_t payload[]; /* keep the objects 8-byte aligned */
+};
+
+void slab_init(slab_t *slab, size_t obj_size)
+{
+    if (obj_size < sizeof(void *))
+        obj_size = sizeof(void *);
+
+    slab->obj_size = obj_size;
+    slab->free_list = NULL;
+    slab->cur = slab->end = NULL;
+    slab->blocks = NULL;
+    slab->block_size = SLAB_MIN_BLOCK;
+    slab->users = 1;
+}
+
+/* Slow path of slab_alloc(): start a new block and carve the first object */
+void *slab_grow(slab_t *slab)
+{
+    size_t size = slab->block_size;
+    while (size < slab->obj_size)
+        size <<= 1;
+
+    slab_block_t *block = malloc(sizeof(slab_block_t) + size);
+    assert(block);
+    block->size = size;
+    block->next = slab->blocks;
+    slab->blocks = block;
+
+    if (slab->block_size < SLAB_MAX_BLOCK)
+        slab->block_size <<= 1;
+
+    slab->cur = (char *) block->payload + slab->obj_size;
+    slab->end = (char *) block->payload + size;
+    return block->payload;
+}
+
+/*
+ * Release every object at once. The newest block is the largest one, so it is
+ * kept around to serve the next round of allocations without calling malloc.
+ */
+void slab_reset(slab_t *slab)
+{
+    slab_block_t *block = slab->blocks;
+    if (!block)
+        return;
+
+    for (slab_block_t *next, *it = block->next; it; it = next) {
+        next = it->next;
+        free(it);
+    }
+    block->next = NULL;
+
+    slab->free_list = NULL;
+    slab->cur = (char *) block->payload;
+    slab->end = (char *) block->payload + block->size;
+}
+
+/* Release every object along with all the memory held by the slab */
+void slab_destroy(slab_t *slab)
+{
+    for (slab_block_t *next, *it = slab->blocks; it; it = next) {
+        next = it->next;
+        free(it);
+    }
+    slab_init(slab, slab->obj_size);
+}
+
+/* Bytes obtained from malloc(), the headers of the blocks included */
+size_t slab_footprint(const slab_t *slab)
+{
+    size_t bytes = 0;
+    for (const slab_block_t *it = slab->blocks; it; it = it->next)
+        bytes += sizeof(slab_block_t) + it->size;
+    return bytes;
+}
+
+/* Allocate a slab of its own on the heap, for slab_share() */
+slab_t *slab_new(size_t obj_size)
+{
+    slab_t *slab = malloc(sizeof(slab_t));
+    assert(slab);
+    slab_init(slab, obj_size);
+    return slab;
+}
+
+/* Take one more hold of a slab from slab_new() */
+slab_t *slab_share(slab_t *slab)
+{
+    slab->users++;
+    return slab;
+}
+
+/* Drop a hold of a slab from slab_new(), and free it along with its memory
+ * once the last one is gone.
+ */
+void slab_release(slab_t *slab)
+{
+    if (--slab->users)
+        return;
+    slab_destroy(slab);
+    free(slab);
+}
+
+/*
+ * Hand the blocks and the free objects of @src over to @dst, for objects of
+ * the same size, leaving @src empty. The free objects of @src are moved one
+ * by one, and the unused end of the newest block of only one of the two is
+ * kept, the larger.
+ */
+void slab_adopt(slab_t *dst, slab_t *src)
+{
+    assert(dst->obj_size == src->obj_size);
+    if (!src->blocks)
+        return;
+
+    slab_block_t *last = src->blocks;
+    while (last->next)
+        last = last->next;
+    last->next = dst->blocks;
+    if (!dst->blocks || src->end - src->cur > dst->end - dst->cur) {
+        dst->cur = src->cur;
+        dst->end = src->end;
+        dst->blocks = src->blocks;
+    } else {
+        /* keep the newest block of @dst first, for slab_reset() */
+        last->next = dst->blocks->next;
+        dst->blocks->next = src->blocks;
+    }
+    if (dst->block_size < src->block_size)
+        dst->block_size = src->block_size;
+
+    while (src->free_list) {
+        void *obj = src->free_list;
+        src->free_list = *(void **) obj;
+        slab_free(dst, obj);
+    }
+
+    src->cur = src->end = NULL;
+    src->blocks = NULL;
+}
@@ -1,10 +1,15 @@
 #include <assert.h>
+#include <pthread.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <time.h>
 
+#include "map-typed.h"
 #include "map.h"
+#include "shardmap.h"
+
+MAP_DEFINE(intmap, int, int, MAP_CMP_SCALAR)
 
 static void swap(int *x, int *y)
 {
@@ -102,6 +107,1214 @@ free_tree:
     return ret;
 }
 
+/* The map must remain usable after its nodes were released in bulk */
+static int test_map_clear_reuse()
+{
+    int ret = 0;
+    map_t tree = map_init(int, int, map_cmp_int);
+
+    for (int round = 0; round < 3; round++) {
+        for (int i = 0; i < N_NODES; i++) {
+            int val = i * 2;
+            map_insert(tree, &i, &val);
+        }
+
+        /* punch holes so that the free list gets used by the next round */
+        for (int i = 0; i < N_NODES; i += 3) {
+            map_iter_t my_it;
+            map_find(tree, &my_it, &i);
+            map_erase(tree, &my_it);
+        }
+
+        for (int i = 0; i < N_NODES; i++) {
+            map_iter_t my_it;
+            map_find(tree, &my_it, &i);
+            if ((i % 3 == 0) != map_at_end(tree, &my_it) ||
+                (!map_at_end(tree, &my_it) &&
+                 map_iter_value(&my_it, int) != i * 2)) {
+                ret = 1;
+                goto free_tree;
+            }
+        }
+
+        map_clear(tree);
+        if (!map_empty(tree)) {
+            ret = 1;
+            goto free_tree;
+        }
+    }
+
+free_tree:
+    map_delete(tree);
+    return ret;
+}
+
+/* The generated map must agree with the generic one */
+static int test_map_typed()
+{
+    int ret = 0;
+    intmap_t *tree = intmap_new();
+
+    int key[N_NODES];
+    for (int i = 0; i < N_NODES; i++)
+        key[i] = i;
+    for (int i = 0; i < N_NODES; i++) {
+        int pos_a = rand() % N_NODES;
+        int pos_b = rand() % N_NODES;
+        swap(&key[pos_a], &key[pos_b]);
+    }
+
+    for (int i = 0; i < N_NODES; i++) {
+        if (!intmap_insert(tree, key[i], key[i] + 1)) {
+            ret = 1;
+            goto free_tree;
+        }
+    }
+
+    /* duplicate keys are rejected */
+    if (intmap_insert(tree, key[0], 0)) {
+        ret = 1;
+        goto free_tree;
+    }
+
+    /* remove the keys in the first half of the insertion order */
+    for (int i = 0; i < N_NODES / 2; i++) {
+        if (!intmap_erase(tree, key[i]) || intmap_erase(tree, key[i])) {
+            ret = 1;
+            goto free_tree;
+        }
+    }
+
+    for (int i = 0; i < N_NODES; i++) {
+        int *val = intmap_find(tree, key[i]);
+        if ((i < N_NODES / 2) ? !!val : (!val || *val != key[i] + 1)) {
+            ret = 1;
+            goto free_tree;
+        }
+    }
+
+    for (int i = N_NODES / 2; i < N_NODES; i++)
+        intmap_erase(tree, key[i]);
+    if (!intmap_empty(tree))
+        ret = 1;
+
+free_tree:
+    intmap_clear(tree);
+    intmap_delete(tree);
+    return ret;
+}
+
+/* A bulk-loaded map must behave like one filled by map_insert() */
+static int test_map_build_sorted()
+{
+    int ret = 0;
+    int key[N_NODES], val[N_NODES];
+
+    for (int i = 0; i < N_NODES; i++) {
+        key[i] = i * 2;
+        val[i] = i;
+    }
+
+    /* cover the shapes of small trees as well as a large one */
+    for (int n = 0; n <= N_NODES; n += (n < 64) ? 1 : N_NODES / 4) {
+        map_t tree = map_init(int, int, map_cmp_int);
+
+        if (!map_build_sorted(tree, key, val, n) ||
+            map_build_sorted(tree, key, val, n) != (n == 0)) {
+            ret = 1;
+            goto free_tree;
+        }
+
+        for (int i = 0; i < n; i++) {
+            map_iter_t my_it;
+            map_find(tree, &my_it, key + i);
+            if (map_at_end(tree, &my_it) ||
+                map_iter_value(&my_it, int) != val[i]) {
+                ret = 1;
+                goto free_tree;
+            }
+        }
+
+        /* the coloring must hold for later updates */
+        for (int i = 0; i < n; i++) {
+            int odd = key[i] + 1;
+            map_insert(tree, &odd, &odd);
+        }
+        for (int i = 0; i < n; i++) {
+            map_iter_t my_it;
+            map_find(tree, &my_it, key + i);
+            map_erase(tree, &my_it);
+            map_find(tree, &my_it, key + i);
+            if (!map_at_end(tree, &my_it)) {
+                ret = 1;
+                goto free_tree;
+            }
+        }
+
+    free_tree:
+        map_delete(tree);
+        if (ret)
+            break;
+    }
+    return ret;
+}
+
+/* Existing elements are returned, or overwritten, without being duplicated */
+static int test_map_insert_or_get()
+{
+    int ret = 0;
+    map_t tree = map_init(int, int, map_cmp_int);
+
+    for (int i = 0; i < N_NODES; i++) {
+        map_iter_t my_it;
+        int val = i + 1;
+        if (!map_insert_or_get(tree, &my_it, &i, &val) ||
+            map_iter_value(&my_it, int) != i + 1) {
+            ret = 1;
+            goto free_tree;
+        }
+    }
+
+    for (int i = 0; i < N_NODES; i++) {
+        map_iter_t my_it, found_it;
+        int val = -1;
+        map_find(tree, &found_it, &i);
+        if (map_insert_or_get(tree, &my_it, &i, &val) ||
+            my_it.node != found_it.node ||
+            map_iter_value(&my_it, int) != i + 1 ||
+            map_insert(tree, &i, &val)) {
+            ret = 1;
+            goto free_tree;
+        }
+    }
+
+    /* overwrite the even elements, and insert as many new ones */
+    for (int i = 0; i < N_NODES * 2; i += 2) {
+        int val = -i;
+        if (map_upsert(tree, &i, &val) != (i >= N_NODES)) {
+            ret = 1;
+            goto free_tree;
+        }
+    }
+
+    for (int i = 0; i < N_NODES * 2; i++) {
+        map_iter_t my_it;
+        map_find(tree, &my_it, &i);
+        if (i >= N_NODES && i % 2) {
+            if (!map_at_end(tree, &my_it))
+                ret = 1;
+        } else if (map_at_end(tree, &my_it) ||
+                   map_iter_value(&my_it, int) != (i % 2 ? i + 1 : -i)) {
+            ret = 1;
+        }
+        if (ret)
+            goto free_tree;
+    }
+
+free_tree:
+    map_delete(tree);
+    return ret;
+}
+
+/* Walk the map in both directions, from either end or from a found element */
+static int test_map_iteration()
+{
+    int ret = 0;
+    map_t tree = map_init(int, int, map_cmp_int);
+    map_iter_t my_it;
+
+    map_first(tree, &my_it);
+    if (!map_at_end(tree, &my_it))
+        ret = 1;
+
+    int key[N_NODES];
+    for (int i = 0; i < N_NODES; i++)
+        key[i] = i * 2;
+    for (int i = 0; i < N_NODES; i++) {
+        int pos_a = rand() % N_NODES;
+        int pos_b = rand() % N_NODES;
+        swap(&key[pos_a], &key[pos_b]);
+    }
+    for (int i = 0; i < N_NODES; i++)
+        map_insert(tree, key + i, key + i);
+
+    int count = 0;
+    for (map_first(tree, &my_it); !map_at_end(tree, &my_it);
+         map_next(tree, &my_it)) {
+        if (map_iter_value(&my_it, int) != count * 2)
+            ret = 1;
+        count++;
+    }
+    if (count != N_NODES)
+        ret = 1;
+
+    count = 0;
+    for (map_last(tree, &my_it); !map_at_end(tree, &my_it);
+         map_prev(tree, &my_it)) {
+        if (map_iter_value(&my_it, int) != (N_NODES - 1 - count) * 2)
+            ret = 1;
+        count++;
+    }
+    if (count != N_NODES)
+        ret = 1;
+
+    /* step around the elements found by key */
+    for (int i = 0; i < N_NODES; i++) {
+        int k = key[i];
+        map_find(tree, &my_it, &k);
+        map_next(tree, &my_it);
+        if (k == (N_NODES - 1) * 2 ? !map_at_end(tree, &my_it)
+                                   : map_iter_value(&my_it, int) != k + 2)
+            ret = 1;
+        map_find(tree, &my_it, &k);
+        map_prev(tree, &my_it);
+        if (k == 0 ? !map_at_end(tree, &my_it)
+                   : map_iter_value(&my_it, int) != k - 2)
+            ret = 1;
+    }
+
+    map_delete(tree);
+    return ret;
+}
+
+/* Return the key pointed by the iterator, or -1 at the end */
+static int iter_key(map_t tree, map_iter_t *it)
+{
+    return map_at_end(tree, it) ? -1 : *(int *) it->node->key;
+}
+
+static bool sum_keys(void *key, void *data, void *ctx)
+{
+    (void) data;
+    *(int *) ctx += *(int *) key;
+    return true;
+}
+
+/* Lookups of the nearest elements on a map of the even numbers */
+static int test_map_bounds()
+{
+    int ret = 0;
+    map_t tree = map_init(int, int, map_cmp_int);
+    map_iter_t my_it;
+
+    int key[N_NODES];
+    for (int i = 0; i < N_NODES; i++)
+        key[i] = i * 2;
+    for (int i = 0; i < N_NODES; i++) {
+        int pos_a = rand() % N_NODES;
+        int pos_b = rand() % N_NODES;
+        swap(&key[pos_a], &key[pos_b]);
+    }
+    for (int i = 0; i < N_NODES; i++)
+        map_insert(tree, key + i, key + i);
+
+    const int max = (N_NODES - 1) * 2;
+    for (int x = -1; x <= max + 1; x++) {
+        int ceil = (x < 0) ? 0 : (x > max) ? -1 : (x + 1) / 2 * 2;
+        int higher = (x + 1 > max) ? -1 : (x < 0) ? 0 : (x + 2) / 2 * 2;
+        int floor = (x < 0) ? -1 : (x > max) ? max : x / 2 * 2;
+
+        map_lower_bound(tree, &my_it, &x);
+        if (iter_key(tree, &my_it) != ceil)
+            ret = 1;
+
+        /* the iteration goes on from a bound */
+        map_next(tree, &my_it);
+        if (ceil >= 0 &&
+            iter_key(tree, &my_it) != (ceil == max ? -1 : ceil + 2))
+            ret = 1;
+
+        map_ceil(tree, &my_it, &x);
+        if (iter_key(tree, &my_it) != ceil)
+            ret = 1;
+        map_upper_bound(tree, &my_it, &x);
+        if (iter_key(tree, &my_it) != higher)
+            ret = 1;
+        map_floor(tree, &my_it, &x);
+        if (iter_key(tree, &my_it) != floor)
+            ret = 1;
+
+        if (ret)
+            goto free_tree;
+    }
+
+    /* the keys in [lo, hi) */
+    for (int lo = -3; lo < 100; lo += 7) {
+        int hi = lo * 3 + 5, sum = 0, expect = 0;
+        for (int k = (lo < 0) ? 0 : (lo + 1) / 2 * 2; k < hi && k <= max;
+             k += 2)
+            expect += k;
+        map_range_foreach(tree, &lo, &hi, sum_keys, &sum);
+        if (sum != expect) {
+            ret = 1;
+            goto free_tree;
+        }
+    }
+
+    int sum = 0;
+    map_range_foreach(tree, NULL, NULL, sum_keys, &sum);
+    if (sum != N_NODES * (N_NODES - 1))
+        ret = 1;
+
+free_tree:
+    map_delete(tree);
+    return ret;
+}
+
+/* Removal by key, in random order, keeps the ends and the other keys */
+static int test_map_erase_key()
+{
+    int ret = 0;
+    map_t tree = map_init(int, int, map_cmp_int);
+    map_iter_t my_it;
+
+    int key[N_NODES];
+    for (int i = 0; i < N_NODES; i++)
+        key[i] = i * 2;
+    for (int i = 0; i < N_NODES; i++) {
+        int pos_a = rand() % N_NODES;
+        int pos_b = rand() % N_NODES;
+        swap(&key[pos_a], &key[pos_b]);
+    }
+    for (int i = 0; i < N_NODES; i++)
+        map_insert(tree, key + i, key + i);
+
+    /* odd keys are absent */
+    for (int x = -1; x < N_NODES * 2; x += 2) {
+        if (map_erase_key(tree, &x)) {
+            ret = 1;
+            goto free_tree;
+        }
+    }
+
+    int lo = 0, hi = (N_NODES - 1) * 2;
+    bool gone[N_NODES] = {false};
+    for (int i = 0; i < N_NODES; i++) {
+        if (!map_erase_key(tree, key + i) || map_erase_key(tree, key + i)) {
+            ret = 1;
+            goto free_tree;
+        }
+        gone[key[i] / 2] = true;
+        while (lo <= hi && gone[lo / 2])
+            lo += 2;
+        while (hi >= lo && gone[hi / 2])
+            hi -= 2;
+
+        map_first(tree, &my_it);
+        if (iter_key(tree, &my_it) != (lo <= hi ? lo : -1))
+            ret = 1;
+        map_last(tree, &my_it);
+        if (iter_key(tree, &my_it) != (lo <= hi ? hi : -1))
+            ret = 1;
+        if (ret)
+            goto free_tree;
+    }
+
+    if (!map_empty(tree))
+        ret = 1;
+
+free_tree:
+    map_delete(tree);
+    return ret;
+}
+
+/* Hinted insertions, in order and around stale hints, keep the map sorted */
+static int test_map_insert_hint()
+{
+    int ret = 0;
+    map_t tree = map_init(int, int, map_cmp_int);
+    map_iter_t my_it = {.node = NULL};
+
+    /* the odd keys descending, each hinted by the previous one */
+    for (int k = N_NODES * 2 - 1; k > 0; k -= 2) {
+        if (!map_insert_hint(tree, &my_it, &k, &k) ||
+            iter_key(tree, &my_it) != k) {
+            ret = 1;
+            goto free_tree;
+        }
+    }
+
+    /* the even keys ascending, hinted by the odd key next to them */
+    for (int k = 0; k < N_NODES * 2; k += 2) {
+        int near = (k % 4) ? k - 1 : k + 1;
+        map_find(tree, &my_it, &near);
+        if (!map_insert_hint(tree, &my_it, &k, &k) ||
+            iter_key(tree, &my_it) != k) {
+            ret = 1;
+            goto free_tree;
+        }
+    }
+
+    /* keys in the map are found from any hint */
+    for (int i = 0; i < N_NODES; i++) {
+        int k = rand() % (N_NODES * 2), v = -1;
+        if (map_insert_hint(tree, &my_it, &k, &v) ||
+            iter_key(tree, &my_it) != k || map_iter_value(&my_it, int) != k) {
+            ret = 1;
+            goto free_tree;
+        }
+    }
+
+    /* the hint keeps moving in order, and appends go past the end */
+    map_next(tree, &my_it);
+    for (int k = N_NODES * 2; k < N_NODES * 3; k++)
+        map_insert_hint(tree, &my_it, &k, &k);
+
+    int expect = 0;
+    for (map_first(tree, &my_it); !map_at_end(tree, &my_it);
+         map_next(tree, &my_it)) {
+        if (iter_key(tree, &my_it) != expect++) {
+            ret = 1;
+            break;
+        }
+    }
+    if (expect != N_NODES * 3)
+        ret = 1;
+
+free_tree:
+    map_delete(tree);
+    return ret;
+}
+
+/* Frozen snapshots find what the map held when frozen, with any key kind */
+static map_cmp_t cmp_u64(const void *arg0, const void *arg1)
+{
+    uint64_t a = *(const uint64_t *) arg0, b = *(const uint64_t *) arg1;
+    return (a < b) ? _CMP_LESS : (a > b) ? _CMP_GREATER : _CMP_EQUAL;
+}
+
+static int check_frozen(map_frozen_t fz, int lo, int hi, int step)
+{
+    for (int k = lo - step; k <= hi + step; k++) {
+        int *v = map_frozen_find(fz, &k);
+        bool in = k >= lo && k <= hi && (k - lo) % step == 0;
+        if (in ? (!v || *v != -k) : v != NULL)
+            return 1;
+    }
+    return 0;
+}
+
+static int test_map_freeze()
+{
+    int ret = 0;
+    map_t tree = map_init(int, int, map_cmp_int);
+
+    map_frozen_t fz = map_freeze(tree, MAP_KEY_INT32);
+    int x = 0;
+    if (map_frozen_find(fz, &x))
+        ret = 1;
+    map_frozen_delete(fz);
+
+    /* every third key in [-N_NODES, N_NODES], inserted in random order */
+    int key[N_NODES];
+    int n = 0;
+    for (int k = -N_NODES; k <= N_NODES && n < N_NODES; k += 3)
+        key[n++] = k;
+    for (int i = 0; i < n; i++) {
+        int pos_a = rand() % n;
+        int pos_b = rand() % n;
+        swap(&key[pos_a], &key[pos_b]);
+    }
+    for (int i = 0; i < n; i++) {
+        int v = -key[i];
+        map_insert(tree, key + i, &v);
+    }
+
+    map_frozen_t vec = map_freeze(tree, MAP_KEY_INT32);
+    map_frozen_t opaque = map_freeze(tree, MAP_KEY_OPAQUE);
+    /* the key kind does not match int, so the comparator is used */
+    map_frozen_t wrong = map_freeze(tree, MAP_KEY_INT64);
+    ret |= check_frozen(vec, -N_NODES, N_NODES - 1, 3);
+    ret |= check_frozen(opaque, -N_NODES, N_NODES - 1, 3);
+    ret |= check_frozen(wrong, -N_NODES, N_NODES - 1, 3);
+
+    /* the snapshots stay as they were while the map changes */
+    map_clear(tree);
+    for (int k = 0; k < 100; k++) {
+        int v = -k;
+        map_insert(tree, &k, &v);
+    }
+    ret |= check_frozen(vec, -N_NODES, N_NODES - 1, 3);
+    ret |= check_frozen(opaque, -N_NODES, N_NODES - 1, 3);
+    map_frozen_delete(vec);
+    map_frozen_delete(opaque);
+    map_frozen_delete(wrong);
+
+    /* and freezing again takes the changes */
+    vec = map_freeze(tree, MAP_KEY_INT32);
+    ret |= check_frozen(vec, 0, 99, 1);
+    map_frozen_delete(vec);
+    map_delete(tree);
+
+    /* unsigned keys keep their order above the top bit */
+    map_t wide = map_init(uint64_t, int, cmp_u64);
+    for (int i = 0; i < 1000; i++) {
+        uint64_t k = (uint64_t) i * (UINT64_MAX / 999);
+        map_insert(wide, &k, &i);
+    }
+    fz = map_freeze(wide, MAP_KEY_UINT64);
+    for (int i = 0; i < 1000; i++) {
+        uint64_t k = (uint64_t) i * (UINT64_MAX / 999);
+        int *v = map_frozen_find(fz, &k);
+        if (!v || *v != i)
+            ret = 1;
+        k += 1;
+        if (i < 999 && map_frozen_find(fz, &k))
+            ret = 1;
+    }
+    map_frozen_delete(fz);
+    map_delete(wide);
+
+    return ret;
+}
+
+/* The lookup cache never returns an erased element, and counts the lookups */
+static int test_map_cache()
+{
+    int ret = 0;
+    map_t tree = map_init(int, int, map_cmp_int);
+    map_iter_t my_it;
+    size_t hits, misses;
+
+    map_cache_enable(tree, 60);
+    for (int k = 0; k < N_NODES; k++)
+        map_insert(tree, &k, &k);
+
+    /* a hot key misses once, then hits */
+    int hot = 42;
+    for (int i = 0; i < 10; i++) {
+        map_find(tree, &my_it, &hot);
+        if (map_at_end(tree, &my_it) || map_iter_value(&my_it, int) != hot)
+            ret = 1;
+    }
+    map_cache_stats(tree, &hits, &misses);
+    if (hits != 9 || misses != 1)
+        ret = 1;
+
+    /* erased keys are not found, and inserting them again is seen */
+    for (int k = 0; k < N_NODES; k++) {
+        map_find(tree, &my_it, &k);
+        if (k % 2)
+            map_erase(tree, &my_it);
+        else
+            map_erase_key(tree, &k);
+        map_find(tree, &my_it, &k);
+        if (!map_at_end(tree, &my_it))
+            ret = 1;
+
+        int v = -k;
+        map_insert(tree, &k, &v);
+        map_find(tree, &my_it, &k);
+        if (map_at_end(tree, &my_it) || map_iter_value(&my_it, int) != v)
+            ret = 1;
+    }
+
+    /* and so are the keys of a cleared map */
+    map_clear(tree);
+    map_find(tree, &my_it, &hot);
+    if (!map_at_end(tree, &my_it))
+        ret = 1;
+
+    /* the map works the same once the cache is off */
+    map_cache_enable(tree, 0);
+    map_insert(tree, &hot, &hot);
+    map_find(tree, &my_it, &hot);
+    if (map_at_end(tree, &my_it))
+        ret = 1;
+    map_cache_stats(tree, &hits, &misses);
+    if (hits || misses)
+        ret = 1;
+
+    map_delete(tree);
+    return ret;
+}
+
+/* Batched lookups agree with one lookup at a time */
+static int test_map_find_batch()
+{
+    int ret = 0;
+    map_t tree = map_init(int, int, map_cmp_int);
+    map_iter_t *its = malloc(N_NODES * 2 * sizeof(map_iter_t));
+    map_iter_t my_it;
+
+    int key[N_NODES * 2];
+    for (int i = 0; i < N_NODES * 2; i++)
+        key[i] = rand() % (N_NODES * 2);
+
+    map_find_batch(tree, key, 3, its);
+    for (int i = 0; i < 3; i++) {
+        if (!map_at_end(tree, its + i))
+            ret = 1;
+    }
+
+    for (int k = 0; k < N_NODES * 2; k += 2)
+        map_insert(tree, &k, &k);
+
+    /* any count, fewer keys than lookups in flight included */
+    for (int n = 0; n <= N_NODES * 2; n += n < 40 ? 1 : N_NODES / 3) {
+        map_find_batch(tree, key, n, its);
+        for (int i = 0; i < n; i++) {
+            map_find(tree, &my_it, key + i);
+            if (its[i].node != my_it.node) {
+                ret = 1;
+                goto free_tree;
+            }
+        }
+    }
+
+    /* the iterators go on from the elements found */
+    map_find_batch(tree, key, N_NODES, its);
+    for (int i = 0; i < N_NODES; i++) {
+        if (map_at_end(tree, its + i))
+            continue;
+        map_next(tree, its + i);
+        int expect = key[i] + 2 < N_NODES * 2 ? key[i] + 2 : -1;
+        if (iter_key(tree, its + i) != expect) {
+            ret = 1;
+            break;
+        }
+    }
+
+free_tree:
+    free(its);
+    map_delete(tree);
+    return ret;
+}
+
+/* Check that the keys come in ascending order, and count them */
+typedef struct {
+    int last, count;
+    bool sorted;
+} walk_t;
+
+static bool walk_keys(void *key, void *data, void *ctx)
+{
+    walk_t *w = ctx;
+    if (w->count && *(int *) key <= w->last)
+        w->sorted = false;
+    if (*(int *) data != -*(int *) key)
+        w->sorted = false;
+    w->last = *(int *) key;
+    w->count++;
+    return true;
+}
+
+enum { N_WRITERS = 4 };
+
+typedef struct {
+    shardmap_t map;
+    int first;
+} writer_ctx_t;
+
+/* Insert the keys of the same residue modulo N_WRITERS, then erase half */
+static void *shard_writer(void *arg)
+{
+    writer_ctx_t *ctx = arg;
+    for (int k = ctx->first; k < N_NODES; k += N_WRITERS) {
+        int v = -k;
+        shardmap_insert(ctx->map, &k, &v);
+    }
+    for (int k = ctx->first; k < N_NODES; k += 2 * N_WRITERS)
+        shardmap_erase(ctx->map, &k);
+    return NULL;
+}
+
+/* Sharded maps keep every key in one shard, and walk all of them in order */
+static int test_shardmap()
+{
+    int ret = 0;
+    int routes[] = {SHARDMAP_HASH, 0, 4};
+
+    for (int r = 0; r < 3; r++) {
+        shardmap_t map = shardmap_init(7, routes[r], int, int, map_cmp_int);
+
+        int key[N_NODES];
+        for (int i = 0; i < N_NODES; i++)
+            key[i] = i - N_NODES / 2;
+        for (int i = 0; i < N_NODES; i++) {
+            int pos_a = rand() % N_NODES;
+            int pos_b = rand() % N_NODES;
+            swap(&key[pos_a], &key[pos_b]);
+        }
+        for (int i = 0; i < N_NODES; i++) {
+            int v = -key[i];
+            if (!shardmap_insert(map, key + i, &v) ||
+                shardmap_insert(map, key + i, &v))
+                ret = 1;
+        }
+        for (int i = 0; i < N_NODES; i += 2) {
+            if (!shardmap_erase(map, key + i) || shardmap_erase(map, key + i))
+                ret = 1;
+        }
+        for (int i = 0; i < N_NODES; i++) {
+            int v = 0;
+            bool found = shardmap_find(map, key + i, &v);
+            if (found != (i % 2 == 1) || (found && v != -key[i]))
+                ret = 1;
+        }
+
+        walk_t w = {.sorted = true};
+        shardmap_foreach(map, walk_keys, &w);
+        if (!w.sorted || w.count != N_NODES / 2)
+            ret = 1;
+
+        shardmap_clear(map);
+        if (!shardmap_empty(map))
+            ret = 1;
+        shardmap_delete(map);
+    }
+
+    /* writers on disjoint keys, sharing the shards */
+    shardmap_t map = shardmap_init(8, SHARDMAP_HASH, int, int, map_cmp_int);
+    pthread_t threads[N_WRITERS];
+    writer_ctx_t ctx[N_WRITERS];
+    for (int t = 0; t < N_WRITERS; t++) {
+        ctx[t] = (writer_ctx_t){.map = map, .first = t};
+        pthread_create(threads + t, NULL, shard_writer, ctx + t);
+    }
+    for (int t = 0; t < N_WRITERS; t++)
+        pthread_join(threads[t], NULL);
+
+    walk_t w = {.sorted = true};
+    shardmap_foreach(map, walk_keys, &w);
+    if (!w.sorted || w.count != N_NODES / 2)
+        ret = 1;
+    for (int k = 0; k < N_NODES; k++) {
+        if (shardmap_find(map, &k, NULL) != ((k / N_WRITERS) % 2 == 1))
+            ret = 1;
+    }
+    shardmap_delete(map);
+
+    return ret;
+}
+
+/* The statistics follow the elements, and the tree stays balanced */
+static int test_map_stats()
+{
+    int ret = 0;
+    map_t tree = map_init(int, int, map_cmp_int);
+    map_stats_t stats;
+
+    map_stats(tree, &stats);
+    if (stats.count || stats.height || stats.red || stats.black)
+        ret = 1;
+
+    int key[N_NODES];
+    for (int i = 0; i < N_NODES; i++)
+        key[i] = i;
+    for (int i = 0; i < N_NODES; i++) {
+        int pos_a = rand() % N_NODES;
+        int pos_b = rand() % N_NODES;
+        swap(&key[pos_a], &key[pos_b]);
+    }
+    for (int i = 0; i < N_NODES; i++)
+        map_insert(tree, key + i, key + i);
+
+    for (int round = 0; round < 2 && !ret; round++) {
+        size_t n = round ? N_NODES / 2 : N_NODES, bound = 0;
+        while (((size_t) 1 << bound) <= n)
+            bound++;
+        map_stats(tree, &stats);
+        if (stats.count != n || stats.red + stats.black != n ||
+            stats.key_bytes != n * sizeof(int) ||
+            stats.data_bytes != n * sizeof(int) ||
+            stats.heap_bytes < stats.node_bytes + stats.key_bytes +
+                                   stats.data_bytes ||
+            stats.height > 2 * bound || stats.avg_depth < 1 ||
+            stats.avg_depth > stats.height)
+            ret = 1;
+
+        for (int i = 0; i < N_NODES / 2; i++)
+            map_erase_key(tree, key + i);
+    }
+
+    map_clear(tree);
+    map_stats(tree, &stats);
+    if (stats.count || stats.height || stats.avg_depth != 0)
+        ret = 1;
+
+    map_delete(tree);
+    return ret;
+}
+
+/* Check that the odd keys below @n are dead and the even ones are there */
+static int check_lazy_erase(map_t tree, int n)
+{
+    map_iter_t it;
+    int expect = 0;
+
+    for (map_first(tree, &it); !map_at_end(tree, &it); map_next(tree, &it)) {
+        if (*(int *) it.node->key != expect)
+            return 1;
+        expect += 2;
+    }
+    if (expect != n || map_size(tree) != (size_t) n / 2)
+        return 1;
+
+    for (int i = 1; i < n; i += 2) {
+        map_find(tree, &it, &i);
+        if (!map_at_end(tree, &it))
+            return 1;
+        map_lower_bound(tree, &it, &i);
+        if (i + 1 < n && (map_at_end(tree, &it) ||
+                          *(int *) it.node->key != i + 1))
+            return 1;
+        map_floor(tree, &it, &i);
+        if (map_at_end(tree, &it) || *(int *) it.node->key != i - 1)
+            return 1;
+    }
+
+    map_last(tree, &it);
+    return map_at_end(tree, &it) || *(int *) it.node->key != n - 2;
+}
+
+static int test_map_lazy_erase()
+{
+    int ret = 0;
+    map_t tree = map_init(int, int, map_cmp_int);
+    map_stats_t stats;
+    map_iter_t it;
+
+    map_cache_enable(tree, 64);
+    map_lazy_enable(tree, 100);
+    int key[N_NODES];
+    for (int i = 0; i < N_NODES; i++)
+        key[i] = i;
+    for (int i = 0; i < N_NODES; i++) {
+        int pos_a = rand() % N_NODES;
+        int pos_b = rand() % N_NODES;
+        swap(&key[pos_a], &key[pos_b]);
+    }
+    for (int i = 0; i < N_NODES; i++)
+        map_insert(tree, key + i, key + i);
+
+    /* warm the cache up, then erase the odd keys both ways */
+    for (int i = 0; i < N_NODES; i++)
+        map_find(tree, &it, key + i);
+    for (int i = 0; i < N_NODES; i++) {
+        if (!(key[i] & 1))
+            continue;
+        if (i & 2) {
+            map_find(tree, &it, key + i);
+            map_erase(tree, &it);
+        } else if (!map_erase_key(tree, key + i)) {
+            ret = 1;
+        }
+    }
+    ret |= check_lazy_erase(tree, N_NODES);
+    map_stats(tree, &stats);
+    if (stats.count != N_NODES / 2 || stats.dead != N_NODES / 2 ||
+        stats.red + stats.black != N_NODES)
+        ret = 1;
+
+    /* a dead element is gone for good, until its key comes back */
+    int one = 1, two = 2, value = 42;
+    if (map_erase_key(tree, &one) || !map_insert(tree, &one, &value) ||
+        map_insert(tree, &two, &value))
+        ret = 1;
+    map_find(tree, &it, &one);
+    if (map_at_end(tree, &it) || *(int *) it.node->data != value ||
+        map_size(tree) != N_NODES / 2 + 1)
+        ret = 1;
+    map_erase_key(tree, &one);
+
+    map_compact(tree);
+    ret |= check_lazy_erase(tree, N_NODES);
+    map_stats(tree, &stats);
+    if (stats.dead || stats.red + stats.black != N_NODES / 2)
+        ret = 1;
+
+    /* the dead nodes never outgrow the threshold */
+    map_lazy_enable(tree, 25);
+    for (int i = 0; i < N_NODES; i += 2) {
+        map_erase_key(tree, &i);
+        map_stats(tree, &stats);
+        if (stats.dead * 100 > 25 * (stats.count + stats.dead))
+            ret = 1;
+    }
+    if (!map_empty(tree))
+        ret = 1;
+
+    /* back to removing the elements right away */
+    for (int i = 0; i < N_NODES; i++)
+        map_insert(tree, key + i, key + i);
+    for (int i = 1; i < N_NODES; i += 2)
+        map_erase_key(tree, &i);
+    map_lazy_enable(tree, 0);
+    map_stats(tree, &stats);
+    if (stats.dead || stats.red + stats.black != N_NODES / 2)
+        ret = 1;
+    map_erase_key(tree, &two);
+    map_stats(tree, &stats);
+    if (stats.dead || stats.count != N_NODES / 2 - 1)
+        ret = 1;
+
+    map_delete(tree);
+    return ret;
+}
+
+/* Check that @tree holds the keys i set in @present, in order, and that it
+ * stays balanced.
+ */
+static int check_present(map_t tree, const bool *present)
+{
+    map_iter_t it;
+    map_stats_t stats;
+    size_t count = 0, bound = 0;
+    int i = 0;
+
+    for (map_first(tree, &it); !map_at_end(tree, &it); map_next(tree, &it)) {
+        while (i < N_NODES && !present[i])
+            i++;
+        if (i == N_NODES || *(int *) it.node->key != i++)
+            return 1;
+        count++;
+    }
+    while (i < N_NODES && !present[i])
+        i++;
+
+    while (((size_t) 1 << bound) <= count)
+        bound++;
+    map_stats(tree, &stats);
+    return i != N_NODES || map_size(tree) != count ||
+           stats.red + stats.black != count || stats.height > 2 * bound;
+}
+
+static int test_map_split_join()
+{
+    int ret = 0;
+    map_t tree = map_init(int, int, map_cmp_int);
+    static bool present[N_NODES], right_present[N_NODES];
+    int key[N_NODES];
+
+    for (int i = 0; i < N_NODES; i++)
+        key[i] = i;
+    for (int i = 0; i < N_NODES; i++) {
+        int pos_a = rand() % N_NODES;
+        int pos_b = rand() % N_NODES;
+        swap(&key[pos_a], &key[pos_b]);
+    }
+    for (int i = 0; i < N_NODES; i++) {
+        map_insert(tree, key + i, key + i);
+        present[i] = true;
+    }
+
+    /* ranges of all lengths, open on either side at times */
+    for (int round = 0; round < 100; round++) {
+        int lo = rand() % N_NODES, hi = lo + rand() % (round < 50 ? 64 : 2000);
+        void *lo_key = (round % 10 == 1) ? NULL : &lo;
+        void *hi_key = (round % 10 == 2) ? NULL : &hi;
+        size_t expected = 0;
+        for (int i = lo_key ? lo : 0; i < N_NODES && (!hi_key || i < hi); i++) {
+            expected += present[i];
+            present[i] = false;
+        }
+        if (map_erase_range(tree, lo_key, hi_key) != expected)
+            ret = 1;
+        ret |= check_present(tree, present);
+
+        for (int i = 0; i < 20; i++) {
+            int k = rand() % N_NODES;
+            map_insert(tree, &k, &k);
+            present[k] = true;
+        }
+    }
+    int two = 2, one = 1;
+    if (map_erase_range(tree, &two, &one))
+        ret = 1;
+
+    /* the right part outlives the left one, and joins another map */
+    map_t right;
+    int middle = N_NODES / 2;
+    map_split(tree, &middle, &right);
+    for (int i = 0; i < N_NODES; i++) {
+        right_present[i] = i >= middle && present[i];
+        present[i] = present[i] && i < middle;
+    }
+    ret |= check_present(tree, present);
+    ret |= check_present(right, right_present);
+    if (map_join(right, tree))
+        ret = 1;
+
+    map_t other = map_init(int, int, map_cmp_int);
+    for (int i = 0; i < middle; i++) {
+        if (present[i])
+            map_insert(other, &i, &i);
+    }
+    map_delete(tree);
+    if (!map_join(other, right) || !map_empty(right))
+        ret = 1;
+    for (int i = 0; i < N_NODES; i++)
+        present[i] = present[i] || right_present[i];
+    ret |= check_present(other, present);
+
+    /* both keep working on their own */
+    for (int i = 0; i < N_NODES; i += 3) {
+        map_insert(right, &i, &i);
+        map_erase_key(other, &i);
+        present[i] = false;
+    }
+    ret |= check_present(other, present);
+    if (map_size(right) != (N_NODES + 2) / 3)
+        ret = 1;
+
+    map_delete(right);
+    map_delete(other);
+    return ret;
+}
+
+#ifdef MAP_ORDER_STATS
+/* Check the ranks in a map of the keys 2 * i, for the i set in @present */
+static int check_order_stats(map_t tree, const bool *present)
+{
+    map_iter_t it;
+    size_t rank = 0;
+
+    for (int i = 0; i < N_NODES; i++) {
+        int even = 2 * i, odd = 2 * i + 1;
+        if (map_rank(tree, &even) != rank)
+            return 1;
+        if (!present[i])
+            continue;
+        map_select(tree, &it, rank++);
+        if (map_at_end(tree, &it) || *(int *) it.node->key != even ||
+            map_rank(tree, &odd) != rank)
+            return 1;
+    }
+
+    map_select(tree, &it, rank);
+    return !map_at_end(tree, &it) || map_size(tree) != rank;
+}
+
+static int test_map_order_stats()
+{
+    int ret = 0;
+    map_t tree = map_init(int, int, map_cmp_int);
+    static bool present[N_NODES];
+    int key[N_NODES];
+
+    for (int i = 0; i < N_NODES; i++)
+        key[i] = 2 * i;
+    for (int i = 0; i < N_NODES; i++) {
+        int pos_a = rand() % N_NODES;
+        int pos_b = rand() % N_NODES;
+        swap(&key[pos_a], &key[pos_b]);
+    }
+    for (int i = 0; i < N_NODES; i++) {
+        map_insert(tree, key + i, NULL);
+        present[key[i] / 2] = true;
+    }
+    ret |= check_order_stats(tree, present);
+
+    for (int i = 0; i < N_NODES / 2; i++) {
+        map_erase_key(tree, key + i);
+        present[key[i] / 2] = false;
+    }
+    ret |= check_order_stats(tree, present);
+
+    /* the iterator of a selected element moves on like any other */
+    map_iter_t it;
+    size_t count = 0;
+    for (map_select(tree, &it, map_size(tree) / 2); !map_at_end(tree, &it);
+         map_next(tree, &it))
+        count++;
+    if (count != map_size(tree) - map_size(tree) / 2)
+        ret = 1;
+
+    /* a bulk load, then insertions past the greatest element */
+    map_clear(tree);
+    for (int i = 0; i < N_NODES; i++) {
+        key[i] = 2 * i;
+        present[i] = true;
+    }
+    map_build_sorted(tree, key, NULL, N_NODES / 2);
+    for (int i = N_NODES / 2; i < N_NODES; i++)
+        map_insert(tree, key + i, NULL);
+    ret |= check_order_stats(tree, present);
+
+    map_delete(tree);
+    return ret;
+}
+#endif
+
+#ifdef MAP_INTERVALS
+enum { N_RANGES = 2000, N_QUERIES = 500, SPACE = 40000 };
+
+/* The elements found by map_overlap_foreach(), in their order */
+typedef struct {
+    map_interval_t found[N_RANGES];
+    int count;
+} overlap_t;
+
+static bool collect_overlap(void *key, void *data, void *ctx)
+{
+    overlap_t *o = ctx;
+    (void) data;
+    o->found[o->count++] = *(map_interval_t *) key;
+    return true;
+}
+
+/* Compare map_overlap_foreach() with a scan of the ranges set in @present */
+static int check_overlaps(map_t tree,
+                          const map_interval_t *ranges,
+                          const bool *present)
+{
+    static overlap_t o;
+
+    for (int q = 0; q < N_QUERIES; q++) {
+        uint64_t lo = rand() % SPACE, hi = lo + 1 + rand() % 200;
+        int expected = 0;
+
+        o.count = 0;
+        map_overlap_foreach(tree, lo, hi, collect_overlap, &o);
+        for (int i = 0; i < N_RANGES; i++)
+            expected += present[i] && ranges[i].start < hi &&
+                        ranges[i].end > lo;
+        if (o.count != expected)
+            return 1;
+        for (int i = 0; i < o.count; i++) {
+            if (o.found[i].start >= hi || o.found[i].end <= lo ||
+                (i && map_cmp_interval(o.found + i - 1, o.found + i) !=
+                          _CMP_LESS))
+                return 1;
+        }
+    }
+    return 0;
+}
+
+static int test_map_intervals()
+{
+    int ret = 0;
+    map_t tree = map_init(map_interval_t, int, map_cmp_interval);
+    static map_interval_t ranges[N_RANGES];
+    static bool present[N_RANGES];
+
+    /* short ranges, and a few long ones over them */
+    for (int i = 0; i < N_RANGES; i++) {
+        ranges[i].start = rand() % SPACE;
+        ranges[i].end = ranges[i].start + 1 + rand() % (i % 10 ? 50 : 2000);
+        present[i] = map_insert(tree, ranges + i, &i);
+    }
+    ret |= check_overlaps(tree, ranges, present);
+
+    for (int i = 0; i < N_RANGES; i += 2) {
+        if (present[i])
+            map_erase_key(tree, ranges + i);
+        present[i] = false;
+    }
+    ret |= check_overlaps(tree, ranges, present);
+
+    /* an empty window finds nothing */
+    overlap_t o = {.count = 0};
+    map_overlap_foreach(tree, 100, 100, collect_overlap, &o);
+    if (o.count)
+        ret = 1;
+
+    map_delete(tree);
+    return ret;
+}
+#endif
+
 int main(int argc, char *argv[])
 {
     (void) argc;
@@ -109,6 +1322,27 @@ int main(int argc, char *argv[])
 
     srand((unsigned) time(NULL));
     int ret = test_map_mixed_operations();
+    ret |= test_map_clear_reuse();
+    ret |= test_map_build_sorted();
+    ret |= test_map_insert_or_get();
+    ret |= test_map_iteration();
+    ret |= test_map_bounds();
+    ret |= test_map_erase_key();
+    ret |= test_map_insert_hint();
+    ret |= test_map_freeze();
+    ret |= test_map_cache();
+    ret |= test_map_find_batch();
+    ret |= test_shardmap();
+    ret |= test_map_typed();
+    ret |= test_map_stats();
+    ret |= test_map_lazy_erase();
+    ret |= test_map_split_join();
+#ifdef MAP_ORDER_STATS
+    ret |= test_map_order_stats();
+#endif
+#ifdef MAP_INTERVALS
+    ret |= test_map_intervals();
+#endif
     printf("%s", (ret == 0) ? "PASS" : "FAIL");
     return ret;
 }
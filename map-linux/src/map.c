@@ -9,6 +9,7 @@
 #include <string.h>
 
 #include "map.h"
+#include "slab.h"
 
 struct map_internal {
     struct map_node *head;
@@ -19,10 +20,24 @@ struct map_internal {
     map_iter_t it_end, it_most, it_least;
 
     int (*comparator)(const void *, const void *);
+
+    /* Nodes, along with their keys and values, are carved from the slab */
+    slab_t slab;
 };
 
 typedef enum { RB_RED = 0, RB_BLACK } map_color_t;
 
+/*
+ * The key and the data are laid out right after the node. Both are rounded
+ * up to this alignment so that the data following the key is aligned.
+ */
+#define MAP_ALIGN sizeof(uint64_t)
+
+static inline size_t map_align(size_t size)
+{
+    return (size + MAP_ALIGN - 1) & ~(MAP_ALIGN - 1);
+}
+
 /*
  * Get parent of node
  * @node: pointer to the rb node
@@ -89,17 +104,82 @@ static inline bool rb_is_red(map_node_t *node)
     return node && (rb_color(node) == RB_RED);
 }
 
+#ifdef MAP_ORDER_STATS
+static inline size_t rb_size(const map_node_t *node)
+{
+    return node ? node->size : 0;
+}
+#endif
+
+#ifdef MAP_INTERVALS
+static inline uint64_t rb_max_end(const map_node_t *node)
+{
+    return node ? node->max_end : 0;
+}
+#endif
+
+/*
+ * Recompute the summary of the subtree of "node" from its children: the
+ * number of its elements with MAP_ORDER_STATS, and the greatest end of their
+ * ranges with MAP_INTERVALS. Without either, there is nothing to maintain.
+ */
+static inline void rb_update(map_node_t *node UNUSED)
+{
+#ifdef MAP_ORDER_STATS
+    node->size = 1 + rb_size(node->left) + rb_size(node->right);
+#endif
+#ifdef MAP_INTERVALS
+    uint64_t end = ((const map_interval_t *) node->key)->end;
+    if (rb_max_end(node->left) > end)
+        end = rb_max_end(node->left);
+    if (rb_max_end(node->right) > end)
+        end = rb_max_end(node->right);
+    node->max_end = end;
+#endif
+}
+
+/*
+ * Account for the element of "node", which was just linked, in the summaries
+ * of its ancestors.
+ */
+static inline void rb_link_update(map_node_t *node UNUSED)
+{
+#if defined(MAP_ORDER_STATS) || defined(MAP_INTERVALS)
+    for (map_node_t *p = rb_parent(node); p; p = rb_parent(p)) {
+#ifdef MAP_ORDER_STATS
+        p->size++;
+#endif
+#ifdef MAP_INTERVALS
+        if (p->max_end < node->max_end)
+            p->max_end = node->max_end;
+#endif
+    }
+#endif
+}
+
+/*
+ * Recompute the summaries of "node" and of its ancestors, from the bottom
+ * up, once an element below them was unlinked.
+ */
+static inline void rb_unlink_update(map_node_t *node UNUSED)
+{
+#if defined(MAP_ORDER_STATS) || defined(MAP_INTERVALS)
+    for (; node; node = rb_parent(node))
+        rb_update(node);
+#endif
+}
+
 /* Create a node to be attached in the map internal tree structure */
-static map_node_t *map_create_node(void *key,
-                                   void *value,
-                                   size_t ksize,
-                                   size_t vsize)
+static map_node_t *map_create_node(map_t obj, void *key, void *value)
 {
-    map_node_t *node = malloc(sizeof(struct map_node));
+    /* The slab hands out the node along with the storage of the keys and
+     * values.
+     */
+    map_node_t *node = slab_alloc(&obj->slab);
+    size_t ksize = obj->key_size, vsize = obj->element_size;
 
-    /* Allocate memory for the keys and values */
-    node->key = malloc(ksize);
-    node->data = malloc(vsize);
+    node->key = node + 1;
+    node->data = (char *) node->key + map_align(ksize);
 
     /* Setup the pointers */
     node->left = node->right = NULL;
@@ -123,14 +203,13 @@ static map_node_t *map_create_node(void *key,
     else
         memcpy(node->data, value, vsize);
 
+    rb_update(node);
     return node;
 }
 
-static void map_delete_node(map_t obj UNUSED, map_node_t *node)
+static void map_delete_node(map_t obj, map_node_t *node)
 {
-    free(node->key);
-    free(node->data);
-    free(node);
+    slab_free(&obj->slab, node);
 }
 
 /*
@@ -169,6 +248,10 @@ static map_node_t *map_rotate_left(map_t obj, map_node_t *node)
     if (node == obj->head)
         obj->head = r;
 
+    /* Only the subtrees of the two nodes changed, the lower one first */
+    rb_update(node);
+    rb_update(r);
+
     return r;
 }
 
@@ -208,6 +291,10 @@ static map_node_t *map_rotate_right(map_t obj, map_node_t *node)
     if (node == obj->head)
         obj->head = l;
 
+    /* Only the subtrees of the two nodes changed, the lower one first */
+    rb_update(node);
+    rb_update(l);
+
     return l;
 }
 
@@ -433,20 +520,87 @@ static void map_delete_fixup(map_t obj,
     rb_set_color(node, RB_BLACK);
 }
 
+/* State of a bulk-load: the sorted elements and the next one to be placed */
+typedef struct {
+    map_t obj;
+    char *keys, *values;
+    size_t next;
+} map_build_t;
+
 /*
- * Recursive wrapper for deleting nodes in a graph at an accelerated pace.
- * Skips rotations. Just aggressively goes through all nodes and deletes.
+ * The subtrees are built as 2-3 trees: every black node has either no red
+ * child, or a single red left child. The largest subtree of the given black
+ * height thus holds 3^height - 1 elements. Saturate instead of overflowing.
  */
-static void map_clear_nested(map_t obj, map_node_t *node)
+static size_t map_build_max_size(unsigned height)
 {
-    /* Free children */
-    if (node->left)
-        map_clear_nested(obj, node->left);
-    if (node->right)
-        map_clear_nested(obj, node->right);
+    size_t size = 1;
+    while (height--) {
+        if (size > SIZE_MAX / 3)
+            return SIZE_MAX;
+        size *= 3;
+    }
+    return size - 1;
+}
 
-    /* Free self */
-    map_delete_node(obj, node);
+/* Create the node of the next element in order */
+static map_node_t *map_build_node(map_build_t *b, map_color_t color)
+{
+    map_t obj = b->obj;
+    void *key = b->keys + b->next * obj->key_size;
+    void *value = b->values ? b->values + b->next * obj->element_size : NULL;
+
+    assert(!b->next ||
+           obj->comparator((char *) key - obj->key_size, key) < 0);
+    b->next++;
+
+    map_node_t *node = map_create_node(obj, key, value);
+    rb_set_color(node, color);
+    return node;
+}
+
+static void map_build_link(map_node_t *node,
+                           map_node_t *left,
+                           map_node_t *right)
+{
+    node->left = left;
+    node->right = right;
+    if (left)
+        rb_set_parent(left, node);
+    if (right)
+        rb_set_parent(right, node);
+    rb_update(node);
+}
+
+/*
+ * Build a subtree of @n elements whose black height is @height, creating the
+ * nodes in order. A subtree of black height h holds at least 2^h - 1
+ * elements, when all of its nodes are black. The elements are spread evenly
+ * among the children of the root, and the root only gets a red left child
+ * when two black children cannot hold them all.
+ */
+static map_node_t *map_build_subtree(map_build_t *b, size_t n, unsigned height)
+{
+    if (!n)
+        return NULL;
+
+    assert(height);
+    if (n <= 2 * map_build_max_size(height - 1) + 1) {
+        map_node_t *left = map_build_subtree(b, (n - 1) / 2, height - 1);
+        map_node_t *node = map_build_node(b, RB_BLACK);
+        map_build_link(node, left, map_build_subtree(b, n / 2, height - 1));
+        return node;
+    }
+
+    size_t n_left = (n - 2) / 3, n_mid = (n - 1) / 3;
+    map_node_t *left = map_build_subtree(b, n_left, height - 1);
+    map_node_t *red = map_build_node(b, RB_RED);
+    map_build_link(red, left, map_build_subtree(b, n_mid, height - 1));
+
+    map_node_t *node = map_build_node(b, RB_BLACK);
+    map_build_link(node, red,
+                   map_build_subtree(b, n - 2 - n_left - n_mid, height - 1));
+    return node;
 }
 
 /*
@@ -501,53 +655,236 @@ map_t map_new(size_t s1, size_t s2, int (*cmp)(const void *, const void *))
     obj->it_most.prev = obj->it_most.node = NULL;
     obj->it_most.node = NULL;
 
+    slab_init(&obj->slab, sizeof(struct map_node) + map_align(s1) +
+                              map_align(s2));
+
     return obj;
 }
 
+/*
+ * Fill an empty map with "n" elements whose keys are sorted in ascending
+ * order, in linear time. "keys" and "values" are arrays of elements of the key
+ * and the element size, and "values" may be NULL to leave the elements blank.
+ * Return false if the map was not empty.
+ */
+bool map_build_sorted(map_t obj, void *keys, void *values, size_t n)
+{
+    if (obj->head)
+        return false;
+
+    /* The tree of black nodes only is the shortest one that can be built */
+    unsigned height = 0;
+    while (height + 1 < sizeof(size_t) * 8 && (n + 1) >> (height + 1))
+        height++;
+
+    map_build_t b = {.obj = obj, .keys = keys, .values = values, .next = 0};
+    obj->head = map_build_subtree(&b, n, height);
+    assert(b.next == n);
+
+    obj->size = n;
+    map_calibrate(obj);
+    return true;
+}
+
+/*
+ * Attach "node" to the tree at the link "indirect" of "parent", which the
+ * caller found free, and rebalance. Rotations move no element, so the least
+ * and the greatest elements only change when "node" hangs off them.
+ */
+static void map_link_node(map_t obj,
+                          map_node_t *parent,
+                          map_node_t **indirect,
+                          map_node_t *node)
+{
+    *indirect = node;
+    rb_set_parent(node, parent);
+    rb_link_update(node);
+    obj->size++;
+
+    if (!parent ||
+        (indirect == &parent->left && parent == obj->it_least.node))
+        obj->it_least.node = node;
+    if (!parent ||
+        (indirect == &parent->right && parent == obj->it_most.node))
+        obj->it_most.node = node;
+
+    map_fix_colors(obj, node);
+}
+
 /*
  * Insert a key/value pair into the map. The value can be blank. If so,
  * it is filled with 0's, as defined in "map_create_node".
  */
 bool map_insert(map_t obj, void *key, void *value)
 {
-    /* Copy the key and value into new node and prepare it to put into tree. */
-    map_node_t *new_node =
-        map_create_node(key, value, obj->key_size, obj->element_size);
+    map_iter_t it;
+    return map_insert_or_get(obj, &it, key, value);
+}
 
-    obj->size++;
+/*
+ * Descend from the link "*indirect" of "*parent" towards "key". Return the
+ * node of "key" if any. Otherwise, "*parent" and "*indirect" are left at the
+ * free link where "key" belongs.
+ */
+static map_node_t *map_search_link(map_t obj,
+                                   void *key,
+                                   map_node_t **parent,
+                                   map_node_t ***indirect)
+{
+    /* Traverse the tree until we hit the end or find a side that is NULL */
+    while (**indirect) {
+        int res = obj->comparator(key, (**indirect)->key);
+        if (res == 0) /* If the key matches something, don't insert */
+            return **indirect;
+        *parent = **indirect;
+        *indirect = res < 0 ? &(*parent)->left : &(*parent)->right;
+    }
+    return NULL;
+}
 
-    if (!obj->head) {
-        /* Just insert the node in as the new head. */
-        obj->head = new_node;
-        rb_set_color(obj->head, RB_BLACK);
+/*
+ * Point "it" to the element of "key", inserting it with "value" if it is not
+ * in the map yet. The tree is only descended once, and nothing is allocated
+ * when the key is found. Return true if the element was inserted.
+ */
+bool map_insert_or_get(map_t obj, map_iter_t *it, void *key, void *value)
+{
+    map_node_t **indirect = &obj->head;
+    map_node_t *parent = NULL;
 
-        /* Calibrate the tree to properly assign pointers. */
-        map_calibrate(obj);
-        return true;
+    it->prev = NULL;
+
+    /* A key past the greatest element is appended right below it */
+    map_node_t *most = obj->it_most.node;
+    if (most && obj->comparator(key, most->key) > 0) {
+        parent = most;
+        indirect = &most->right;
     }
 
-    /* Traverse the tree until we hit the end or find a side that is NULL */
-    map_node_t **indirect = &obj->head;
-    map_node_t *parent = obj->head;
+    it->node = map_search_link(obj, key, &parent, &indirect);
+    if (it->node)
+        return false;
 
-    while (*indirect) {
-        int res = obj->comparator(new_node->key, (*indirect)->key);
-        if (res == 0) { /* If the key matches something, don't insert */
-            map_delete_node(obj, new_node);
-            return false;
+    /* Copy the key and value into new node and prepare it to put into tree. */
+    it->node = map_create_node(obj, key, value);
+    map_link_node(obj, parent, indirect, it->node);
+    return true;
+}
+
+/*
+ * Insert the key/value pair like map_insert_or_get(), but search from the
+ * element of "it" instead of the head. The search climbs from the hint only
+ * as far as needed, so a hint next to the position of "key", such as the
+ * element inserted last while the keys come in order, makes the insertion
+ * take amortized constant time apart from rebalancing. A farther hint is
+ * slower, never wrong. On return, "it" points to the element of "key", ready
+ * to hint the next insertion.
+ */
+bool map_insert_hint(map_t obj, map_iter_t *it, void *key, void *value)
+{
+    map_node_t *node = it->node;
+    if (!node)
+        return map_insert_or_get(obj, it, key, value);
+
+    it->prev = NULL;
+    int res = obj->comparator(key, node->key);
+    while (res != 0) {
+        /* Nothing bounds the subtree of an end on the side past it */
+        if (node == (res < 0 ? obj->it_least.node : obj->it_most.node))
+            break;
+
+        /* The nearest ancestor on the side of "key" bounds the subtree */
+        map_node_t *child = node, *bound = rb_parent(node);
+        while (bound && child == (res < 0 ? bound->left : bound->right)) {
+            child = bound;
+            bound = rb_parent(bound);
         }
-        parent = *indirect;
-        indirect = res < 0 ? &(*indirect)->left : &(*indirect)->right;
+        if (!bound)
+            break;
+
+        int res_bound = obj->comparator(key, bound->key);
+        if (res_bound != 0 && (res_bound < 0) != (res < 0))
+            break;
+        node = bound;
+        res = res_bound;
+    }
+    if (res == 0) {
+        it->node = node;
+        return false;
     }
 
-    *indirect = new_node;
-    rb_set_parent(new_node, parent);
-    map_fix_colors(obj, new_node);
-    map_calibrate(obj);
+    /* "key" belongs to the subtree of "node", on its side */
+    map_node_t *parent = node;
+    map_node_t **indirect = res < 0 ? &node->left : &node->right;
+    it->node = map_search_link(obj, key, &parent, &indirect);
+    if (it->node)
+        return false;
+
+    it->node = map_create_node(obj, key, value);
+    map_link_node(obj, parent, indirect, it->node);
     return true;
 }
 
-static void map_prev(map_t obj, map_iter_t *it)
+/*
+ * Insert the key/value pair, or overwrite the value in place if "key" is in
+ * the map already. Return true if the pair was inserted.
+ */
+bool map_upsert(map_t obj, void *key, void *value)
+{
+    map_iter_t it;
+    if (map_insert_or_get(obj, &it, key, value))
+        return true;
+
+    if (!value)
+        memset(it.node->data, 0, obj->element_size);
+    else
+        memcpy(it.node->data, value, obj->element_size);
+    return false;
+}
+
+/* Point "it" to the least element, or to the end if the map is empty */
+void map_first(map_t obj, map_iter_t *it)
+{
+    it->prev = NULL;
+    it->node = obj->it_least.node;
+}
+
+/* Point "it" to the greatest element, or to the end if the map is empty */
+void map_last(map_t obj, map_iter_t *it)
+{
+    it->prev = NULL;
+    it->node = obj->it_most.node;
+}
+
+/* Move "it" to the next element in order */
+void map_next(map_t obj, map_iter_t *it)
+{
+    /* We have hit the end or null node. */
+    if (!it->node || it->node == obj->it_most.node) {
+        it->prev = it->node = NULL;
+        return;
+    }
+
+    if (it->node->right) { /* To the right, as far left as possible */
+        for (it->node = it->node->right; it->node->left;
+             it->node = it->node->left)
+            it->prev = it->node;
+        return;
+    }
+
+    /* If there is no right child, keep going up until there is a right child */
+    it->prev = it->node;
+    it->node = rb_parent(it->node);
+
+    while (rb_parent(it->node) && it->node->right &&
+           (it->node->right == it->prev)) {
+        it->prev = it->node;
+        it->node = rb_parent(it->node);
+    }
+}
+
+/* Move "it" to the previous element in order */
+void map_prev(map_t obj, map_iter_t *it)
 {
     /* We have hit the end or null node. */
     if (!it->node || it->node == obj->it_least.node) {
@@ -603,17 +940,239 @@ void map_find(map_t obj, map_iter_t *it, void *key)
     it->prev = tmp.node;
 }
 
+/*
+ * Point "it" to the first element whose key is greater than (or equal to, if
+ * not "strict") "key", or to the last element whose key is less than (or
+ * equal to) "key" if not "forward".
+ */
+static void map_bound(map_t obj,
+                      map_iter_t *it,
+                      void *key,
+                      bool forward,
+                      bool strict)
+{
+    map_node_t *node = obj->head;
+
+    it->prev = it->node = NULL;
+    while (node) {
+        int res = obj->comparator(key, node->key);
+        if (res == 0 && !strict) {
+            it->node = node;
+            return;
+        }
+
+        /* An equal key here is only met by a strict bound, and skipped */
+        if (res == 0 || (forward ? res > 0 : res < 0)) {
+            node = forward ? node->right : node->left;
+            continue;
+        }
+
+        /* A candidate, but a closer one may sit in the subtree towards key */
+        it->node = node;
+        node = forward ? node->left : node->right;
+    }
+}
+
+/* First element whose key is not less than "key" */
+void map_lower_bound(map_t obj, map_iter_t *it, void *key)
+{
+    map_bound(obj, it, key, true, false);
+}
+
+/* First element whose key is greater than "key" */
+void map_upper_bound(map_t obj, map_iter_t *it, void *key)
+{
+    map_bound(obj, it, key, true, true);
+}
+
+/* Last element whose key is not greater than "key" */
+void map_floor(map_t obj, map_iter_t *it, void *key)
+{
+    map_bound(obj, it, key, false, false);
+}
+
+/* First element whose key is not less than "key", like map_lower_bound() */
+void map_ceil(map_t obj, map_iter_t *it, void *key)
+{
+    map_bound(obj, it, key, true, false);
+}
+
 bool map_empty(map_t obj)
 {
     return (obj->size == 0);
 }
 
+size_t map_size(map_t obj)
+{
+    return obj->size;
+}
+
+#ifdef MAP_ORDER_STATS
+/*
+ * Count the elements whose keys are less than "key", adding up the left
+ * subtrees of the descent.
+ */
+size_t map_rank(map_t obj, void *key)
+{
+    map_node_t *node = obj->head;
+    size_t rank = 0;
+
+    while (node) {
+        int res = obj->comparator(key, node->key);
+        if (res < 0) {
+            node = node->left;
+            continue;
+        }
+        rank += rb_size(node->left);
+        if (res == 0)
+            break;
+        rank++;
+        node = node->right;
+    }
+    return rank;
+}
+
+/*
+ * Point "it" to the element of rank "k", counting from 0, or to the end if
+ * the map holds no more than "k" elements.
+ */
+void map_select(map_t obj, map_iter_t *it, size_t k)
+{
+    map_node_t *node = obj->head;
+
+    it->node = it->prev = NULL;
+    if (k >= obj->size)
+        return;
+
+    for (;;) {
+        size_t left = rb_size(node->left);
+        if (k == left)
+            break;
+        if (k < left) {
+            node = node->left;
+        } else {
+            k -= left + 1;
+            node = node->right;
+        }
+    }
+    it->node = node;
+
+    /* Generate a "prev" as well, like map_find() */
+    map_iter_t tmp = *it;
+    map_prev(obj, &tmp);
+    it->prev = tmp.node;
+}
+#endif
+
+/* Add the nodes of the subtree of @node, @depth nodes below the root, to
+ * @stats, and their depths to @depths.
+ */
+static void map_stats_walk(const map_node_t *node,
+                           size_t depth,
+                           map_stats_t *stats,
+                           size_t *depths)
+{
+    for (; node; node = node->right) {
+        *depths += ++depth;
+        if (depth > stats->height)
+            stats->height = depth;
+        if (rb_color(node) == RB_RED)
+            stats->red++;
+        else
+            stats->black++;
+        map_stats_walk(node->left, depth, stats, depths);
+    }
+}
+
+void map_stats(map_t obj, map_stats_t *stats)
+{
+    size_t depths = 0;
+
+    memset(stats, 0, sizeof(*stats));
+    stats->count = obj->size;
+    stats->node_bytes = obj->size * sizeof(map_node_t);
+    stats->key_bytes = obj->size * obj->key_size;
+    stats->data_bytes = obj->size * obj->element_size;
+    stats->heap_bytes =
+        sizeof(struct map_internal) + slab_footprint(&obj->slab);
+
+    map_stats_walk(obj->head, 0, stats, &depths);
+    assert(stats->red + stats->black == obj->size);
+    if (obj->size)
+        stats->avg_depth = (double) depths / obj->size;
+}
+
 /* Return true if at the the end of the map */
 bool map_at_end(map_t obj UNUSED, map_iter_t *it)
 {
     return (it->node == NULL);
 }
 
+/*
+ * Call "cb" on the elements whose keys lie in ["lo", "hi") in order, until it
+ * returns false. A NULL bound leaves that side of the range open. Only the
+ * elements in the range are visited, after a single descent to "lo".
+ */
+void map_range_foreach(map_t obj,
+                       void *lo,
+                       void *hi,
+                       bool (*cb)(void *key, void *data, void *ctx),
+                       void *ctx)
+{
+    map_iter_t it;
+
+    if (lo)
+        map_lower_bound(obj, &it, lo);
+    else
+        map_first(obj, &it);
+
+    for (; it.node; map_next(obj, &it)) {
+        if (hi && obj->comparator(it.node->key, hi) >= 0)
+            break;
+        if (!cb(it.node->key, it.node->data, ctx))
+            break;
+    }
+}
+
+#ifdef MAP_INTERVALS
+/*
+ * Walk the subtree of "node" for map_overlap_foreach(), recursing on the left
+ * and looping on the right. Return false once "cb" has asked to stop.
+ */
+static bool map_overlap_walk(map_node_t *node,
+                             uint64_t lo,
+                             uint64_t hi,
+                             bool (*cb)(void *key, void *data, void *ctx),
+                             void *ctx)
+{
+    for (; node; node = node->right) {
+        /* No range of the subtree reaches "lo" */
+        if (node->max_end <= lo)
+            return true;
+        if (!map_overlap_walk(node->left, lo, hi, cb, ctx))
+            return false;
+
+        /* The ranges of the right subtree start after this one */
+        const map_interval_t *range = node->key;
+        if (range->start >= hi)
+            return true;
+        if (range->end > lo && !cb(node->key, node->data, ctx))
+            return false;
+    }
+    return true;
+}
+
+void map_overlap_foreach(map_t obj,
+                         uint64_t lo,
+                         uint64_t hi,
+                         bool (*cb)(void *key, void *data, void *ctx),
+                         void *ctx)
+{
+    if (lo < hi)
+        map_overlap_walk(obj->head, lo, hi, cb, ctx);
+}
+#endif
+
 /*
  * Remove a node from the map. It performs a BST delete, and then reorders
  * the tree so that it remains balanced.
@@ -628,6 +1187,7 @@ void map_erase(map_t obj, map_iter_t *it)
         map_delete_node(obj, node);
         obj->head = NULL;
         obj->size--;
+        map_calibrate(obj);
         return;
     }
 
@@ -671,6 +1231,7 @@ void map_erase(map_t obj, map_iter_t *it)
         rb_set_parent(x, rb_parent(y));
 
     x_parent = rb_parent(y);
+    map_color_t y_color = rb_color(y);
 
     bool y_is_left = false;
     if (!rb_parent(y)) {
@@ -684,28 +1245,48 @@ void map_erase(map_t obj, map_iter_t *it)
     }
 
     if (y != node) {
-        free(node->key);
-        free(node->data);
-
-        node->key = y->key;
-        node->data = y->data;
-
-        y->key = y->data = NULL;
+        /*
+         * The storage is owned by the node, so "y" takes the place of "node"
+         * in the tree instead, and the other elements stay where they are.
+         */
+        if (x_parent == node)
+            x_parent = y;
+
+        y->left = node->left;
+        y->right = node->right;
+        rb_set_parent_color(y, rb_parent(node), rb_color(node));
+        if (y->left)
+            rb_set_parent(y->left, y);
+        if (y->right)
+            rb_set_parent(y->right, y);
+
+        if (!rb_parent(node))
+            obj->head = y;
+        else if (rb_parent(node)->left == node)
+            rb_parent(node)->left = y;
+        else
+            rb_parent(node)->right = y;
     }
 
-    if (rb_color(y) == RB_BLACK) {
+    /* The rotations of the fixup rely on the summaries below them */
+    rb_unlink_update(x_parent);
+
+    if (y_color == RB_BLACK) {
         if (!x) { /* Make a blank node if null */
-            double_blk =
-                map_create_node(NULL, NULL, obj->key_size, obj->element_size);
+            double_blk = map_create_node(obj, NULL, NULL);
+#ifdef MAP_ORDER_STATS
+            /* it holds no element, and the rotations never move it */
+            double_blk->size = 0;
+#endif
 
             x = double_blk;
 
-            if (!rb_parent(target)->left)
-                rb_parent(target)->left = x;
+            if (y_is_left)
+                x_parent->left = x;
             else
-                rb_parent(target)->right = x;
+                x_parent->right = x;
 
-            rb_set_parent_color(x, rb_parent(target), RB_BLACK);
+            rb_set_parent_color(x, x_parent, RB_BLACK);
         }
 
         /* fix the tree up */
@@ -726,28 +1307,51 @@ void map_erase(map_t obj, map_iter_t *it)
 
     obj->size--;
 
-    map_delete_node(obj, y);
-    map_calibrate(obj);
+    /* The ends only move when "node" was one of them */
+    bool at_end = node == obj->it_least.node || node == obj->it_most.node;
+
+    map_delete_node(obj, node);
+    if (at_end)
+        map_calibrate(obj);
 }
 
 /*
- * Delete all nodes in the graph. This is done by calling erase on the head
- * node until the tree is empty.
+ * Remove the element of "key" without going through an iterator. Return
+ * false if "key" is not in the map.
+ */
+bool map_erase_key(map_t obj, void *key)
+{
+    map_iter_t it = {.prev = NULL, .node = obj->head, .count = 0};
+
+    while (it.node) {
+        int res = obj->comparator(key, it.node->key);
+        if (res == 0) {
+            map_erase(obj, &it);
+            return true;
+        }
+        it.node = res < 0 ? it.node->left : it.node->right;
+    }
+    return false;
+}
+
+/*
+ * Delete all nodes in the graph. Every node lives in the slab, so they are
+ * released at once without walking the tree.
  */
 void map_clear(map_t obj)
 {
-    if (obj->head) /* Aggressively delete by recursion */
-        map_clear_nested(obj, obj->head);
+    slab_reset(&obj->slab);
 
     obj->size = 0;
     obj->head = NULL;
+    map_calibrate(obj);
 }
 
 /* Free the map from memory and delete all nodes. */
 void map_delete(map_t obj)
 {
     /* Free all nodes */
-    map_clear(obj);
+    slab_destroy(&obj->slab);
 
     /* Free the map itself */
     free(obj);
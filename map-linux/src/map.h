@@ -18,6 +18,7 @@
 
 #include <stdbool.h>
 #include <stddef.h>
+#include <stdint.h>
 
 enum { _CMP_LESS = -1, _CMP_EQUAL = 0, _CMP_GREATER = 1 };
 
@@ -49,6 +50,12 @@ static inline int map_cmp_sizet(const void *arg0, const void *arg1)
  * @parent_color: combination of @parent and @color (lowest bit)
  * @left: pointer to the left child in the tree
  * @right: pointer to the right child in the tree
+ * @key: pointer to the key bytes, stored right after the node
+ * @data: pointer to the value bytes, stored right after the key
+ *
+ * The key and the value share a single allocation with the node, so that
+ * inserting an element costs one allocation and a lookup stays within the
+ * cache lines of the node itself.
  *
  * The red-black tree consists of a root and nodes attached to this root.
  */
@@ -71,11 +78,20 @@ static inline int map_cmp_sizet(const void *arg0, const void *arg1)
 #endif
 
 typedef struct map_node {
-    void *key, *data;
-
     /* red-black tree */
     unsigned long parent_color;
     struct map_node *left, *right;
+
+    void *key, *data;
+
+#ifdef MAP_ORDER_STATS
+    /* number of the elements of the subtree */
+    size_t size;
+#endif
+#ifdef MAP_INTERVALS
+    /* greatest end of the ranges of the subtree */
+    uint64_t max_end;
+#endif
 } __ALIGNED(sizeof(unsigned long)) map_node_t;
 
 typedef struct {
@@ -93,18 +109,102 @@ typedef struct map_internal *map_t;
 /* Constructor */
 map_t map_new(size_t, size_t, int (*)(const void *, const void *));
 
-/* Add function */
+/* Add functions */
 bool map_insert(map_t, void *, void *);
+bool map_insert_or_get(map_t, map_iter_t *, void *, void *);
+bool map_insert_hint(map_t, map_iter_t *, void *, void *);
+bool map_upsert(map_t, void *, void *);
+bool map_build_sorted(map_t, void *, void *, size_t);
 
 /* Get functions */
 void map_find(map_t, map_iter_t *, void *);
+void map_lower_bound(map_t, map_iter_t *, void *);
+void map_upper_bound(map_t, map_iter_t *, void *);
+void map_floor(map_t, map_iter_t *, void *);
+void map_ceil(map_t, map_iter_t *, void *);
 bool map_empty(map_t);
 
+/* Order statistics.
+ * map_size() counts the elements in constant time. When MAP_ORDER_STATS is
+ * defined, for map.c and all of its users alike, every node also keeps the
+ * size of its subtree, at the cost of a word per node and of a walk up from
+ * each inserted or removed node. map_rank() then counts the elements whose
+ * keys are less than @key, and map_select() points @it to the element of
+ * rank @k, from 0, or to the end past the last one, in logarithmic time.
+ */
+size_t map_size(map_t);
+#ifdef MAP_ORDER_STATS
+size_t map_rank(map_t, void *);
+void map_select(map_t, map_iter_t *, size_t);
+#endif
+
+/* Interval map.
+ * When MAP_INTERVALS is defined, for map.c and all of its users alike, the
+ * keys start with the range [@start, @end) they cover, and every node keeps
+ * the greatest end of the ranges of its subtree. The keys are ordered by
+ * map_cmp_interval(), or by any comparator that orders them by their start
+ * first. map_overlap_foreach() calls @cb on the elements whose ranges
+ * overlap [@lo, @hi), in the order of the keys, until it returns false, and
+ * @cb must not change the map. The subtrees whose ranges all end by @lo or
+ * start from @hi are skipped, so that the cost is logarithmic plus linear in
+ * the number of elements found.
+ */
+#ifdef MAP_INTERVALS
+typedef struct {
+    uint64_t start, end;
+} map_interval_t;
+
+static inline int map_cmp_interval(const void *arg0, const void *arg1)
+{
+    const map_interval_t *a = arg0, *b = arg1;
+    if (a->start != b->start)
+        return (a->start < b->start) ? _CMP_LESS : _CMP_GREATER;
+    return (a->end < b->end)   ? _CMP_LESS
+           : (a->end > b->end) ? _CMP_GREATER
+                               : _CMP_EQUAL;
+}
+
+void map_overlap_foreach(map_t,
+                         uint64_t,
+                         uint64_t,
+                         bool (*)(void *, void *, void *),
+                         void *);
+#endif
+
+/* Introspection.
+ * map_stats() walks the tree to report the footprint and the shape of the
+ * map. The bytes of the keys and values only count the sizes given to
+ * map_new(), so that the heap bytes less these are the overhead of the map:
+ * nodes, padding, free slots of the allocator and the map itself.
+ */
+typedef struct {
+    size_t count;      /* elements */
+    size_t node_bytes; /* nodes, without their keys and values */
+    size_t key_bytes;  /* keys */
+    size_t data_bytes; /* values */
+    size_t heap_bytes; /* all the memory held by the map */
+    size_t height;     /* nodes on the longest path, the most a lookup visits */
+    double avg_depth;  /* nodes a lookup of an element visits on average */
+    size_t red, black; /* nodes of each color */
+} map_stats_t;
+
+void map_stats(map_t, map_stats_t *);
+
 /* Iteration */
+void map_first(map_t, map_iter_t *);
+void map_last(map_t, map_iter_t *);
+void map_next(map_t, map_iter_t *);
+void map_prev(map_t, map_iter_t *);
 bool map_at_end(map_t, map_iter_t *);
+void map_range_foreach(map_t,
+                       void *,
+                       void *,
+                       bool (*)(void *, void *, void *),
+                       void *);
 
 /* Remove functions */
 void map_erase(map_t, map_iter_t *);
+bool map_erase_key(map_t, void *);
 void map_clear(map_t);
 
 /* Destructor */
@@ -0,0 +1,95 @@
+/*
+ * rv32emu is freely redistributable under the MIT License. See the file
+ * "LICENSE" for information on usage and redistribution of this file.
+ */
+
+#include <assert.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "slab.h"
+
+/* Blocks start small so that tiny maps stay cheap, and then grow
+ * geometrically up to the maximum size.
+ */
+#define SLAB_MIN_BLOCK (4 << 10)
+#define SLAB_MAX_BLOCK (1 << 20)
+
+struct slab_block {
+    struct slab_block *next;
+    size_t size;
+    uint64_t payload[]; /* keep the objects 8-byte aligned */
+};
+
+void slab_init(slab_t *slab, size_t obj_size)
+{
+    if (obj_size < sizeof(void *))
+        obj_size = sizeof(void *);
+
+    slab->obj_size = obj_size;
+    slab->free_list = NULL;
+    slab->cur = slab->end = NULL;
+    slab->blocks = NULL;
+    slab->block_size = SLAB_MIN_BLOCK;
+}
+
+/* Slow path of slab_alloc(): start a new block and carve the first object */
+void *slab_grow(slab_t *slab)
+{
+    size_t size = slab->block_size;
+    while (size < slab->obj_size)
+        size <<= 1;
+
+    slab_block_t *block = malloc(sizeof(slab_block_t) + size);
+    assert(block);
+    block->size = size;
+    block->next = slab->blocks;
+    slab->blocks = block;
+
+    if (slab->block_size < SLAB_MAX_BLOCK)
+        slab->block_size <<= 1;
+
+    slab->cur = (char *) block->payload + slab->obj_size;
+    slab->end = (char *) block->payload + size;
+    return block->payload;
+}
+
+/*
+ * Release every object at once. The newest block is the largest one, so it is
+ * kept around to serve the next round of allocations without calling malloc.
+ */
+void slab_reset(slab_t *slab)
+{
+    slab_block_t *block = slab->blocks;
+    if (!block)
+        return;
+
+    for (slab_block_t *next, *it = block->next; it; it = next) {
+        next = it->next;
+        free(it);
+    }
+    block->next = NULL;
+
+    slab->free_list = NULL;
+    slab->cur = (char *) block->payload;
+    slab->end = (char *) block->payload + block->size;
+}
+
+/* Release every object along with all the memory held by the slab */
+void slab_destroy(slab_t *slab)
+{
+    for (slab_block_t *next, *it = slab->blocks; it; it = next) {
+        next = it->next;
+        free(it);
+    }
+    slab_init(slab, slab->obj_size);
+}
+
+/* Bytes obtained from malloc(), the headers of the blocks included */
+size_t slab_footprint(const slab_t *slab)
+{
+    size_t bytes = 0;
+    for (const slab_block_t *it = slab->blocks; it; it = it->next)
+        bytes += sizeof(slab_block_t) + it->size;
+    return bytes;
+}
@@ -0,0 +1,66 @@
+/*
+ * rv32emu is freely redistributable under the MIT License. See the file
+ * "LICENSE" for information on usage and redistribution of this file.
+ */
+
+/*
+ * Fixed-size object allocator backing the map nodes.
+ *
+ * Objects are carved out of large blocks, and released objects are kept in
+ * an intrusive free list which is consulted first on allocation. The blocks
+ * are only returned to the system as a whole, so that emptying a map does not
+ * need to visit its nodes one by one.
+ */
+
+#pragma once
+
+#include <stddef.h>
+
+typedef struct slab_block slab_block_t;
+
+/*
+ * @obj_size: size of every object, a multiple of the object alignment
+ * @free_list: objects released by slab_free(), linked through their first word
+ * @cur: first unused byte of the newest block
+ * @end: end of the newest block
+ * @blocks: all the blocks owned by the slab, newest first
+ * @block_size: payload size of the next block to be allocated
+ */
+typedef struct {
+    size_t obj_size;
+    void *free_list;
+    char *cur, *end;
+    slab_block_t *blocks;
+    size_t block_size;
+} slab_t;
+
+void slab_init(slab_t *, size_t);
+void *slab_grow(slab_t *);
+void slab_reset(slab_t *);
+void slab_destroy(slab_t *);
+size_t slab_footprint(const slab_t *);
+
+/* Allocate an object, reusing a released one when possible */
+static inline void *slab_alloc(slab_t *slab)
+{
+    void *obj = slab->free_list;
+    if (obj) {
+        slab->free_list = *(void **) obj;
+        return obj;
+    }
+
+    if ((size_t) (slab->end - slab->cur) >= slab->obj_size) {
+        obj = slab->cur;
+        slab->cur += slab->obj_size;
+        return obj;
+    }
+
+    return slab_grow(slab);
+}
+
+/* Give an object back to the slab. The memory is kept for later reuse. */
+static inline void slab_free(slab_t *slab, void *obj)
+{
+    *(void **) obj = slab->free_list;
+    slab->free_list = obj;
+}
@@ -102,6 +102,681 @@ free_tree:
     return ret;
 }
 
+/* The map must remain usable after its nodes were released in bulk */
+static int test_map_clear_reuse()
+{
+    int ret = 0;
+    map_t tree = map_init(int, int, map_cmp_int);
+
+    for (int round = 0; round < 3; round++) {
+        for (int i = 0; i < N_NODES; i++) {
+            int val = i * 2;
+            map_insert(tree, &i, &val);
+        }
+
+        /* punch holes so that the free list gets used by the next round */
+        for (int i = 0; i < N_NODES; i += 3) {
+            map_iter_t my_it;
+            map_find(tree, &my_it, &i);
+            map_erase(tree, &my_it);
+        }
+
+        for (int i = 0; i < N_NODES; i++) {
+            map_iter_t my_it;
+            map_find(tree, &my_it, &i);
+            if ((i % 3 == 0) != map_at_end(tree, &my_it) ||
+                (!map_at_end(tree, &my_it) &&
+                 map_iter_value(&my_it, int) != i * 2)) {
+                ret = 1;
+                goto free_tree;
+            }
+        }
+
+        map_clear(tree);
+        if (!map_empty(tree)) {
+            ret = 1;
+            goto free_tree;
+        }
+    }
+
+free_tree:
+    map_delete(tree);
+    return ret;
+}
+
+/* A bulk-loaded map must behave like one filled by map_insert() */
+static int test_map_build_sorted()
+{
+    int ret = 0;
+    int key[N_NODES], val[N_NODES];
+
+    for (int i = 0; i < N_NODES; i++) {
+        key[i] = i * 2;
+        val[i] = i;
+    }
+
+    /* cover the shapes of small trees as well as a large one */
+    for (int n = 0; n <= N_NODES; n += (n < 64) ? 1 : N_NODES / 4) {
+        map_t tree = map_init(int, int, map_cmp_int);
+
+        if (!map_build_sorted(tree, key, val, n) ||
+            map_build_sorted(tree, key, val, n) != (n == 0)) {
+            ret = 1;
+            goto free_tree;
+        }
+
+        for (int i = 0; i < n; i++) {
+            map_iter_t my_it;
+            map_find(tree, &my_it, key + i);
+            if (map_at_end(tree, &my_it) ||
+                map_iter_value(&my_it, int) != val[i]) {
+                ret = 1;
+                goto free_tree;
+            }
+        }
+
+        /* the coloring must hold for later updates */
+        for (int i = 0; i < n; i++) {
+            int odd = key[i] + 1;
+            map_insert(tree, &odd, &odd);
+        }
+        for (int i = 0; i < n; i++) {
+            map_iter_t my_it;
+            map_find(tree, &my_it, key + i);
+            map_erase(tree, &my_it);
+            map_find(tree, &my_it, key + i);
+            if (!map_at_end(tree, &my_it)) {
+                ret = 1;
+                goto free_tree;
+            }
+        }
+
+    free_tree:
+        map_delete(tree);
+        if (ret)
+            break;
+    }
+    return ret;
+}
+
+/* Existing elements are returned, or overwritten, without being duplicated */
+static int test_map_insert_or_get()
+{
+    int ret = 0;
+    map_t tree = map_init(int, int, map_cmp_int);
+
+    for (int i = 0; i < N_NODES; i++) {
+        map_iter_t my_it;
+        int val = i + 1;
+        if (!map_insert_or_get(tree, &my_it, &i, &val) ||
+            map_iter_value(&my_it, int) != i + 1) {
+            ret = 1;
+            goto free_tree;
+        }
+    }
+
+    for (int i = 0; i < N_NODES; i++) {
+        map_iter_t my_it, found_it;
+        int val = -1;
+        map_find(tree, &found_it, &i);
+        if (map_insert_or_get(tree, &my_it, &i, &val) ||
+            my_it.node != found_it.node ||
+            map_iter_value(&my_it, int) != i + 1 ||
+            map_insert(tree, &i, &val)) {
+            ret = 1;
+            goto free_tree;
+        }
+    }
+
+    /* overwrite the even elements, and insert as many new ones */
+    for (int i = 0; i < N_NODES * 2; i += 2) {
+        int val = -i;
+        if (map_upsert(tree, &i, &val) != (i >= N_NODES)) {
+            ret = 1;
+            goto free_tree;
+        }
+    }
+
+    for (int i = 0; i < N_NODES * 2; i++) {
+        map_iter_t my_it;
+        map_find(tree, &my_it, &i);
+        if (i >= N_NODES && i % 2) {
+            if (!map_at_end(tree, &my_it))
+                ret = 1;
+        } else if (map_at_end(tree, &my_it) ||
+                   map_iter_value(&my_it, int) != (i % 2 ? i + 1 : -i)) {
+            ret = 1;
+        }
+        if (ret)
+            goto free_tree;
+    }
+
+free_tree:
+    map_delete(tree);
+    return ret;
+}
+
+/* Walk the map in both directions, from either end or from a found element */
+static int test_map_iteration()
+{
+    int ret = 0;
+    map_t tree = map_init(int, int, map_cmp_int);
+    map_iter_t my_it;
+
+    map_first(tree, &my_it);
+    if (!map_at_end(tree, &my_it))
+        ret = 1;
+
+    int key[N_NODES];
+    for (int i = 0; i < N_NODES; i++)
+        key[i] = i * 2;
+    for (int i = 0; i < N_NODES; i++) {
+        int pos_a = rand() % N_NODES;
+        int pos_b = rand() % N_NODES;
+        swap(&key[pos_a], &key[pos_b]);
+    }
+    for (int i = 0; i < N_NODES; i++)
+        map_insert(tree, key + i, key + i);
+
+    int count = 0;
+    for (map_first(tree, &my_it); !map_at_end(tree, &my_it);
+         map_next(tree, &my_it)) {
+        if (map_iter_value(&my_it, int) != count * 2)
+            ret = 1;
+        count++;
+    }
+    if (count != N_NODES)
+        ret = 1;
+
+    count = 0;
+    for (map_last(tree, &my_it); !map_at_end(tree, &my_it);
+         map_prev(tree, &my_it)) {
+        if (map_iter_value(&my_it, int) != (N_NODES - 1 - count) * 2)
+            ret = 1;
+        count++;
+    }
+    if (count != N_NODES)
+        ret = 1;
+
+    /* step around the elements found by key */
+    for (int i = 0; i < N_NODES; i++) {
+        int k = key[i];
+        map_find(tree, &my_it, &k);
+        map_next(tree, &my_it);
+        if (k == (N_NODES - 1) * 2 ? !map_at_end(tree, &my_it)
+                                   : map_iter_value(&my_it, int) != k + 2)
+            ret = 1;
+        map_find(tree, &my_it, &k);
+        map_prev(tree, &my_it);
+        if (k == 0 ? !map_at_end(tree, &my_it)
+                   : map_iter_value(&my_it, int) != k - 2)
+            ret = 1;
+    }
+
+    map_delete(tree);
+    return ret;
+}
+
+/* Return the key pointed by the iterator, or -1 at the end */
+static int iter_key(map_t tree, map_iter_t *it)
+{
+    return map_at_end(tree, it) ? -1 : *(int *) it->node->key;
+}
+
+static bool sum_keys(void *key, void *data, void *ctx)
+{
+    (void) data;
+    *(int *) ctx += *(int *) key;
+    return true;
+}
+
+/* Lookups of the nearest elements on a map of the even numbers */
+static int test_map_bounds()
+{
+    int ret = 0;
+    map_t tree = map_init(int, int, map_cmp_int);
+    map_iter_t my_it;
+
+    int key[N_NODES];
+    for (int i = 0; i < N_NODES; i++)
+        key[i] = i * 2;
+    for (int i = 0; i < N_NODES; i++) {
+        int pos_a = rand() % N_NODES;
+        int pos_b = rand() % N_NODES;
+        swap(&key[pos_a], &key[pos_b]);
+    }
+    for (int i = 0; i < N_NODES; i++)
+        map_insert(tree, key + i, key + i);
+
+    const int max = (N_NODES - 1) * 2;
+    for (int x = -1; x <= max + 1; x++) {
+        int ceil = (x < 0) ? 0 : (x > max) ? -1 : (x + 1) / 2 * 2;
+        int higher = (x + 1 > max) ? -1 : (x < 0) ? 0 : (x + 2) / 2 * 2;
+        int floor = (x < 0) ? -1 : (x > max) ? max : x / 2 * 2;
+
+        map_lower_bound(tree, &my_it, &x);
+        if (iter_key(tree, &my_it) != ceil)
+            ret = 1;
+
+        /* the iteration goes on from a bound */
+        map_next(tree, &my_it);
+        if (ceil >= 0 &&
+            iter_key(tree, &my_it) != (ceil == max ? -1 : ceil + 2))
+            ret = 1;
+
+        map_ceil(tree, &my_it, &x);
+        if (iter_key(tree, &my_it) != ceil)
+            ret = 1;
+        map_upper_bound(tree, &my_it, &x);
+        if (iter_key(tree, &my_it) != higher)
+            ret = 1;
+        map_floor(tree, &my_it, &x);
+        if (iter_key(tree, &my_it) != floor)
+            ret = 1;
+
+        if (ret)
+            goto free_tree;
+    }
+
+    /* the keys in [lo, hi) */
+    for (int lo = -3; lo < 100; lo += 7) {
+        int hi = lo * 3 + 5, sum = 0, expect = 0;
+        for (int k = (lo < 0) ? 0 : (lo + 1) / 2 * 2; k < hi && k <= max;
+             k += 2)
+            expect += k;
+        map_range_foreach(tree, &lo, &hi, sum_keys, &sum);
+        if (sum != expect) {
+            ret = 1;
+            goto free_tree;
+        }
+    }
+
+    int sum = 0;
+    map_range_foreach(tree, NULL, NULL, sum_keys, &sum);
+    if (sum != N_NODES * (N_NODES - 1))
+        ret = 1;
+
+free_tree:
+    map_delete(tree);
+    return ret;
+}
+
+/* Removal by key, in random order, keeps the ends and the other keys */
+static int test_map_erase_key()
+{
+    int ret = 0;
+    map_t tree = map_init(int, int, map_cmp_int);
+    map_iter_t my_it;
+
+    int key[N_NODES];
+    for (int i = 0; i < N_NODES; i++)
+        key[i] = i * 2;
+    for (int i = 0; i < N_NODES; i++) {
+        int pos_a = rand() % N_NODES;
+        int pos_b = rand() % N_NODES;
+        swap(&key[pos_a], &key[pos_b]);
+    }
+    for (int i = 0; i < N_NODES; i++)
+        map_insert(tree, key + i, key + i);
+
+    /* odd keys are absent */
+    for (int x = -1; x < N_NODES * 2; x += 2) {
+        if (map_erase_key(tree, &x)) {
+            ret = 1;
+            goto free_tree;
+        }
+    }
+
+    int lo = 0, hi = (N_NODES - 1) * 2;
+    bool gone[N_NODES] = {false};
+    for (int i = 0; i < N_NODES; i++) {
+        if (!map_erase_key(tree, key + i) || map_erase_key(tree, key + i)) {
+            ret = 1;
+            goto free_tree;
+        }
+        gone[key[i] / 2] = true;
+        while (lo <= hi && gone[lo / 2])
+            lo += 2;
+        while (hi >= lo && gone[hi / 2])
+            hi -= 2;
+
+        map_first(tree, &my_it);
+        if (iter_key(tree, &my_it) != (lo <= hi ? lo : -1))
+            ret = 1;
+        map_last(tree, &my_it);
+        if (iter_key(tree, &my_it) != (lo <= hi ? hi : -1))
+            ret = 1;
+        if (ret)
+            goto free_tree;
+    }
+
+    if (!map_empty(tree))
+        ret = 1;
+
+free_tree:
+    map_delete(tree);
+    return ret;
+}
+
+/* Erasing an element leaves the keys and values of the others in place */
+static int test_map_erase_stable()
+{
+    int ret = 0;
+    map_t tree = map_init(int, int, map_cmp_int);
+    map_iter_t my_it;
+
+    int one = 1, two = 2, three = 3, four = 4;
+    int ten = 10, twenty = 20, thirty = 30, forty = 40;
+    map_insert(tree, &one, &ten);
+    map_insert(tree, &two, &twenty);
+    map_insert(tree, &three, &thirty);
+    map_find(tree, &my_it, &one);
+    int *data = my_it.node->data;
+    map_erase_key(tree, &two);
+    map_insert(tree, &four, &forty);
+    if (*data != 10)
+        ret = 1;
+    map_delete(tree);
+
+    tree = map_init(int, int, map_cmp_int);
+    int key[N_NODES];
+    static int *keys[N_NODES], *vals[N_NODES];
+    for (int i = 0; i < N_NODES; i++)
+        key[i] = i;
+    for (int i = N_NODES - 1; i > 0; i--)
+        swap(&key[i], &key[rand() % (i + 1)]);
+    for (int i = 0; i < N_NODES; i++) {
+        map_insert(tree, key + i, key + i);
+        map_find(tree, &my_it, key + i);
+        keys[key[i]] = my_it.node->key;
+        vals[key[i]] = my_it.node->data;
+    }
+
+    /* erase half of the keys both ways, then reuse their storage */
+    for (int i = 0; i < N_NODES / 2; i++) {
+        if (i & 1) {
+            map_erase_key(tree, key + i);
+        } else {
+            map_find(tree, &my_it, key + i);
+            map_erase(tree, &my_it);
+        }
+        keys[key[i]] = vals[key[i]] = NULL;
+    }
+    for (int i = N_NODES; i < N_NODES + N_NODES / 2; i++)
+        map_insert(tree, &i, &i);
+
+    for (int i = 0; i < N_NODES; i++) {
+        if (!keys[i])
+            continue;
+        map_find(tree, &my_it, &i);
+        if (map_at_end(tree, &my_it) || my_it.node->key != keys[i] ||
+            my_it.node->data != vals[i] || *keys[i] != i || *vals[i] != i)
+            ret = 1;
+    }
+
+    map_delete(tree);
+    return ret;
+}
+
+/* Hinted insertions, in order and around stale hints, keep the map sorted */
+static int test_map_insert_hint()
+{
+    int ret = 0;
+    map_t tree = map_init(int, int, map_cmp_int);
+    map_iter_t my_it = {.node = NULL};
+
+    /* the odd keys descending, each hinted by the previous one */
+    for (int k = N_NODES * 2 - 1; k > 0; k -= 2) {
+        if (!map_insert_hint(tree, &my_it, &k, &k) ||
+            iter_key(tree, &my_it) != k) {
+            ret = 1;
+            goto free_tree;
+        }
+    }
+
+    /* the even keys ascending, hinted by the odd key next to them */
+    for (int k = 0; k < N_NODES * 2; k += 2) {
+        int near = (k % 4) ? k - 1 : k + 1;
+        map_find(tree, &my_it, &near);
+        if (!map_insert_hint(tree, &my_it, &k, &k) ||
+            iter_key(tree, &my_it) != k) {
+            ret = 1;
+            goto free_tree;
+        }
+    }
+
+    /* keys in the map are found from any hint */
+    for (int i = 0; i < N_NODES; i++) {
+        int k = rand() % (N_NODES * 2), v = -1;
+        if (map_insert_hint(tree, &my_it, &k, &v) ||
+            iter_key(tree, &my_it) != k || map_iter_value(&my_it, int) != k) {
+            ret = 1;
+            goto free_tree;
+        }
+    }
+
+    /* the hint keeps moving in order, and appends go past the end */
+    map_next(tree, &my_it);
+    for (int k = N_NODES * 2; k < N_NODES * 3; k++)
+        map_insert_hint(tree, &my_it, &k, &k);
+
+    int expect = 0;
+    for (map_first(tree, &my_it); !map_at_end(tree, &my_it);
+         map_next(tree, &my_it)) {
+        if (iter_key(tree, &my_it) != expect++) {
+            ret = 1;
+            break;
+        }
+    }
+    if (expect != N_NODES * 3)
+        ret = 1;
+
+free_tree:
+    map_delete(tree);
+    return ret;
+}
+
+/* The statistics follow the elements, and the tree stays balanced */
+static int test_map_stats()
+{
+    int ret = 0;
+    map_t tree = map_init(int, int, map_cmp_int);
+    map_stats_t stats;
+
+    map_stats(tree, &stats);
+    if (stats.count || stats.height || stats.red || stats.black)
+        ret = 1;
+
+    int key[N_NODES];
+    for (int i = 0; i < N_NODES; i++)
+        key[i] = i;
+    for (int i = 0; i < N_NODES; i++) {
+        int pos_a = rand() % N_NODES;
+        int pos_b = rand() % N_NODES;
+        swap(&key[pos_a], &key[pos_b]);
+    }
+    for (int i = 0; i < N_NODES; i++)
+        map_insert(tree, key + i, key + i);
+
+    for (int round = 0; round < 2 && !ret; round++) {
+        size_t n = round ? N_NODES / 2 : N_NODES, bound = 0;
+        while (((size_t) 1 << bound) <= n)
+            bound++;
+        map_stats(tree, &stats);
+        if (stats.count != n || stats.red + stats.black != n ||
+            stats.key_bytes != n * sizeof(int) ||
+            stats.data_bytes != n * sizeof(int) ||
+            stats.heap_bytes < stats.node_bytes + stats.key_bytes +
+                                   stats.data_bytes ||
+            stats.height > 2 * bound || stats.avg_depth < 1 ||
+            stats.avg_depth > stats.height)
+            ret = 1;
+
+        for (int i = 0; i < N_NODES / 2; i++)
+            map_erase_key(tree, key + i);
+    }
+
+    map_clear(tree);
+    map_stats(tree, &stats);
+    if (stats.count || stats.height || stats.avg_depth != 0)
+        ret = 1;
+
+    map_delete(tree);
+    return ret;
+}
+
+#ifdef MAP_ORDER_STATS
+/* Check the ranks in a map of the keys 2 * i, for the i set in @present */
+static int check_order_stats(map_t tree, const bool *present)
+{
+    map_iter_t it;
+    size_t rank = 0;
+
+    for (int i = 0; i < N_NODES; i++) {
+        int even = 2 * i, odd = 2 * i + 1;
+        if (map_rank(tree, &even) != rank)
+            return 1;
+        if (!present[i])
+            continue;
+        map_select(tree, &it, rank++);
+        if (map_at_end(tree, &it) || *(int *) it.node->key != even ||
+            map_rank(tree, &odd) != rank)
+            return 1;
+    }
+
+    map_select(tree, &it, rank);
+    return !map_at_end(tree, &it) || map_size(tree) != rank;
+}
+
+static int test_map_order_stats()
+{
+    int ret = 0;
+    map_t tree = map_init(int, int, map_cmp_int);
+    static bool present[N_NODES];
+    int key[N_NODES];
+
+    for (int i = 0; i < N_NODES; i++)
+        key[i] = 2 * i;
+    for (int i = 0; i < N_NODES; i++) {
+        int pos_a = rand() % N_NODES;
+        int pos_b = rand() % N_NODES;
+        swap(&key[pos_a], &key[pos_b]);
+    }
+    for (int i = 0; i < N_NODES; i++) {
+        map_insert(tree, key + i, NULL);
+        present[key[i] / 2] = true;
+    }
+    ret |= check_order_stats(tree, present);
+
+    for (int i = 0; i < N_NODES / 2; i++) {
+        map_erase_key(tree, key + i);
+        present[key[i] / 2] = false;
+    }
+    ret |= check_order_stats(tree, present);
+
+    /* the iterator of a selected element moves on like any other */
+    map_iter_t it;
+    size_t count = 0;
+    for (map_select(tree, &it, map_size(tree) / 2); !map_at_end(tree, &it);
+         map_next(tree, &it))
+        count++;
+    if (count != map_size(tree) - map_size(tree) / 2)
+        ret = 1;
+
+    /* a bulk load, then insertions past the greatest element */
+    map_clear(tree);
+    for (int i = 0; i < N_NODES; i++) {
+        key[i] = 2 * i;
+        present[i] = true;
+    }
+    map_build_sorted(tree, key, NULL, N_NODES / 2);
+    for (int i = N_NODES / 2; i < N_NODES; i++)
+        map_insert(tree, key + i, NULL);
+    ret |= check_order_stats(tree, present);
+
+    map_delete(tree);
+    return ret;
+}
+#endif
+
+#ifdef MAP_INTERVALS
+enum { N_RANGES = 2000, N_QUERIES = 500, SPACE = 40000 };
+
+/* The elements found by map_overlap_foreach(), in their order */
+typedef struct {
+    map_interval_t found[N_RANGES];
+    int count;
+} overlap_t;
+
+static bool collect_overlap(void *key, void *data, void *ctx)
+{
+    overlap_t *o = ctx;
+    (void) data;
+    o->found[o->count++] = *(map_interval_t *) key;
+    return true;
+}
+
+/* Compare map_overlap_foreach() with a scan of the ranges set in @present */
+static int check_overlaps(map_t tree,
+                          const map_interval_t *ranges,
+                          const bool *present)
+{
+    static overlap_t o;
+
+    for (int q = 0; q < N_QUERIES; q++) {
+        uint64_t lo = rand() % SPACE, hi = lo + 1 + rand() % 200;
+        int expected = 0;
+
+        o.count = 0;
+        map_overlap_foreach(tree, lo, hi, collect_overlap, &o);
+        for (int i = 0; i < N_RANGES; i++)
+            expected += present[i] && ranges[i].start < hi &&
+                        ranges[i].end > lo;
+        if (o.count != expected)
+            return 1;
+        for (int i = 0; i < o.count; i++) {
+            if (o.found[i].start >= hi || o.found[i].end <= lo ||
+                (i && map_cmp_interval(o.found + i - 1, o.found + i) !=
+                          _CMP_LESS))
+                return 1;
+        }
+    }
+    return 0;
+}
+
+static int test_map_intervals()
+{
+    int ret = 0;
+    map_t tree = map_init(map_interval_t, int, map_cmp_interval);
+    static map_interval_t ranges[N_RANGES];
+    static bool present[N_RANGES];
+
+    /* short ranges, and a few long ones over them */
+    for (int i = 0; i < N_RANGES; i++) {
+        ranges[i].start = rand() % SPACE;
+        ranges[i].end = ranges[i].start + 1 + rand() % (i % 10 ? 50 : 2000);
+        present[i] = map_insert(tree, ranges + i, &i);
+    }
+    ret |= check_overlaps(tree, ranges, present);
+
+    for (int i = 0; i < N_RANGES; i += 2) {
+        if (present[i])
+            map_erase_key(tree, ranges + i);
+        present[i] = false;
+    }
+    ret |= check_overlaps(tree, ranges, present);
+
+    /* an empty window finds nothing */
+    overlap_t o = {.count = 0};
+    map_overlap_foreach(tree, 100, 100, collect_overlap, &o);
+    if (o.count)
+        ret = 1;
+
+    map_delete(tree);
+    return ret;
+}
+#endif
+
 int main(int argc, char *argv[])
 {
     (void) argc;
@@ -110,6 +785,21 @@ int main(int argc, char *argv[])
     srand((unsigned) time(NULL));
 
     int ret = test_map_mixed_operations();
+    ret |= test_map_clear_reuse();
+    ret |= test_map_build_sorted();
+    ret |= test_map_insert_or_get();
+    ret |= test_map_iteration();
+    ret |= test_map_bounds();
+    ret |= test_map_erase_key();
+    ret |= test_map_erase_stable();
+    ret |= test_map_insert_hint();
+    ret |= test_map_stats();
+#ifdef MAP_ORDER_STATS
+    ret |= test_map_order_stats();
+#endif
+#ifdef MAP_INTERVALS
+    ret |= test_map_intervals();
+#endif
     printf("%s", (ret == 0) ? "PASS" : "FAIL");
     return ret;
 }
@@ -0,0 +1,176 @@
+/*
+ * rv32emu is freely redistributable under the MIT License. See the file
+ * "LICENSE" for information on usage and redistribution of this file.
+ */
+
+/*
+ * Lookups of map-rcu from 1, 2, 4, ... reader threads, with and without a
+ * concurrent writer.
+ *
+ * usage: bench-map-rcu-threads [max-threads]
+ */
+
+#include <assert.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "bench-rng.h"
+#include "map.h"
+
+static int map_cmp_sizet(const void *arg0, const void *arg1)
+{
+    size_t a = *(const size_t *) arg0, b = *(const size_t *) arg1;
+    return (a < b) ? _CMP_LESS : (a > b) ? _CMP_GREATER : _CMP_EQUAL;
+}
+
+typedef struct {
+    map_t tree;
+    size_t *key;
+    size_t n;
+    pthread_barrier_t *start;
+    int *stop; /* for the writer */
+} worker_t;
+
+/* Look up @n keys, each in its own read-side section */
+static void *reader_thread(void *arg)
+{
+    worker_t *w = arg;
+    map_reader_t reader = map_reader_register(w->tree);
+
+    pthread_barrier_wait(w->start);
+    for (size_t i = 0; i < w->n; i++) {
+        map_iter_t my_it;
+        map_read_lock(reader);
+        map_find(w->tree, &my_it, w->key + i);
+        assert(!map_at_end(w->tree, &my_it));
+        map_read_unlock(reader);
+    }
+
+    map_reader_unregister(w->tree, reader);
+    return NULL;
+}
+
+/* Insert and erase keys past the ones looked up until the readers are done */
+static void *writer_thread(void *arg)
+{
+    worker_t *w = arg;
+
+    pthread_barrier_wait(w->start);
+    for (size_t k = w->n; !__atomic_load_n(w->stop, __ATOMIC_ACQUIRE); k++) {
+        map_insert(w->tree, &k, &k);
+        map_erase_key(w->tree, &k);
+    }
+    return NULL;
+}
+
+/* @scale lookups split among @threads readers, along with a writer if
+ * @update. The time is from the start of the readers to the end of the last.
+ */
+static double perf_readers(map_t tree,
+                           size_t *key,
+                           size_t scale,
+                           unsigned threads,
+                           bool update)
+{
+    pthread_t tid[threads + 1];
+    worker_t w[threads + 1];
+    pthread_barrier_t start;
+    int stop = 0;
+
+    pthread_barrier_init(&start, NULL, threads + 1 + update);
+    for (unsigned t = 0; t < threads; t++) {
+        size_t lo = scale * t / threads, hi = scale * (t + 1) / threads;
+        w[t] = (worker_t){.tree = tree, .key = key + lo, .n = hi - lo,
+                          .start = &start};
+        pthread_create(tid + t, NULL, reader_thread, w + t);
+    }
+    if (update) {
+        w[threads] = (worker_t){.tree = tree, .n = scale, .start = &start,
+                                .stop = &stop};
+        pthread_create(tid + threads, NULL, writer_thread, w + threads);
+    }
+
+    /* the workers are all waiting for this thread at the barrier */
+    struct timespec before;
+    struct timespec after;
+    clock_gettime(CLOCK_MONOTONIC, &before);
+    pthread_barrier_wait(&start);
+    for (unsigned t = 0; t < threads; t++)
+        pthread_join(tid[t], NULL);
+    clock_gettime(CLOCK_MONOTONIC, &after);
+
+    if (update) {
+        __atomic_store_n(&stop, 1, __ATOMIC_RELEASE);
+        pthread_join(tid[threads], NULL);
+    }
+    pthread_barrier_destroy(&start);
+    return (after.tv_sec - before.tv_sec) * 1000000000UL +
+           (after.tv_nsec - before.tv_nsec);
+}
+
+static void perf_rb(rng_t *rng,
+                    const size_t scale,
+                    const size_t reps,
+                    unsigned max_threads)
+{
+    map_t tree = map_init(long, long, map_cmp_sizet);
+
+    size_t *key = malloc(scale * sizeof(size_t));
+
+    for (size_t i = 0; i < scale; i++)
+        key[i] = i;
+    shuffle(rng, key, scale);
+
+    for (size_t i = 0; i < scale; i++) {
+        map_insert(tree, key + i, key + i);
+    }
+
+    /* 1, 2, 4, ... readers, and as many as there are cores */
+    for (unsigned threads = 1;; threads *= 2) {
+        if (threads > max_threads)
+            threads = max_threads;
+
+        char benchmark_id[32];
+        snprintf(benchmark_id, sizeof(benchmark_id), "readers-%u", threads);
+        double result = perf_readers(tree, key, scale, threads, false);
+        printf("%f, %s, %s, %zu, %zu\n", result, benchmark_id, "find", scale,
+               reps);
+        result = perf_readers(tree, key, scale, threads, true);
+        printf("%f, %s, %s, %zu, %zu\n", result, benchmark_id, "find-update",
+               scale, reps);
+
+        if (threads == max_threads)
+            break;
+    }
+
+    map_delete(tree);
+    free(key);
+}
+
+int main(int argc, char *argv[])
+{
+    size_t scale[] = {/*1, 1e1, 1e2, 1e3,*/ 1e4, 1e5, 1e6 /*, 1e7, 1e8*/};
+    size_t n_scales = 3;
+    size_t reps = 20;
+
+    /* the number of readers to go up to, the online cores by default */
+    long cores = sysconf(_SC_NPROCESSORS_ONLN);
+    unsigned max_threads = (argc > 1) ? (unsigned) atoi(argv[1])
+                           : (cores > 0) ? (unsigned) cores
+                                         : 1;
+    if (max_threads == 0)
+        max_threads = 1;
+
+    rng_t rng;
+    rng_seed(&rng, 1);
+    for (size_t i = 0; i < n_scales; i++) {
+        /* the last field of the output counts the repetitions left */
+        for (size_t left = reps; left > 0; left--)
+            perf_rb(&rng, scale[i], left, max_threads);
+    }
+    return 0;
+}
@@ -0,0 +1,496 @@
+/*
+ * rv32emu is freely redistributable under the MIT License. See the file
+ * "LICENSE" for information on usage and redistribution of this file.
+ */
+
+/* A left-leaning red-black tree whose published nodes are immutable. An
+ * update runs the usual recursive insertion or removal, except that it
+ * copies a node before changing it, unless the node was made by the same
+ * update. The copies end up forming a new path from a new root, which the
+ * update publishes with a single store. The nodes they replace go to the
+ * limbo list, tagged with the epoch of the update.
+ *
+ * Each update advances the epoch of the map. A reader records the epoch it
+ * enters a read-side section in, and a node replaced in epoch E is freed once
+ * no reader is in a section entered in epoch E or before: any later section
+ * started from a root published after the node was unlinked.
+ */
+
+#include <assert.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "map.h"
+
+#define RCU_CACHE_LINE 64
+
+/* The key and the data are laid out right after the node. Both are rounded
+ * up to this alignment so that the data following the key is aligned.
+ */
+#define MAP_ALIGN sizeof(uint64_t)
+
+static inline size_t map_align(size_t size)
+{
+    return (size + MAP_ALIGN - 1) & ~(MAP_ALIGN - 1);
+}
+
+/* Readers only follow @left and @right, and read @key and @data. The other
+ * fields belong to the updates.
+ */
+typedef struct map_node {
+    struct map_node *left, *right;
+    void *key, *data;
+    bool red;
+
+    /* epoch of the update that made the node, then of the one that replaced
+     * it once it is in the limbo list.
+     */
+    uint64_t gen;
+    struct map_node *limbo; /* next node to free */
+} map_node_t;
+
+/* Each reader takes a cache line of its own, so that the readers do not
+ * contend when they enter or leave sections.
+ */
+struct map_reader {
+    uint64_t epoch; /* of the section the reader is in, 0 outside */
+    map_t map;
+    struct map_reader *next;
+};
+
+struct map_internal {
+    /* read by the readers */
+    map_node_t *root;
+    uint64_t epoch; /* starts at 1, advanced by each update */
+
+    /* properties */
+    size_t key_size, data_size;
+
+    map_cmp_t (*comparator)(const void *, const void *);
+
+    /* below, owned by the update holding @lock */
+    pthread_mutex_t lock;
+    map_reader_t readers;
+    map_node_t *limbo_head, *limbo_tail; /* oldest first */
+};
+
+/* Readers */
+
+map_reader_t map_reader_register(map_t obj)
+{
+    map_reader_t reader = NULL;
+    int err = posix_memalign((void **) &reader, RCU_CACHE_LINE,
+                             (sizeof(struct map_reader) + RCU_CACHE_LINE - 1) &
+                                 ~(size_t) (RCU_CACHE_LINE - 1));
+    assert(!err && reader);
+    (void) err;
+
+    reader->epoch = 0;
+    reader->map = obj;
+    pthread_mutex_lock(&obj->lock);
+    reader->next = obj->readers;
+    obj->readers = reader;
+    pthread_mutex_unlock(&obj->lock);
+    return reader;
+}
+
+/* The reader must be out of any section */
+void map_reader_unregister(map_t obj, map_reader_t reader)
+{
+    pthread_mutex_lock(&obj->lock);
+    map_reader_t *p = &obj->readers;
+    while (*p != reader)
+        p = &(*p)->next;
+    *p = reader->next;
+    pthread_mutex_unlock(&obj->lock);
+    free(reader);
+}
+
+void map_read_lock(map_reader_t reader)
+{
+    uint64_t epoch = __atomic_load_n(&reader->map->epoch, __ATOMIC_ACQUIRE);
+    __atomic_store_n(&reader->epoch, epoch, __ATOMIC_RELAXED);
+
+    /* Either the update scanning the readers sees this epoch, or the loads of
+     * the section see the root the update published before the scan.
+     */
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+}
+
+void map_read_unlock(map_reader_t reader)
+{
+    __atomic_store_n(&reader->epoch, 0, __ATOMIC_RELEASE);
+}
+
+/* Updates */
+
+static map_node_t *rb_node_new(map_t obj, const void *key, const void *data)
+{
+    map_node_t *node = malloc(sizeof(map_node_t) + map_align(obj->key_size) +
+                              map_align(obj->data_size));
+    assert(node);
+
+    node->key = node + 1;
+    node->data = (char *) node->key + map_align(obj->key_size);
+    memcpy(node->key, key, obj->key_size);
+    if (data)
+        memcpy(node->data, data, obj->data_size);
+    else
+        memset(node->data, 0, obj->data_size);
+
+    node->left = node->right = NULL;
+    node->red = true;
+    node->gen = obj->epoch;
+    node->limbo = NULL;
+    return node;
+}
+
+/* Queue a node unlinked by the running update, or free it at once if the
+ * update made it, as no reader could reach it.
+ */
+static void rb_retire(map_t obj, map_node_t *node)
+{
+    if (node->gen == obj->epoch) {
+        free(node);
+        return;
+    }
+
+    node->gen = obj->epoch;
+    node->limbo = NULL;
+    if (obj->limbo_tail)
+        obj->limbo_tail->limbo = node;
+    else
+        obj->limbo_head = node;
+    obj->limbo_tail = node;
+}
+
+/* Return @node if the running update made it, or a copy of it to change in
+ * its place otherwise.
+ */
+static map_node_t *rb_own(map_t obj, map_node_t *node)
+{
+    if (node->gen == obj->epoch)
+        return node;
+
+    map_node_t *copy = rb_node_new(obj, node->key, node->data);
+    copy->left = node->left, copy->right = node->right;
+    copy->red = node->red;
+    rb_retire(obj, node);
+    return copy;
+}
+
+/* Free the nodes of the limbo list that no reader can hold anymore */
+static void rb_reclaim(map_t obj)
+{
+    uint64_t oldest = UINT64_MAX;
+    for (map_reader_t r = obj->readers; r; r = r->next) {
+        uint64_t epoch = __atomic_load_n(&r->epoch, __ATOMIC_ACQUIRE);
+        if (epoch && epoch < oldest)
+            oldest = epoch;
+    }
+
+    while (obj->limbo_head && obj->limbo_head->gen < oldest) {
+        map_node_t *node = obj->limbo_head;
+        obj->limbo_head = node->limbo;
+        free(node);
+    }
+    if (!obj->limbo_head)
+        obj->limbo_tail = NULL;
+}
+
+/* Make @root the tree of the readers, and close the update */
+static void rb_publish(map_t obj, map_node_t *root)
+{
+    __atomic_store_n(&obj->root, root, __ATOMIC_RELEASE);
+    __atomic_add_fetch(&obj->epoch, 1, __ATOMIC_SEQ_CST);
+    /* pairs with the fence of map_read_lock() */
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    rb_reclaim(obj);
+}
+
+/* Below, the node passed to each function is owned by the running update, and
+ * so is any node the function returns.
+ */
+
+static inline bool rb_is_red(const map_node_t *node)
+{
+    return node && node->red;
+}
+
+static map_node_t *rb_rotate_left(map_t obj, map_node_t *node)
+{
+    map_node_t *x = rb_own(obj, node->right);
+    node->right = x->left;
+    x->left = node;
+    x->red = node->red;
+    node->red = true;
+    return x;
+}
+
+static map_node_t *rb_rotate_right(map_t obj, map_node_t *node)
+{
+    map_node_t *x = rb_own(obj, node->left);
+    node->left = x->right;
+    x->right = node;
+    x->red = node->red;
+    node->red = true;
+    return x;
+}
+
+static void rb_flip_colors(map_t obj, map_node_t *node)
+{
+    node->red = !node->red;
+    node->left = rb_own(obj, node->left);
+    node->left->red = !node->left->red;
+    node->right = rb_own(obj, node->right);
+    node->right->red = !node->right->red;
+}
+
+static map_node_t *rb_balance(map_t obj, map_node_t *node)
+{
+    if (rb_is_red(node->right) && !rb_is_red(node->left))
+        node = rb_rotate_left(obj, node);
+    if (rb_is_red(node->left) && rb_is_red(node->left->left))
+        node = rb_rotate_right(obj, node);
+    if (rb_is_red(node->left) && rb_is_red(node->right))
+        rb_flip_colors(obj, node);
+    return node;
+}
+
+/* @key is not in the subtree of @node */
+static map_node_t *rb_insert(map_t obj,
+                             map_node_t *node,
+                             const void *key,
+                             const void *data)
+{
+    if (!node)
+        return rb_node_new(obj, key, data);
+
+    node = rb_own(obj, node);
+    if ((obj->comparator)(key, node->key) == _CMP_LESS)
+        node->left = rb_insert(obj, node->left, key, data);
+    else
+        node->right = rb_insert(obj, node->right, key, data);
+    return rb_balance(obj, node);
+}
+
+static map_node_t *rb_move_red_left(map_t obj, map_node_t *node)
+{
+    rb_flip_colors(obj, node);
+    if (rb_is_red(node->right->left)) {
+        node->right = rb_rotate_right(obj, node->right);
+        node = rb_rotate_left(obj, node);
+        rb_flip_colors(obj, node);
+    }
+    return node;
+}
+
+static map_node_t *rb_move_red_right(map_t obj, map_node_t *node)
+{
+    rb_flip_colors(obj, node);
+    if (rb_is_red(node->left->left)) {
+        node = rb_rotate_right(obj, node);
+        rb_flip_colors(obj, node);
+    }
+    return node;
+}
+
+/* Unlike the other functions, @node may be published */
+static map_node_t *rb_remove_min(map_t obj, map_node_t *node)
+{
+    if (!node->left) {
+        rb_retire(obj, node);
+        return NULL;
+    }
+
+    node = rb_own(obj, node);
+    if (!rb_is_red(node->left) && !rb_is_red(node->left->left))
+        node = rb_move_red_left(obj, node);
+    node->left = rb_remove_min(obj, node->left);
+    return rb_balance(obj, node);
+}
+
+/* @key is in the subtree of @node, which may be published */
+static map_node_t *rb_remove(map_t obj, map_node_t *node, const void *key)
+{
+    node = rb_own(obj, node);
+    if ((obj->comparator)(key, node->key) == _CMP_LESS) {
+        if (!rb_is_red(node->left) && !rb_is_red(node->left->left))
+            node = rb_move_red_left(obj, node);
+        node->left = rb_remove(obj, node->left, key);
+        return rb_balance(obj, node);
+    }
+
+    if (rb_is_red(node->left))
+        node = rb_rotate_right(obj, node);
+    if ((obj->comparator)(key, node->key) == _CMP_EQUAL && !node->right) {
+        rb_retire(obj, node);
+        return NULL;
+    }
+    if (!rb_is_red(node->right) && !rb_is_red(node->right->left))
+        node = rb_move_red_right(obj, node);
+    if ((obj->comparator)(key, node->key) == _CMP_EQUAL) {
+        /* take the place of the successor, which has no left child */
+        map_node_t *min = node->right;
+        while (min->left)
+            min = min->left;
+        memcpy(node->key, min->key, obj->key_size);
+        memcpy(node->data, min->data, obj->data_size);
+        node->right = rb_remove_min(obj, node->right);
+    } else {
+        node->right = rb_remove(obj, node->right, key);
+    }
+    return rb_balance(obj, node);
+}
+
+/* Retire all the nodes of a tree */
+static void rb_retire_all(map_t obj, map_node_t *node)
+{
+    if (!node)
+        return;
+
+    rb_retire_all(obj, node->left);
+    rb_retire_all(obj, node->right);
+    rb_retire(obj, node);
+}
+
+static void rb_free_all(map_node_t *node)
+{
+    if (!node)
+        return;
+
+    rb_free_all(node->left);
+    rb_free_all(node->right);
+    free(node);
+}
+
+/* Constructor */
+map_t map_new(size_t s1,
+              size_t s2,
+              map_cmp_t (*cmp)(const void *, const void *))
+{
+    map_t tree = malloc(sizeof(struct map_internal));
+    assert(tree);
+
+    tree->root = NULL;
+    tree->epoch = 1;
+    tree->key_size = s1, tree->data_size = s2;
+    tree->comparator = cmp;
+    pthread_mutex_init(&tree->lock, NULL);
+    tree->readers = NULL;
+    tree->limbo_head = tree->limbo_tail = NULL;
+    return tree;
+}
+
+/* Add function */
+bool map_insert(map_t obj, void *key, void *val)
+{
+    map_iter_t it;
+
+    pthread_mutex_lock(&obj->lock);
+    map_find(obj, &it, key);
+    if (it.node) {
+        pthread_mutex_unlock(&obj->lock);
+        return false;
+    }
+
+    map_node_t *root = rb_insert(obj, obj->root, key, val);
+    root->red = false;
+    rb_publish(obj, root);
+    pthread_mutex_unlock(&obj->lock);
+    return true;
+}
+
+/* Get functions */
+
+/* Lookups only read nodes reachable from a published root, which never change
+ * afterwards, so they need no other synchronization.
+ */
+void map_find(map_t obj, map_iter_t *it, void *key)
+{
+    map_node_t *node = __atomic_load_n(&obj->root, __ATOMIC_ACQUIRE);
+    while (node) {
+        map_cmp_t cmp = (obj->comparator)(key, node->key);
+        if (cmp == _CMP_EQUAL)
+            break;
+        node = (cmp == _CMP_LESS) ? node->left : node->right;
+    }
+    it->node = node;
+    it->key = node ? node->key : NULL;
+    it->data = node ? node->data : NULL;
+}
+
+bool map_empty(map_t obj)
+{
+    return !__atomic_load_n(&obj->root, __ATOMIC_ACQUIRE);
+}
+
+/* Iteration */
+bool map_at_end(map_t UNUSED, map_iter_t *it)
+{
+    return !it->node;
+}
+
+/* Remove functions */
+
+/* @it must have been filled by a lookup that no other update ran since */
+void map_erase(map_t obj, map_iter_t *it)
+{
+    if (it->node)
+        map_erase_key(obj, it->key);
+}
+
+bool map_erase_key(map_t obj, void *key)
+{
+    map_iter_t it;
+
+    pthread_mutex_lock(&obj->lock);
+    map_find(obj, &it, key);
+    if (!it.node) {
+        pthread_mutex_unlock(&obj->lock);
+        return false;
+    }
+
+    /* @key may belong to a node the removal unlinks, which stays intact until
+     * the update is over.
+     */
+    map_node_t *root = obj->root;
+    if (!rb_is_red(root->left) && !rb_is_red(root->right)) {
+        root = rb_own(obj, root);
+        root->red = true;
+    }
+    root = rb_remove(obj, root, key);
+    if (root)
+        root->red = false;
+    rb_publish(obj, root);
+    pthread_mutex_unlock(&obj->lock);
+    return true;
+}
+
+void map_clear(map_t obj)
+{
+    pthread_mutex_lock(&obj->lock);
+    rb_retire_all(obj, obj->root);
+    rb_publish(obj, NULL);
+    pthread_mutex_unlock(&obj->lock);
+}
+
+/* Destructor */
+void map_delete(map_t obj)
+{
+    rb_free_all(obj->root);
+    while (obj->limbo_head) {
+        map_node_t *node = obj->limbo_head;
+        obj->limbo_head = node->limbo;
+        free(node);
+    }
+    while (obj->readers) {
+        map_reader_t reader = obj->readers;
+        obj->readers = reader->next;
+        free(reader);
+    }
+    pthread_mutex_destroy(&obj->lock);
+    free(obj);
+}
@@ -0,0 +1,106 @@
+/*
+ * rv32emu is freely redistributable under the MIT License. See the file
+ * "LICENSE" for information on usage and redistribution of this file.
+ */
+
+/*
+ * C Implementation for C++ std::map using red-black tree.
+ *
+ * Any data type can be stored in a map, just like std::map.
+ * A map instance requires the specification of two file types:
+ *   1. the key;
+ *   2. what data type the tree node will store;
+ *
+ * It will also require a comparison function to sort the tree.
+ *
+ * This variant lets several threads look up elements while another one
+ * updates the map. A node is never changed once other threads can reach it:
+ * an update copies the nodes along its path and publishes the new tree by
+ * swapping the root, so that a lookup sees the tree either before or after
+ * the update, never in between. Lookups take no lock and finish within the
+ * height of the tree, whatever the other threads do. Updates serialize among
+ * themselves on a lock.
+ *
+ * The nodes an update replaces stay readable until every lookup that might
+ * still hold them is over. The threads that look up elements concurrently
+ * with updates register a reader, and wrap each lookup, along with the use
+ * of the element found, in map_read_lock() and map_read_unlock(). Updates
+ * free the replaced nodes once all the readers have left the sections they
+ * were in (epoch-based reclamation).
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+
+typedef enum { _CMP_LESS = -1, _CMP_EQUAL = 0, _CMP_GREATER = 1 } map_cmp_t;
+
+typedef struct map_internal *map_t;
+
+/* An iterator is valid until the end of the read-side section in which it
+ * was filled. The element it points to is read-only.
+ *
+ * @node: the node of the element, NULL at the end
+ * @key: pointer to the key of the element
+ * @data: pointer to the value of the element
+ */
+typedef struct {
+    struct map_node *node;
+    void *key, *data;
+} map_iter_t;
+
+typedef struct map_reader *map_reader_t;
+
+#define map_iter_value(it, type) (*(type *) (it)->data)
+
+/* Integer comparison */
+static inline map_cmp_t map_cmp_int(const void *arg0, const void *arg1)
+{
+    int *a = (int *) arg0;
+    int *b = (int *) arg1;
+    return (*a < *b) ? _CMP_LESS : (*a > *b) ? _CMP_GREATER : _CMP_EQUAL;
+}
+
+/* Unsigned integer comparison */
+static inline map_cmp_t map_cmp_uint(const void *arg0, const void *arg1)
+{
+    unsigned int *a = (unsigned int *) arg0;
+    unsigned int *b = (unsigned int *) arg1;
+    return (*a < *b) ? _CMP_LESS : (*a > *b) ? _CMP_GREATER : _CMP_EQUAL;
+}
+
+/* Constructor */
+map_t map_new(size_t, size_t, map_cmp_t (*cmp)(const void *, const void *));
+
+/* Readers.
+ * Each thread looking up elements while another thread may update the map
+ * registers its own reader. Read-side sections do not nest. A thread that
+ * only looks up elements while no update runs, such as the only thread
+ * using the map, needs no reader.
+ */
+map_reader_t map_reader_register(map_t);
+void map_reader_unregister(map_t, map_reader_t);
+void map_read_lock(map_reader_t);
+void map_read_unlock(map_reader_t);
+
+/* Add function */
+bool map_insert(map_t, void *, void *);
+
+/* Get functions */
+void map_find(map_t, map_iter_t *, void *);
+bool map_empty(map_t);
+
+/* Iteration */
+bool map_at_end(map_t, map_iter_t *);
+
+/* Remove functions */
+void map_erase(map_t, map_iter_t *);
+bool map_erase_key(map_t, void *);
+void map_clear(map_t);
+
+/* Destructor, once no other thread uses the map */
+void map_delete(map_t);
+
+#define map_init(key_type, element_type, __func) \
+    map_new(sizeof(key_type), sizeof(element_type), __func)
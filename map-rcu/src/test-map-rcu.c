@@ -0,0 +1,231 @@
+#include <assert.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <pthread.h>
+#include <time.h>
+
+#include "map.h"
+
+static void swap(int *x, int *y)
+{
+    int tmp = *x;
+    *x = *y;
+    *y = tmp;
+}
+
+enum { N_NODES = 10000 };
+
+/* return 0 on success; non-zero values on failure */
+static int test_map_mixed_operations()
+{
+    int ret = 0;
+    map_t tree = map_init(int, int, map_cmp_uint);
+
+    int key[N_NODES], val[N_NODES];
+
+    /*
+     *  Generate data for insertion
+     */
+    for (int i = 0; i < N_NODES; i++) {
+        key[i] = i;
+        val[i] = i + 1;
+    }
+
+    /* Fisher-Yates shuffle, keeping each key paired with its value */
+    for (int i = N_NODES - 1; i > 0; i--) {
+        int pos = rand() % (i + 1);
+        swap(&key[i], &key[pos]);
+        swap(&val[i], &val[pos]);
+    }
+
+    /* add first 1/2 items */
+    for (int i = 0; i < N_NODES / 2; i++) {
+        map_iter_t my_it;
+        map_insert(tree, key + i, val + i);
+        map_find(tree, &my_it, key + i);
+        if (!my_it.node) {
+            ret = 1;
+            goto free_tree;
+        }
+        assert(map_iter_value(&my_it, int) == val[i]);
+    }
+
+    /* remove first 1/4 items */
+    for (int i = 0; i < N_NODES / 4; i++) {
+        map_iter_t my_it;
+        map_find(tree, &my_it, key + i);
+        if (map_at_end(tree, &my_it))
+            continue;
+        map_erase(tree, &my_it);
+        map_find(tree, &my_it, key + i);
+        if (my_it.node) {
+            ret = 1;
+            goto free_tree;
+        }
+    }
+
+    /* add the rest */
+    for (int i = N_NODES / 2 + 1; i < N_NODES; i++) {
+        map_iter_t my_it;
+        map_insert(tree, key + i, val + i);
+        map_find(tree, &my_it, key + i);
+        if (!my_it.node) {
+            ret = 1; /* test fail */
+            goto free_tree;
+        }
+        assert(map_iter_value(&my_it, int) == val[i]);
+    }
+
+
+    /* remove 2nd quarter of items */
+    for (int i = N_NODES / 4 + 1; i < N_NODES / 2; i++) {
+        map_iter_t my_it;
+        map_find(tree, &my_it, key + i);
+        if (map_at_end(tree, &my_it)) {
+            ret = 1; /* test fail */
+            goto free_tree;
+        }
+        map_erase(tree, &my_it);
+        map_find(tree, &my_it, key + i);
+        if (my_it.node) {
+            ret = 1; /* test fail */
+            goto free_tree;
+        }
+    }
+
+free_tree:
+    map_clear(tree);
+    map_delete(tree);
+    return ret;
+}
+
+/* The map must remain usable after its nodes were released in bulk */
+static int test_map_clear_reuse()
+{
+    int ret = 0;
+    map_t tree = map_init(int, int, map_cmp_int);
+
+    for (int round = 0; round < 3; round++) {
+        for (int i = 0; i < N_NODES; i++) {
+            int val = i * 2;
+            map_insert(tree, &i, &val);
+        }
+
+        /* punch holes, to be filled by the next round */
+        for (int i = 0; i < N_NODES; i += 3) {
+            map_iter_t my_it;
+            map_find(tree, &my_it, &i);
+            map_erase(tree, &my_it);
+        }
+
+        for (int i = 0; i < N_NODES; i++) {
+            map_iter_t my_it;
+            map_find(tree, &my_it, &i);
+            if ((i % 3 == 0) != map_at_end(tree, &my_it) ||
+                (!map_at_end(tree, &my_it) &&
+                 map_iter_value(&my_it, int) != i * 2)) {
+                ret = 1;
+                goto free_tree;
+            }
+        }
+
+        map_clear(tree);
+        if (!map_empty(tree)) {
+            ret = 1;
+            goto free_tree;
+        }
+    }
+
+free_tree:
+    map_delete(tree);
+    return ret;
+}
+
+
+enum { N_READERS = 4, N_ROUNDS = 5 };
+
+typedef struct {
+    map_t tree;
+    int *stop;
+    int ret;
+} reader_ctx_t;
+
+static void *reader_thread(void *arg)
+{
+    reader_ctx_t *ctx = arg;
+    map_reader_t reader = map_reader_register(ctx->tree);
+
+    while (!__atomic_load_n(ctx->stop, __ATOMIC_ACQUIRE)) {
+        for (int i = 0; i < N_NODES; i++) {
+            map_iter_t my_it;
+            map_read_lock(reader);
+            map_find(ctx->tree, &my_it, &i);
+            /* the even keys stay in the map, the odd ones come and go */
+            if (map_at_end(ctx->tree, &my_it) ? i % 2 == 0
+                                              : map_iter_value(&my_it, int) !=
+                                                    -i)
+                ctx->ret = 1;
+            map_read_unlock(reader);
+        }
+    }
+
+    map_reader_unregister(ctx->tree, reader);
+    return NULL;
+}
+
+/* Lookups running along with updates always find the elements they should */
+static int test_map_readers()
+{
+    int ret = 0, stop = 0;
+    map_t tree = map_init(int, int, map_cmp_int);
+    pthread_t threads[N_READERS];
+    reader_ctx_t ctx[N_READERS];
+
+    for (int i = 0; i < N_NODES; i += 2) {
+        int val = -i;
+        map_insert(tree, &i, &val);
+    }
+    for (int t = 0; t < N_READERS; t++) {
+        ctx[t] = (reader_ctx_t){.tree = tree, .stop = &stop, .ret = 0};
+        pthread_create(threads + t, NULL, reader_thread, ctx + t);
+    }
+
+    int key[N_NODES / 2];
+    for (int i = 0; i < N_NODES / 2; i++)
+        key[i] = i * 2 + 1;
+    for (int round = 0; round < N_ROUNDS; round++) {
+        for (int i = N_NODES / 2 - 1; i > 0; i--)
+            swap(&key[i], &key[rand() % (i + 1)]);
+        for (int i = 0; i < N_NODES / 2; i++) {
+            int val = -key[i];
+            map_insert(tree, key + i, &val);
+        }
+        for (int i = N_NODES / 2; i-- > 0;) {
+            if (!map_erase_key(tree, key + i))
+                ret = 1;
+        }
+    }
+
+    __atomic_store_n(&stop, 1, __ATOMIC_RELEASE);
+    for (int t = 0; t < N_READERS; t++) {
+        pthread_join(threads[t], NULL);
+        ret |= ctx[t].ret;
+    }
+
+    map_delete(tree);
+    return ret;
+}
+
+int main(int argc, char *argv[])
+{
+    (void) argc;
+    (void) argv;
+
+    srand((unsigned) time(NULL));
+    int ret = test_map_mixed_operations();
+    ret |= test_map_clear_reuse();
+    ret |= test_map_readers();
+    printf("%s", (ret == 0) ? "PASS" : "FAIL");
+    return ret;
+}
@@ -1,5 +1,7 @@
 #!/usr/bin/env python3
 
+import os
+
 import pandas as pd
 import matplotlib.pyplot as plt
 import numpy as np
@@ -16,18 +18,65 @@ def subplots(i, j):
         axs = np.asarray([axs])
     return fig, axs
 
-def main():
-    print('---------- plot bench ----------')
+PERCENTILES = ['p50', 'p90', 'p99', 'p99.9', 'max']
+
+def plot_latency():
+    '''
+    df         0         1       2     3     4   5   6   7     8   9
+        testname test_type op_type scale count p50 p90 p99 p99.9 max
+    '''
+    df = pd.read_table(
+        'bench.txt',
+        sep=',',
+        header=None,
+        names=['name', 'test_type', 'op_type', 'scale', 'count'] + PERCENTILES
+        )
+
+    map_names = df['name'].unique()
+    op_types = df['op_type'].unique()
+    scales = df['scale'].unique()
+    test_types = df['test_type'].unique()
+
+    # one row of operations for each scale
+    fig, axs = plt.subplots(len(scales), len(op_types), squeeze=False)
+    fig.suptitle("Compare the operation latencies of the maps")
 
+    for s_ix, scale in enumerate(scales):
+        for o_ix, op_type in enumerate(op_types):
+            ax = axs[s_ix][o_ix]
+            for name in map_names:
+                for test_type in test_types:
+                    data = df.loc[
+                        (df['name'] == name)
+                        & (df['op_type'] == op_type)
+                        & (df['scale'] == scale)
+                        & (df['test_type'] == test_type)
+                       ]
+                    if data.empty:
+                        continue
+                    lat = data[PERCENTILES].iloc[0].tolist()
+                    ax.plot(PERCENTILES, lat, "o-", label=name + " " + str(test_type))
+                    print(name, test_type, scale, op_type, lat)
+            ax.set_yscale("log")
+            ax.set_title(op_type + " " + str(scale))
+
+        axs[s_ix][0].set_ylabel("ns")
+    axs[0][0].legend()
+
+    plt.show()
+
+def plot_time(filename, title, ylabel):
     '''
     df         0       1          2       3          4    5
         testname time(ns) test_type op_type test_scale reps
+    followed, with -p, by the hardware event counts per operation
     '''
     df = pd.read_table(
-        'bench.txt',
+        filename,
         sep=',',
         header=None,
-        names=['name', 'time', 'test_type', 'op_type', 'scale', 'reps']
+        names=['name', 'time', 'test_type', 'op_type', 'scale', 'reps'],
+        usecols=range(6)
         )
 
     map_names = df['name'].unique()
@@ -36,12 +85,14 @@ def main():
     test_types = df['test_type'].unique()
 
     fig, axs = subplots(1, len(op_types))
-    fig.suptitle("Compare propsed and old map average operation time")
+    fig.suptitle(title)
 
     for n_ix, name in enumerate(map_names):
         for test_ix, test_type in enumerate(test_types):
             for o_ix, op_type in enumerate(op_types):
-                tavg = [0.0] * len(scales)
+                # not every map runs every test at every scale
+                xs = []
+                tavg = []
                 for s_ix, scale in enumerate(scales):
                     data = df.loc[
                         (df['name'] == name)
@@ -49,17 +100,39 @@ def main():
                         & (df['scale'] == scale)
                         & (df['test_type'] == test_type)
                        ]
-                    davg = data['time'].mean()
-                    tavg[s_ix] = davg
-                axs[o_ix].plot(scales, tavg, "o-", label=name + " " + str(test_type) + " operation")
-                print(name, test_type, scale, op_type, tavg)
+                    if data.empty:
+                        continue
+                    # each row times "scale" operations
+                    xs.append(scale)
+                    tavg.append(data['time'].mean() / scale)
+                if not xs:
+                    continue
+                axs[o_ix].plot(xs, tavg, "o-", label=name + " " + str(test_type) + " operation")
+                print(name, test_type, op_type, xs, tavg)
                 axs[o_ix].set_xscale("log")
                 #axs[o_ix].set_ylim(0, 1800)
                 axs[o_ix].set_title(op_type)
 
-    axs[0].set_ylabel("ns/op")
+    axs[0].set_ylabel(ylabel)
     axs[0].legend()
 
+def main():
+    print('---------- plot bench ----------')
+
+    # the benchmarks run with -l print percentiles instead of total times
+    with open('bench.txt') as f:
+        if not f.readline().split(',')[1].strip()[0].isdigit():
+            return plot_latency()
+
+    plot_time('bench.txt', "Compare the average operation time of the maps",
+              "ns/op")
+
+    # the threads of a multi-threaded test share its wall-clock time
+    if os.path.exists('bench-threads.txt'):
+        plot_time('bench-threads.txt',
+                  "Compare the maps across threads and invalidation storms",
+                  "wall-clock ns/op")
+
     plt.show()
 
     return